@@ -43,7 +43,9 @@ struct FabComponentBlock {
     using AmrVertexId = typename Component::AmrVertexId;
     using VertexValue = typename Component::VertexValue;
     using Value = typename Grid::Value;
-    using MaskedBox = r::MaskedBox<D>;
+    // link of a cell: FreudenthalConnectivity, FaceConnectivity, EdgeConnectivity or FullConnectivity
+    using Connectivity = r::FreudenthalConnectivity<D>;
+    using MaskedBox = r::MaskedBox<D, Connectivity>;
     using Vertex = typename MaskedBox::Position;
 
     using AmrVertexContainer = std::vector<AmrVertexId>;
@@ -211,9 +213,6 @@ struct FabComponentBlock {
     // compare w.r.t negate_ flag
     bool cmp(Real a, Real b) const;
 
-    void set_low(const diy::Point<int, D>& v_core,
-                 const Real& absolute_rho);
-
     void set_mask(const diy::Point<int, D>& v_mask,
                   diy::AMRLink *l,
                   const Real& rho,
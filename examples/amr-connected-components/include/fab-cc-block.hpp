@@ -47,7 +47,7 @@ FabComponentBlock<Real, D>::FabComponentBlock(diy::GridRef<Real, D>& fab_grid,
 
     if (is_absolute_threshold)
     {
-        init(rho, amr_link, false); // false means: don't call set_low, already did in set_mask
+        init(rho, amr_link, false); // false means: don't mark low cells, already did in set_mask
     }
 }
 
@@ -189,33 +189,6 @@ void FabComponentBlock<Real, D>::set_mask(const diy::Point<int, D>& v_mask,
 
 }
 
-template<class Real, unsigned D>
-void FabComponentBlock<Real, D>::set_low(const diy::Point<int, D>& p_core,
-        const Real& absolute_threshold)
-{
-    if (not local_.is_in_core(p_core))
-        return;
-
-    Vertex p_mask = p_core + Vertex::one();
-    if (local_.mask(p_mask) != MaskedBox::ACTIVE)
-        return;
-
-    Vertex p_bounds = p_core + local_.ghost_adjustment();
-    bool is_low = cmp(absolute_threshold,
-            fab_(p_bounds)); //   negate_ ? fab_(v_bounds) < absolute_threshold : fab_(v_bounds) > absolute_threshold;
-
-    if (is_low)
-    {
-        local_.set_mask(p_mask, MaskedBox::LOW);
-        n_low_++;
-        sum_low_ += fab_(p_bounds);
-    } else
-    {
-        n_active_++;
-        sum_active_ += fab_(p_bounds);
-    }
-}
-
 template<class Real, unsigned D>
 void FabComponentBlock<Real, D>::init(Real absolute_rho, diy::AMRLink* amr_link, bool must_set_low)
 {
@@ -226,9 +199,11 @@ void FabComponentBlock<Real, D>::init(Real absolute_rho, diy::AMRLink* amr_link,
 
     if (must_set_low)
     {
-        diy::for_each(local_.core_shape(), [this, absolute_rho](const Vertex& v_core) {
-            this->set_low(v_core, absolute_rho);
-        });
+        auto low_stats = local_.mark_low(fab_, [this, absolute_rho](Real x) { return this->cmp(absolute_rho, x); });
+        n_low_ += low_stats.n_low;
+        n_active_ += low_stats.n_active;
+        sum_low_ += low_stats.sum_low;
+        sum_active_ += low_stats.sum_active;
     }
 
 #ifdef REEBER_DO_DETAILED_TIMING
@@ -278,9 +253,9 @@ void FabComponentBlock<Real, D>::sparsify_prune_original_tree(const VertexEdgesM
 #endif
 }
 
-template<unsigned D>
+template<unsigned D, class Connectivity>
 r::AmrEdgeContainer
-get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D>& local, diy::AMRLink* l,
+get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D, Connectivity>& local, diy::AMRLink* l,
         const diy::DiscreteBounds& domain, bool wrap)
 {
     using Position = diy::Point<int, D>;
@@ -316,7 +291,7 @@ get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D>& l
         int masking_gid = local.mask(neighb_v_mask);
 
 #ifdef REEBER_ENABLE_CHECKS
-        if (masking_gid == r::MaskedBox<D>::UNINIT)
+        if (masking_gid == r::MaskedBox<D, Connectivity>::UNINIT)
         {
             fmt::print("v_glob = {}, v_glob_idx = {}, neighb_v_mask = {}\n", v_glob, v_glob_idx, masking_gid);
             throw std::runtime_error("bad masking gid");
@@ -360,7 +335,7 @@ get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D>& l
             // neighbour is on the same level or below me, neighbouring vertex corresponds
             // to the unique vertex in a neighbouring block
             size_t neighb_vertex_idx = get_vertex_id(wrapped_neighb_vert_glob, local.refinement(), link_idx, l,
-                    local.mask_grid().c_order());
+                    local.c_order());
 
             result.emplace_back(v_glob_idx, reeber::AmrVertexId{masking_gid, neighb_vertex_idx});
 
@@ -381,8 +356,8 @@ get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D>& l
                         "In get_vertex_edges, v_glob = {}, masking_gid = {}, masking_box_from = {}, masking_box_to = {}\n",
                         v_glob, local.gid(), masking_box_from, masking_box_to);
 
-            reeber::Box<D> masking_box(masking_box_from, masking_box_to);
-            reeber::Box<D> covering_box(masking_box_from - Position::one(), masking_box_to + Position::one());
+            reeber::Box<D, Connectivity> masking_box(masking_box_from, masking_box_to);
+            reeber::Box<D, Connectivity> covering_box(masking_box_from - Position::one(), masking_box_to + Position::one());
 
             for(const Position& masking_position : masking_box.positions())
             {
@@ -407,7 +382,7 @@ get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D>& l
                         r::AmrVertexId masking_vertex_idx{masking_gid,
                                                           get_vertex_id(masking_position_global, nb_refinement,
                                                                   link_idx, l,
-                                                                  local.mask_grid().c_order())};
+                                                                  local.c_order())};
 
                         if (debug)
                         {
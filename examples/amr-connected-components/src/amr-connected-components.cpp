@@ -162,7 +162,7 @@ void read_from_file(std::string infn,
     }
 }
 
-void create_fab_cc_blocks(const diy::mpi::communicator& world, int in_memory, int threads, Real rho, bool absolute,
+void create_fab_cc_blocks(const diy::mpi::communicator& world, int in_memory, int threads, Real absolute_rho,
         bool negate, bool wrap, const diy::FileStorage& storage, diy::Master& master_reader, diy::Master& master,
         const Real cell_volume, const diy::DiscreteBounds& domain)
 {
@@ -171,7 +171,7 @@ void create_fab_cc_blocks(const diy::mpi::communicator& world, int in_memory, in
     // FabBlock can be safely discarded afterwards
 
     master_reader.foreach(
-            [&master, domain, rho, negate, wrap, absolute, cell_volume](FabBlockR* b, const diy::Master::ProxyWithLink& cp) {
+            [&master, domain, absolute_rho, negate, wrap, cell_volume](FabBlockR* b, const diy::Master::ProxyWithLink& cp) {
                 auto* l = static_cast<AMRLink*>(cp.link());
                 AMRLink* new_link = new AMRLink(*l);
 
@@ -184,7 +184,7 @@ void create_fab_cc_blocks(const diy::mpi::communicator& world, int in_memory, in
                         new Block(b->fab, b->extra_names_, b->extra_fabs_, local_ref, local_lev, domain,
                                 l->bounds(),
                                 l->core(), cp.gid(),
-                                new_link, rho, negate, wrap, absolute, cell_volume),
+                                new_link, absolute_rho, negate, wrap, /* is_absolute_threshold = */ true, cell_volume),
                         new_link);
 
             });
@@ -224,6 +224,7 @@ int main(int argc, char** argv)
     // threshold
     Real rho = 81.66;
     Real absolute_rho;
+    Real min_persistence = 0;
     int min_cells = 10;
 
     std::string integral_fields = "";
@@ -243,6 +244,7 @@ int main(int argc, char** argv)
             >> Option('s', "storage", prefix, "storage prefix")
             >> Option('i', "rho", rho, "iso threshold")
             >> Option('x', "mincells", min_cells, "minimal number of cells to output halo")
+            >> Option(      "min-persistence", min_persistence, "skip pairs of lower persistence in the binary diagrams")
             >> Option('f', "function_fields", function_fields, "fields to add for merge tree, separated with , ")
             >> Option(      "integral_fields", integral_fields, "fields to integrate separated with , ")
             >> Option('r', "runs", n_runs, "number of runs")
@@ -256,6 +258,7 @@ int main(int argc, char** argv)
     // ignored for now, wrap is always assumed
     bool wrap = ops >> opts::Present('w', "wrap", "wrap");
     bool split = ops >> opts::Present("split", "use split IO");
+    bool binary_diagrams = ops >> opts::Present("binary-diagrams", "write diagrams as binary (birth, death) pairs");
 
     BoolVector wrap_vec { wrap, wrap, wrap };
 
@@ -337,8 +340,8 @@ int main(int argc, char** argv)
     dlog::Timer timer_cc_exchange;
 
     DurationType time_to_construct_blocks;
-    DurationType time_to_init_blocks;
-    DurationType time_to_get_average;
+    DurationType time_to_init_blocks = 0;
+    DurationType time_to_get_average = 0;
     DurationType cc_send_time = 0;
     DurationType cc_receive_time = 0;
     DurationType cc_exchange_1_time = 0;
@@ -386,99 +389,87 @@ int main(int argc, char** argv)
     LOG_SEV_IF(world.rank() == 0, info) << "Time to read data:       " << dlog::clock_to_string(timer.elapsed());
     dlog::flush();
 
-    timer.restart();
+    // the reader has collected the sum and the number of unmasked cells in each block,
+    // so the mean costs one all-reduce; the blocks are then constructed with the absolute
+    // threshold and set the mask, low cells and local components in one sweep
+    Real mean = std::numeric_limits<Real>::min();
 
-    for(int n_run = 0; n_run < n_runs; ++n_run)
+    if (absolute)
+    {
+        absolute_rho = rho;
+    } else
     {
-        world.barrier();
         timer.restart();
-        timer_all.restart();
-
-        diy::Master master(world, threads, in_memory, &Block::create, &Block::destroy, &storage, &Block::save,
-            &Block::load);
 
-        create_fab_cc_blocks(world, in_memory, threads, rho, absolute, negate, wrap, storage, master_reader, master, cell_volume, domain);
+        master_reader.foreach([](FabBlockR* b, const diy::Master::ProxyWithLink& cp) {
+            auto* l = static_cast<AMRLink*>(cp.link());
+            if (not b->has_unmasked_stats_)
+                compute_unmasked_stats(b, l);
 
-        auto time_for_local_computation = timer.elapsed();
+            Real scaling_factor = 1;
+            for(unsigned i = 0; i < DIM; ++i)
+                scaling_factor /= l->refinement()[0];
 
+            cp.collectives()->clear();
+            cp.all_reduce(b->unmasked_sum_ * scaling_factor, std::plus<Real>());
+            cp.all_reduce(static_cast<Real>(b->n_unmasked_) * scaling_factor, std::plus<Real>());
+        });
 
-#ifdef REEBER_DO_DETAILED_TIMING
-        time_to_construct_blocks = timer.elapsed();
-#endif
+        master_reader.exchange();
 
-        Real mean = std::numeric_limits<Real>::min();
-        Real total_sum;
+        const diy::Master::ProxyWithLink& proxy = master_reader.proxy(master_reader.loaded_block());
 
-        if (absolute)
-        {
-            absolute_rho = rho;
-            LOG_SEV_IF(world.rank() == 0, info) << "Time to compute local trees and components:  "
-                                                << dlog::clock_to_string(timer.elapsed());
-        } else
-        {
-            LOG_SEV_IF(world.rank() == 0, info) << "Time to construct FabComponentBlocks: "
-                                                << dlog::clock_to_string(timer.elapsed());
-            dlog::flush();
-            timer.restart();
+        Real total_sum = proxy.get<Real>();
+        Real total_unmasked = proxy.get<Real>();
 
-            master.foreach([](Block* b, const diy::Master::ProxyWithLink& cp) {
-                cp.collectives()->clear();
-                cp.all_reduce(b->sum_ * b->scaling_factor(), std::plus<Real>());
-                cp.all_reduce(static_cast<Real>(b->n_unmasked_) * b->scaling_factor(), std::plus<Real>());
-            });
+        mean = total_sum / total_unmasked;
 
-            master.exchange();
+        absolute_rho = rho * mean;                                            // now rho contains absolute threshold
+#ifdef REEBER_DO_DETAILED_TIMING
+        time_to_get_average = timer.elapsed();
+#endif
 
-            const diy::Master::ProxyWithLink& proxy = master.proxy(master.loaded_block());
+        LOG_SEV_IF(world.rank() == 0, info) << "Total sum = " << total_sum << ", total_unmasked = "
+                                            << total_unmasked;
 
-            total_sum = proxy.get<Real>();
-            Real total_unmasked = proxy.get<Real>();
+        LOG_SEV_IF(world.rank() == 0, info) << "Average = " << mean << ", rho = " << rho
+                                            << ", absolute_rho = " << absolute_rho
+                                            << ", time to compute average: "
+                                            << dlog::clock_to_string(timer.elapsed());
 
-            mean = total_sum / total_unmasked;
+        if (mean < 0 or std::isnan(mean) or std::isinf(mean) or mean > 1e+40)
+        {
+            LOG_SEV_IF(world.rank() == 0, error) << "Bad average = " << mean << ", do not proceed";
+            if (read_plotfile)
+                amrex::Finalize();
+            return 1;
+        }
 
-            absolute_rho = rho * mean;                                            // now rho contains absolute threshold
-#ifdef REEBER_DO_DETAILED_TIMING
-            time_to_get_average = timer.elapsed();
-#endif
+        dlog::flush();
+    }
 
-            LOG_SEV_IF(world.rank() == 0, info) << "Total sum = " << total_sum << ", total_unmasked = "
-                                                << total_unmasked;
+    timer.restart();
 
-            LOG_SEV_IF(world.rank() == 0, info) << "Average = " << mean << ", rho = " << rho
-                                                << ", absolute_rho = " << absolute_rho
-                                                << ", time to compute average: "
-                                                << dlog::clock_to_string(timer.elapsed());
+    for(int n_run = 0; n_run < n_runs; ++n_run)
+    {
+        world.barrier();
+        timer.restart();
+        timer_all.restart();
 
-            if (mean < 0 or std::isnan(mean) or std::isinf(mean) or mean > 1e+40)
-            {
-                LOG_SEV_IF(world.rank() == 0, error) << "Bad average = " << mean << ", do not proceed";
-                if (read_plotfile)
-                    amrex::Finalize();
-                return 1;
-            }
+        diy::Master master(world, threads, in_memory, &Block::create, &Block::destroy, &storage, &Block::save,
+            &Block::load);
 
-            time_for_local_computation += timer.elapsed();
-            dlog::flush();
-            timer.restart();
+        create_fab_cc_blocks(world, in_memory, threads, absolute_rho, negate, wrap, storage, master_reader, master, cell_volume, domain);
 
-            long int local_active = 0;
-            master.foreach([absolute_rho, &local_active](Block* b, const diy::Master::ProxyWithLink& cp)
-            {
-                AMRLink* l = static_cast<AMRLink*>(cp.link());
-                b->init(absolute_rho, l, true);
-                cp.collectives()->clear();
-                local_active += b->n_active_;
-            });
+        auto time_for_local_computation = timer.elapsed();
 
-            dlog::flush();
 
 #ifdef REEBER_DO_DETAILED_TIMING
-            time_to_init_blocks = timer.elapsed();
+        time_to_construct_blocks = timer.elapsed();
 #endif
 
-            LOG_SEV_IF(world.rank() == 0, info) << "Time to initialize FabComponentBlocks (low vertices, local trees, components, outgoing edges): " << timer.elapsed();
-            time_for_local_computation += timer.elapsed();
-        }
+        LOG_SEV_IF(world.rank() == 0, info) << "Time to compute local trees and components:  "
+                                            << dlog::clock_to_string(timer.elapsed());
 
         dlog::flush();
 
@@ -616,7 +607,13 @@ int main(int argc, char** argv)
 
         bool verbose = false;
 
-        if (write_diag)
+        if (write_diag && binary_diagrams)
+        {
+            bool ignore_zero_persistence = true;
+            IsAmrVertexLocal test_local;
+            DiagramWriter<Block, IsAmrVertexLocal> writer(output_diagrams_filename, world, test_local, absolute_rho, ignore_zero_persistence, min_persistence);
+            writer.write(master);
+        } else if (write_diag)
         {
             bool ignore_zero_persistence = true;
             OutputPairsR::ExtraInfo extra(output_diagrams_filename, verbose, world);
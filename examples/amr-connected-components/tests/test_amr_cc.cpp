@@ -615,7 +615,8 @@ TEST_CASE("Check blocks constructor in simplest case", "[FabTmtBlock][dim2]")
         for(int i = 0; i < n_blocks; ++i)
         {
             REQUIRE(blocks[i].components_.size() == 1);
-            if (correct_masks[i] != blocks[i].local_.mask_grid())
+            auto mask = blocks[i].local_.mask_grid();
+            if (correct_masks[i] != mask)
             {
                 fmt::print("ACHTUNG!, i = {}\n", i);
                 for(int kkk = 0; kkk < correct_masks[i].size(); ++kkk)
@@ -625,14 +626,14 @@ TEST_CASE("Check blocks constructor in simplest case", "[FabTmtBlock][dim2]")
                     v.vertex = kkk;
                     MaskedBox::Position local_pos = blocks[i].local_.local_position(v);
                     MaskedBox::Position global_pos = blocks[i].local_.global_position(v);
-                    auto my_value = blocks[i].local_.mask_grid()(v);
+                    auto my_value = mask(v);
                     auto correct_value = correct_masks[i](v);
                     if (my_value != correct_value)
                         fmt::print("i = {}, local pos = {}, global pos = {}, correct = {}, my = {}\n", i, local_pos,
                                 global_pos, correct_value, my_value);
                 }
             }
-            REQUIRE(correct_masks[i] == blocks[i].local_.mask_grid());
+            REQUIRE(correct_masks[i] == mask);
         }
 
 
@@ -856,7 +857,8 @@ TEST_CASE("Check blocks constructor in simplest case-no ghosts", "[FabTmtBlock][
         for(int i = 0; i < n_blocks; ++i)
         {
             REQUIRE(blocks[i].components_.size() == 1);
-            if (correct_masks[i] != blocks[i].local_.mask_grid())
+            auto mask = blocks[i].local_.mask_grid();
+            if (correct_masks[i] != mask)
             {
                 fmt::print("ACHTUNG!, i = {}\n", i);
                 for(int i1 = 0; i1 < correct_masks[i].size(); ++i1)
@@ -866,14 +868,14 @@ TEST_CASE("Check blocks constructor in simplest case-no ghosts", "[FabTmtBlock][
                     v.vertex = i1;
                     MaskedBox::Position local_pos = blocks[i].local_.local_position(v);
                     MaskedBox::Position global_pos = blocks[i].local_.global_position(v);
-                    auto my_value = blocks[i].local_.mask_grid()(v);
+                    auto my_value = mask(v);
                     auto correct_value = correct_masks[i](v);
                     if (my_value != correct_value)
                         fmt::print("i = {}, local pos = {}, global pos = {}, correct = {}, my = {}\n", i, local_pos,
                                 global_pos, correct_value, my_value);
                 }
             }
-            REQUIRE(correct_masks[i] == blocks[i].local_.mask_grid());
+            REQUIRE(correct_masks[i] == mask);
         }
 
 
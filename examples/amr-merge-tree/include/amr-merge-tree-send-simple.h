@@ -60,6 +60,60 @@ void expand_link(FabTmtBlock<Real, D>* b,
     cp.master()->add_expected(n_added);
 }
 
+// delta exchange: the original link gids go to a receiver only once, and the link
+// only grows (see expand_link), so only the entries added since the last round are sent;
+// receive_link_delta accumulates them on the other side
+template<class Real, unsigned D>
+void send_link_delta(FabTmtBlock<Real, D>* b, const diy::Master::ProxyWithLink& cp, AMRLink* l, const diy::BlockID& receiver)
+{
+    auto sent = b->sent_link_size_.find(receiver.gid);
+    int first_contact = (sent == b->sent_link_size_.end());
+    int n_sent = first_contact ? 0 : sent->second;
+
+    cp.enqueue(receiver, first_contact);
+    if (first_contact)
+        cp.enqueue(receiver, b->get_original_link_gids());
+
+    AMRLink delta(l->dimension(), l->level(), l->refinement(), l->core(), l->bounds());
+    for(int k = n_sent; k < l->size(); ++k)
+    {
+        delta.add_neighbor(l->target(k));
+        delta.add_bounds(l->level(k), l->refinement(k), l->core(k), l->bounds(k));
+    }
+    diy::MemoryBuffer& out = cp.outgoing(receiver);
+    diy::LinkFactory::save(out, &delta);
+
+    b->sent_link_size_[receiver.gid] = l->size();
+}
+
+template<class Real, unsigned D>
+void receive_link_delta(FabTmtBlock<Real, D>* b, const diy::Master::ProxyWithLink& cp, const diy::BlockID& sender,
+                        std::vector<AMRLink>& received_links, std::vector<std::vector<int>>& received_original_gids)
+{
+    int first_contact;
+    cp.dequeue(sender, first_contact);
+    if (first_contact)
+        cp.dequeue(sender, b->peer_original_link_gids_[sender.gid]);
+    received_original_gids.push_back(b->peer_original_link_gids_[sender.gid]);
+
+    diy::MemoryBuffer& in = cp.incoming(sender.gid);
+    AMRLink* delta = static_cast<AMRLink*>(diy::LinkFactory::load(in));
+    if (first_contact)
+        b->peer_links_.erase(sender.gid);
+    auto peer_link = b->peer_links_.emplace(sender.gid, *delta);
+    if (!peer_link.second)
+    {
+        AMRLink& link = peer_link.first->second;
+        for(int k = 0; k < delta->size(); ++k)
+        {
+            link.add_neighbor(delta->target(k));
+            link.add_bounds(delta->level(k), delta->refinement(k), delta->core(k), delta->bounds(k));
+        }
+    }
+    delete delta;
+    received_links.push_back(peer_link.first->second);
+}
+
 template<class Real, unsigned D>
 void amr_tmt_send(FabTmtBlock<Real, D>* b, const diy::Master::ProxyWithLink& cp)
 {
@@ -80,12 +134,17 @@ void amr_tmt_send(FabTmtBlock<Real, D>* b, const diy::Master::ProxyWithLink& cp)
     {
         int receiver_gid = receiver.gid;
 
-        cp.enqueue(receiver, b->get_original_link_gids());
+        if (b->delta_exchange_)
+            send_link_delta(b, cp, l, receiver);
+        else
+        {
+            cp.enqueue(receiver, b->get_original_link_gids());
 
-        //if (debug) fmt::print("In send_simple for block = {}, receiver = {}, enqueued original_link_gids = {}\n", b->gid, receiver.gid, container_to_string(b->get_original_link_gids()));
+            //if (debug) fmt::print("In send_simple for block = {}, receiver = {}, enqueued original_link_gids = {}\n", b->gid, receiver.gid, container_to_string(b->get_original_link_gids()));
 
-        diy::MemoryBuffer& out = cp.outgoing(receiver);
-        diy::LinkFactory::save(out, l);
+            diy::MemoryBuffer& out = cp.outgoing(receiver);
+            diy::LinkFactory::save(out, l);
+        }
 
         // if we have sent our tree to this receiver before, only send n_trees = 0
         // else send the tree and all outgoing edges
@@ -102,7 +161,16 @@ void amr_tmt_send(FabTmtBlock<Real, D>* b, const diy::Master::ProxyWithLink& cp)
         {
             // send local tree and all outgoing edges that end in receiver
             cp.enqueue(receiver, b->original_tree_);
-            cp.enqueue(receiver, b->original_vertex_to_deepest_);
+            if (b->delta_exchange_)
+            {
+                // the receiver already has (and never overwrites) the entries of its own vertices
+                typename FabTmtBlock<Real, D>::VertexVertexMap vertex_to_deepest;
+                for(const auto& vertex_deepest : b->original_vertex_to_deepest_)
+                    if (vertex_deepest.first.gid != receiver_gid)
+                        vertex_to_deepest.insert(vertex_to_deepest.end(), vertex_deepest);
+                cp.enqueue(receiver, vertex_to_deepest);
+            } else
+                cp.enqueue(receiver, b->original_vertex_to_deepest_);
             cp.enqueue(receiver, b->get_original_deepest_vertices());
             cp.enqueue(receiver, b->get_all_outgoing_edges());
 
@@ -185,12 +253,17 @@ void amr_tmt_receive(FabTmtBlock<Real, D>* b, const diy::Master::ProxyWithLink&
     {
         int n_trees;
 
-        received_original_gids.emplace_back();
-        cp.dequeue(sender, received_original_gids.back());
-        diy::MemoryBuffer& in = cp.incoming(sender.gid);
-        AMRLink* l = static_cast<AMRLink*>(diy::LinkFactory::load(in));
-        received_links.push_back(*l);
-        delete l;
+        if (b->delta_exchange_)
+            receive_link_delta(b, cp, sender, received_links, received_original_gids);
+        else
+        {
+            received_original_gids.emplace_back();
+            cp.dequeue(sender, received_original_gids.back());
+            diy::MemoryBuffer& in = cp.incoming(sender.gid);
+            AMRLink* l = static_cast<AMRLink*>(diy::LinkFactory::load(in));
+            received_links.push_back(*l);
+            delete l;
+        }
 
         cp.dequeue(sender, n_trees);
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdexcept>
+
 #include <diy/serialization.hpp>
 #include <diy/grid.hpp>
 #include <diy/vertices.hpp>
@@ -66,6 +68,11 @@ struct FabBlock
     std::vector<std::string> extra_names_; // vector of names additional components
     std::vector<diy::GridRef<T, D>> extra_fabs_; // vector of additional components' data
 
+    // sum and number of the core cells not covered by a finer block (to compute the mean);
+    // filled in by the reader while it streams the data in, or by compute_unmasked_stats
+    T unmasked_sum_ { 0 };
+    long long int n_unmasked_ { 0 };
+    bool has_unmasked_stats_ { false };
 };
 
 template<class T, unsigned D>
@@ -120,3 +127,49 @@ void change_to_c_order(FabBlock<T, D>* b)
 
 }
 
+// sweep the core of the block and skip the cells that a neighbor one level above contains,
+// i.e., the cells that FabTmtBlock and FabComponentBlock mask
+template<class T, unsigned D>
+void compute_unmasked_stats(FabBlock<T, D>* b, diy::AMRLink* l)
+{
+    using Vertex = typename FabBlock<T, D>::Vertex;
+
+    Vertex core_from = point_from_dynamic_point<D>(l->core().min);
+    Vertex core_to = point_from_dynamic_point<D>(l->core().max);
+    Vertex bounds_from = point_from_dynamic_point<D>(l->bounds().min);
+
+    // neighbor_contains compares a single refinement per block
+    auto is_isotropic = [](const auto& r) {
+        for(unsigned i = 1; i < D; ++i)
+            if (r[i] != r[0])
+                return false;
+        return true;
+    };
+
+    if (not is_isotropic(l->refinement()))
+        throw std::runtime_error("compute_unmasked_stats: refinement must be the same along all axes");
+    int ref = l->refinement()[0];
+
+    std::vector<int> finer_neighbors;
+    for(int i = 0; i < l->size(); ++i)
+        if (l->level(i) == l->level() + 1)
+        {
+            if (not is_isotropic(l->refinement(i)))
+                throw std::runtime_error("compute_unmasked_stats: refinement must be the same along all axes");
+            finer_neighbors.push_back(i);
+        }
+
+    b->unmasked_sum_ = 0;
+    b->n_unmasked_ = 0;
+
+    diy::for_each(core_to - core_from + Vertex::one(), [&](const Vertex v) {
+        Vertex v_glob = v + core_from;
+        for(int i : finer_neighbors)
+            if (neighbor_contains<D>(i, l, v_glob, ref))
+                return;
+        b->unmasked_sum_ += b->fab(v_glob - bounds_from);
+        b->n_unmasked_++;
+    });
+
+    b->has_unmasked_stats_ = true;
+}
@@ -35,7 +35,9 @@ struct FabTmtBlock
     // index of point: first = index inside box, second = index of a box
     using AmrVertexId = r::AmrVertexId;
     using Value = typename Grid::Value;
-    using MaskedBox = r::MaskedBox<D>;
+    // link of a cell: FreudenthalConnectivity, FaceConnectivity, EdgeConnectivity or FullConnectivity
+    using Connectivity = r::FreudenthalConnectivity<D>;
+    using MaskedBox = r::MaskedBox<D, Connectivity>;
     using Vertex = typename MaskedBox::Position;
     using TripletMergeTree = r::TripletMergeTree<r::AmrVertexId, Value>;
     using AmrVertexContainer = std::vector<AmrVertexId>;
@@ -197,6 +199,12 @@ struct FabTmtBlock
     std::set<int> new_receivers_;
     std::set<int> processed_receivers_;
 
+    // delta exchange mode: only what a peer has not received yet is sent in amr_tmt_send
+    bool delta_exchange_ { false };
+    std::map<int, int> sent_link_size_;                         // receiver gid -> number of link entries sent
+    std::map<int, GidVector> peer_original_link_gids_;          // sender gid -> its original link gids
+    std::map<int, diy::AMRLink> peer_links_;                    // sender gid -> its link, accumulated
+
     GidVector original_link_gids_;
 
     bool negate_;
@@ -305,14 +313,14 @@ struct FabTmtBlock
 
     void sparsify_prune_original_tree();
 
+    // cancel the branches of persistence below epsilon in the tree we send to the other blocks
+    void simplify_original_tree(Real epsilon);
+
     void sparsify_local_tree(const AmrVertexSet& keep);
 
     // compare w.r.t negate_ flag
     bool cmp(Real a, Real b) const;
 
-    void set_low(const diy::Point<int, D>& v_bounds,
-                 const Real& absolute_rho);
-
 
     void set_mask(const diy::Point<int, D>& v_mask,
                   diy::AMRLink *l,
@@ -182,35 +182,15 @@ void FabTmtBlock<Real, D>::set_mask(const diy::Point<int, D>& v_mask,
     }
 }
 
-template<class Real, unsigned D>
-void FabTmtBlock<Real, D>::set_low(const diy::Point<int, D>& v_bounds,
-        const Real& absolute_threshold)
-{
-    auto v_mask = local_.mask_position_from_local(v_bounds);
-    if (local_.mask(v_mask) != MaskedBox::ACTIVE)
-        return;
-    bool is_low = cmp(absolute_threshold,
-            fab_(v_bounds)); //   negate_ ? fab_(v_bounds) < absolute_threshold : fab_(v_bounds) > absolute_threshold;
-    if (is_low)
-    {
-        n_low_++;
-        local_.set_mask(v_mask, MaskedBox::LOW);
-    } else
-    {
-        n_active_++;
-//        if (gid == 0) fmt::print("HERE ACTIVE: {}\n", local_.global_position_from_local(v_bounds));
-    }
-}
-
 template<class Real, unsigned D>
 void FabTmtBlock<Real, D>::init(Real absolute_rho, diy::AMRLink* amr_link)
 {
     bool debug = false; //gid == 1 or gid == 100;
     std::string debug_prefix = "In FabTmtBlock::init, gid = " + std::to_string(gid);
 
-    diy::for_each(local_.bounds_shape(), [this, absolute_rho](const Vertex& v_bounds) {
-        this->set_low(v_bounds, absolute_rho);
-    });
+    auto low_stats = local_.mark_low(fab_, [this, absolute_rho](Real x) { return this->cmp(absolute_rho, x); });
+    n_low_ += low_stats.n_low;
+    n_active_ += low_stats.n_active;
 
     if (debug)
         fmt::print("{}, absolute_rho = {}, n_active = {}, n_masked = {}, total_size = {}, level = {}\n", debug_prefix,
@@ -269,6 +249,22 @@ void FabTmtBlock<Real, D>::sparsify_prune_original_tree()
 #endif
 }
 
+template<class Real, unsigned D>
+void FabTmtBlock<Real, D>::simplify_original_tree(Real epsilon)
+{
+    // same vertices as in sparsify_prune_original_tree: the branches that carry them stay
+    std::unordered_set<AmrVertexId> special;
+    for(const AmrEdge& out_edge : get_all_outgoing_edges())
+    {
+        special.insert(std::get<0>(out_edge));
+    }
+    for(AmrVertexId od : original_deepest_)
+    {
+        special.insert(od);
+    }
+    r::simplify(original_tree_, epsilon, [&special](AmrVertexId u) { return special.find(u) != special.end(); });
+}
+
 template<class Real, unsigned D>
 void FabTmtBlock<Real, D>::sparsify_local_tree(const FabTmtBlock::AmrVertexSet& keep)
 {
@@ -278,9 +274,9 @@ void FabTmtBlock<Real, D>::sparsify_local_tree(const FabTmtBlock::AmrVertexSet&
             { return u.gid == this->gid or keep.find(u) != keep.end(); });
 #endif
 }
-template<unsigned D>
+template<unsigned D, class Connectivity>
 r::AmrEdgeContainer
-get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D>& local, diy::AMRLink* l,
+get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D, Connectivity>& local, diy::AMRLink* l,
         const diy::DiscreteBounds& domain, bool debug = false)
 {
     using Position = diy::Point<int, D>;
@@ -351,7 +347,7 @@ get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D>& l
             // neighbour is on the same level or below me, neighbouring vertex corresponds
             // to the unique vertex in a neighbouring block
             size_t neighb_vertex_idx = get_vertex_id(wrapped_neighb_vert_glob, local.refinement(), link_idx, l,
-                    local.mask_grid().c_order());
+                    local.c_order());
 
             result.emplace_back(v_glob_idx, reeber::AmrVertexId{masking_gid, neighb_vertex_idx});
 
@@ -372,8 +368,8 @@ get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D>& l
                         "In get_vertex_edges, v_glob = {}, masking_gid = {}, masking_box_from = {}, masking_box_to = {}\n",
                         v_glob, local.gid(), masking_box_from, masking_box_to);
 
-            reeber::Box<D> masking_box(masking_box_from, masking_box_to);
-            reeber::Box<D> covering_box(masking_box_from - Position::one(), masking_box_to + Position::one());
+            reeber::Box<D, Connectivity> masking_box(masking_box_from, masking_box_to);
+            reeber::Box<D, Connectivity> covering_box(masking_box_from - Position::one(), masking_box_to + Position::one());
 
             for(const Position& masking_position : masking_box.positions())
             {
@@ -398,7 +394,7 @@ get_vertex_edges(const diy::Point<int, D>& v_glob, const reeber::MaskedBox<D>& l
                         r::AmrVertexId masking_vertex_idx{masking_gid,
                                                           get_vertex_id(masking_position_global, nb_refinement,
                                                                   link_idx, l,
-                                                                  local.mask_grid().c_order())};
+                                                                  local.c_order())};
 
                         if (debug)
                         {
@@ -1090,6 +1086,15 @@ void FabTmtBlock<Real, D>::save(const void* b, diy::BinaryBuffer& bb)
 //    diy::save(bb, block->components_disjoint_set_parent_);
 //    diy::save(bb, block->components_disjoint_set_size_);
     diy::save(bb, block->round_);
+    diy::save(bb, block->delta_exchange_);
+    diy::save(bb, block->sent_link_size_);
+    diy::save(bb, block->peer_original_link_gids_);
+    diy::save(bb, block->peer_links_.size());
+    for(const auto& gid_link : block->peer_links_)
+    {
+        diy::save(bb, gid_link.first);
+        diy::LinkFactory::save(bb, &gid_link.second);
+    }
 }
 
 template<class Real, unsigned D>
@@ -1113,5 +1118,18 @@ void FabTmtBlock<Real, D>::load(void* b, diy::BinaryBuffer& bb)
 //    diy::load(bb, block->components_disjoint_set_parent_);
 //    diy::load(bb, block->components_disjoint_set_size_);
     diy::load(bb, block->round_);
+    diy::load(bb, block->delta_exchange_);
+    diy::load(bb, block->sent_link_size_);
+    diy::load(bb, block->peer_original_link_gids_);
+    size_t n_peer_links;
+    diy::load(bb, n_peer_links);
+    for(size_t i = 0; i < n_peer_links; ++i)
+    {
+        int peer_gid;
+        diy::load(bb, peer_gid);
+        diy::AMRLink* l = static_cast<diy::AMRLink*>(diy::LinkFactory::load(bb));
+        block->peer_links_.emplace(peer_gid, *l);
+        delete l;
+    }
 }
 
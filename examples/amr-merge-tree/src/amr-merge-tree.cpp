@@ -248,6 +248,8 @@ int main(int argc, char** argv)
     // threshold
     Real rho = 81.66;
     Real absolute_rho;
+    Real min_persistence = 0;
+    Real epsilon = 0;
     int min_cells = 10;
     int n_runs = 1;
 
@@ -264,6 +266,8 @@ int main(int argc, char** argv)
             >> Option('s', "storage", prefix, "storage prefix")
             >> Option('i', "rho", rho, "iso threshold")
             >> Option('x', "mincells", min_cells, "minimal number of cells to output halo")
+            >> Option(      "min-persistence", min_persistence, "skip pairs of lower persistence in the binary diagrams")
+            >> Option('e', "epsilon", epsilon, "cancel the branches of lower persistence in the trees sent to the other blocks")
             >> Option('f', "fields", fields_to_read, "comma-separated list of fields to read")
             >> Option('r', "runs", n_runs, "number of runs")
             >> Option('p', "profile", profile_path, "path to keep the execution profile")
@@ -276,6 +280,8 @@ int main(int argc, char** argv)
     // ignored for now, wrap is always assumed
     bool wrap = ops >> opts::Present('w', "wrap", "wrap");
     bool split = ops >> opts::Present("split", "use split IO");
+    bool binary_diagrams = ops >> opts::Present("binary-diagrams", "write diagrams as binary (birth, death) pairs");
+    bool delta_exchange = ops >> opts::Present("delta-exchange", "in the tree exchange rounds, send each neighbor only what it has not received yet");
 
     bool print_stats = ops >> opts::Present("stats", "print statistics");
     std::string input_filename, output_filename, output_diagrams_filename, output_integral_filename;
@@ -341,8 +347,8 @@ int main(int argc, char** argv)
     dlog::Timer timer_tmt_exchange;
 
     DurationType time_to_construct_blocks;
-    DurationType time_to_init_blocks;
-    DurationType time_to_get_average;
+    DurationType time_to_init_blocks {};
+    DurationType time_to_get_average {};
     DurationType tmt_send_time = timer_send.elapsed();
     DurationType tmt_receive_time = timer_receieve.elapsed();
     DurationType tmt_exchange_1_time = timer_receieve.elapsed();
@@ -384,6 +390,65 @@ int main(int argc, char** argv)
     LOG_SEV_IF(world.rank() == 0, info) << "Data read, local size = " << master_reader.size();
     LOG_SEV_IF(world.rank() == 0, info) << "Time to read data:       " << dlog::clock_to_string(timer.elapsed());
     dlog::flush();
+
+    // the reader has collected the sum and the number of unmasked cells in each block,
+    // so the mean costs one all-reduce; the blocks are then constructed with the absolute
+    // threshold and set the mask, low cells and local trees in one sweep
+    Real mean = std::numeric_limits<Real>::min();
+
+    if (absolute)
+    {
+        absolute_rho = rho;
+    } else
+    {
+        timer.restart();
+
+        master_reader.foreach([debug](FabBlockR* b, const diy::Master::ProxyWithLink& cp) {
+            auto* l = static_cast<AMRLink*>(cp.link());
+            if (not b->has_unmasked_stats_)
+                compute_unmasked_stats(b, l);
+
+            Real scaling_factor = 1;
+            for(unsigned i = 0; i < DIM; ++i)
+                scaling_factor /= l->refinement()[0];
+
+            cp.collectives()->clear();
+            cp.all_reduce(b->unmasked_sum_ * scaling_factor, std::plus<Real>());
+            cp.all_reduce(static_cast<Real>(b->n_unmasked_) * scaling_factor, std::plus<Real>());
+            if (debug)
+                fmt::print("BEFORE EXCHANgE gid = {}, sum = {}, n_unmasked = {}\n", cp.gid(), b->unmasked_sum_,
+                        b->n_unmasked_);
+        });
+
+        master_reader.exchange();
+
+        const diy::Master::ProxyWithLink& proxy = master_reader.proxy(master_reader.loaded_block());
+
+        Real total_sum = proxy.get<Real>();
+        Real total_unmasked = proxy.get<Real>();
+
+        mean = total_sum / total_unmasked;
+        absolute_rho = rho * mean;                                            // now rho contains absolute threshold
+
+        LOG_SEV_IF(world.rank() == 0, info) << "Average = " << mean << ", rho = " << rho
+                                                            << ", absolute_rho =  " << absolute_rho
+                                                            << ", time to compute average: "
+                                                            << dlog::clock_to_string(timer.elapsed());
+#ifdef DO_DETAILED_TIMING
+        time_to_get_average = timer.elapsed();
+#endif
+
+        dlog::flush();
+
+        if (mean < 0 or std::isnan(mean) or std::isinf(mean) or mean > 1e+40)
+        {
+            LOG_SEV_IF(world.rank() == 0, error) << "Bad average = " << mean << ", do not proceed";
+            if (read_plotfile)
+                amrex::Finalize();
+            return 1;
+        }
+    }
+
     for(int n_run = 0; n_run < n_runs; ++n_run)
     {
 
@@ -397,7 +462,7 @@ int main(int argc, char** argv)
         // FabBlock can be safely discarded afterwards
 
         master_reader.foreach(
-                [&master, domain, rho, negate, absolute](FabBlockR* b, const diy::Master::ProxyWithLink& cp) {
+                [&master, domain, absolute_rho, negate](FabBlockR* b, const diy::Master::ProxyWithLink& cp) {
                     auto* l = static_cast<AMRLink*>(cp.link());
                     AMRLink* new_link = new AMRLink(*l);
 
@@ -408,7 +473,7 @@ int main(int argc, char** argv)
 
                     master.add(cp.gid(),
                             new Block(b->fab, local_ref, local_lev, domain, l->bounds(), l->core(), cp.gid(),
-                                    new_link, rho, negate, absolute),
+                                    new_link, absolute_rho, negate, /* is_absolute_threshold = */ true),
                             new_link);
 
                 });
@@ -419,88 +484,24 @@ int main(int argc, char** argv)
         time_to_construct_blocks = timer.elapsed();
 #endif
 
-        Real mean = std::numeric_limits<Real>::min();
-
         if (debug)
         {
             master.foreach([debug](Block* b, const diy::Master::ProxyWithLink& cp) {
                 auto* l = static_cast<diy::AMRLink*>(cp.link());
                 {
                     fmt::print(
-                            "master, FabTmtBlocks: gid = {}: level = {}, shape = {}, core = {} - {}, bounds = {} - {}, sum_  = {}, n_active = {}, local = {}\n",
+                            "master, FabTmtBlocks: gid = {}: level = {}, shape = {}, core = {} - {}, bounds = {} - {}, n_active = {}, local = {}\n",
                             cp.gid(), l->level(), b->fab_.shape(),
                             l->core().min, l->core().max,
                             l->bounds().min, l->bounds().max,
-                            b->sum_,
                             b->n_active_,
                             b->local_);
                 }
             });
         }
 
-        if (absolute)
-        {
-            absolute_rho = rho;
-            LOG_SEV_IF(world.rank() == 0, info) << "Time to compute local trees and components:  "
-                    << dlog::clock_to_string(timer.elapsed());
-        } else
-        {
-            LOG_SEV_IF(world.rank() == 0, info) << "Time to construct FabTmtBlocks: "
-                    << dlog::clock_to_string(timer.elapsed());
-            dlog::flush();
-            timer.restart();
-
-            master.foreach([debug](Block* b, const diy::Master::ProxyWithLink& cp) {
-                cp.collectives()->clear();
-                cp.all_reduce(b->sum_ * b->scaling_factor(), std::plus<Real>());
-                cp.all_reduce(static_cast<Real>(b->n_unmasked_) * b->scaling_factor(), std::plus<Real>());
-                if (debug)
-                    fmt::print("BEFORE EXCHANgE gid = {}, sum = {}, n_unmasked = {}\n", b->gid, b->sum_,
-                            b->n_unmasked_);
-            });
-
-            master.exchange();
-
-            const diy::Master::ProxyWithLink& proxy = master.proxy(master.loaded_block());
-
-            mean = proxy.get<Real>() / proxy.get<Real>();
-            absolute_rho = rho * mean;                                            // now rho contains absolute threshold
-
-            LOG_SEV_IF(world.rank() == 0, info) << "Average = " << mean << ", rho = " << rho
-                                                                << ", absolute_rho =  " << absolute_rho
-                                                                << ", time to compute average: "
-                                                                << dlog::clock_to_string(timer.elapsed());
-#ifdef DO_DETAILED_TIMING
-            time_to_get_average = timer.elapsed();
-#endif
-            time_for_local_computation += timer.elapsed();
-
-            dlog::flush();
-
-            if (mean < 0 or std::isnan(mean) or std::isinf(mean) or mean > 1e+40)
-            {
-                LOG_SEV_IF(world.rank() == 0, error) << "Bad average = " << mean << ", do not proceed";
-                if (read_plotfile)
-                    amrex::Finalize();
-                return 1;
-            }
-
-            timer.restart();
-            master.foreach([absolute_rho](Block* b, const diy::Master::ProxyWithLink& cp) {
-                AMRLink* l = static_cast<AMRLink*>(cp.link());
-                b->init(absolute_rho, l);
-                cp.collectives()->clear();
-            });
-
-#ifdef DO_DETAILED_TIMING
-            time_to_init_blocks = timer.elapsed();
-#endif
-
-            LOG_SEV_IF(world.rank() == 0, info) <<
-            "Time to initialize FabTmtBlocks (low vertices, local trees, components, outgoing edges): "
-                    << timer.elapsed();
-            time_for_local_computation += timer.elapsed();
-        }
+        LOG_SEV_IF(world.rank() == 0, info) << "Time to compute local trees and components:  "
+                << dlog::clock_to_string(timer.elapsed());
         dlog::flush();
         timer.restart();
 
@@ -582,6 +583,10 @@ int main(int argc, char** argv)
         tmt_send_time = 0;
 #endif
 
+        master.foreach([delta_exchange](Block* b, const diy::Master::ProxyWithLink& cp) { b->delta_exchange_ = delta_exchange; });
+        if (epsilon > 0)
+            master.foreach([epsilon](Block* b, const diy::Master::ProxyWithLink& cp) { b->simplify_original_tree(epsilon); });
+
         int rounds = 0;
         while(global_n_undone)
         {
@@ -707,7 +712,13 @@ int main(int argc, char** argv)
 
         bool verbose = false;
 
-        if (write_diag)
+        if (write_diag && binary_diagrams)
+        {
+            bool ignore_zero_persistence = true;
+            IsAmrVertexLocal test_local;
+            DiagramWriter<Block, IsAmrVertexLocal> writer(output_diagrams_filename, world, test_local, absolute_rho, ignore_zero_persistence, min_persistence);
+            writer.write(master);
+        } else if (write_diag)
         {
             bool ignore_zero_persistence = true;
             OutputPairsR::ExtraInfo extra(output_diagrams_filename, verbose, world);
@@ -114,6 +114,8 @@ void read_amr_plotfile(std::string infile,
 
     std::map<int, std::vector<Real*>> gid_to_extra_pointers;
 
+    std::map<int, Block*> gid_to_block;
+
     for(size_t var_idx = 0; var_idx < all_var_names.size(); ++var_idx)
     {
         for(int level = 0; level < n_levels; ++level)
@@ -126,6 +128,8 @@ void read_amr_plotfile(std::string infile,
                 // TODO: this will load actual data; we only boxes from finer level
                 const MultiFab& mf_finer = plotfile.get(level + 1, all_var_names[var_idx]);
                 ba_finer = mf_finer.boxArray();
+                // on our level, finer boxes cover the cells that the blocks mask, they do not count in the mean
+                ba_finer.coarsen(plotfile.refRatio(level));
             }
 
             // false is for no tiling in MFIter; we want boxes exactly as they are in plotfile
@@ -168,6 +172,28 @@ void read_amr_plotfile(std::string infile,
 
                 Real* fab_ptr = const_cast<Real*>(my_fab.dataPtr(0));
                 long long int fab_size = a_shape[0] * a_shape[1] * a_shape[2];
+
+                // accumulate the sum of unmasked cells while the data streams in,
+                // so that the mean needs no extra pass over the blocks
+                std::vector<std::pair<int, Box>> covered_isects;
+                if (level < finest_level)
+                    ba_finer.intersections(valid_box, covered_isects);
+
+                auto covered_sum = [&covered_isects, &abox, &a_shape](const Real* ptr) {
+                    Real result = 0;
+                    const IntVect& lo = abox.smallEnd();
+                    for(const auto& is : covered_isects)
+                    {
+                        const Box& b = is.second;
+                        for(int z = b.smallEnd()[2]; z <= b.bigEnd()[2]; ++z)
+                            for(int y = b.smallEnd()[1]; y <= b.bigEnd()[1]; ++y)
+                                for(int x = b.smallEnd()[0]; x <= b.bigEnd()[0]; ++x)
+                                    result += ptr[(x - lo[0]) + a_shape[0] * ((y - lo[1]) + (long long int) a_shape[1] * (z - lo[2]))];
+                    }
+                    return result;
+                };
+
+                Real tile_sum = 0;
                 if (var_idx == 0)
                 {
                     fab_ptr_copy = new Real[fab_size];
@@ -189,6 +215,7 @@ void read_amr_plotfile(std::string infile,
 
                     for(int i = 0; i < fab_size; ++i)
                     {
+                        tile_sum += fab_ptr[i];
                         total_sum += fab_ptr[i];
                         n_nans += std::isnan(fab_ptr[i]);
                         n_infs += std::isinf(fab_ptr[i]);
@@ -201,7 +228,18 @@ void read_amr_plotfile(std::string infile,
                     }
                     if (debug) { fmt::print("FIELD 0 rank = {}, gid = {}, sum = {}, fabs_size = {}, avg_in_fab = {}, n_nans = {}, n_infs = {}, n_negs = {}, n_wo = {}, avg_wo = {}\n", world.rank(), gid, total_sum, fab_size, total_sum / fab_size, n_nans, n_infs, n_negs, n_wo, total_sum_wo / n_wo); }
 
-                    master_reader.add(gid, new Block(fab_ptr_copy, all_var_names, extra_pointers, a_shape), link);
+                    Block* block = new Block(fab_ptr_copy, all_var_names, extra_pointers, a_shape);
+                    gid_to_block[gid] = block;
+
+                    long long int n_covered = 0;
+                    for(const auto& is : covered_isects)
+                        n_covered += is.second.numPts();
+
+                    block->unmasked_sum_ = tile_sum - covered_sum(fab_ptr);
+                    block->n_unmasked_ = fab_size - n_covered;
+                    block->has_unmasked_stats_ = true;
+
+                    master_reader.add(gid, block, link);
 
                     // record wrap
                     for(int dir_x : {-1, 0, 1})
@@ -300,11 +338,15 @@ void read_amr_plotfile(std::string infile,
                         if (add_to_fab)
                         {
                             block_fab_ptr[i] += fab_ptr[i];
+                            tile_sum += fab_ptr[i];
                             n_additions += 1;
                         }
 
                         block_extra_ptr[i] = fab_ptr[i];
                     }
+
+                    if (add_to_fab)
+                        gid_to_block.at(gid)->unmasked_sum_ += tile_sum - covered_sum(fab_ptr);
                     if (debug) fmt::print( "Added next field, block_fab_ptr = {}, fab_ptr = {}, gid = {}, n_nans_1 = {}, n_negs_1 = {}, n_infs_1 = {}, totao_sum_1 = {}\n", (void*) block_fab_ptr, (void*) fab_ptr, gid, n_nans_1, n_negs_1, n_infs_1, total_sum_1);
                 }
             } // loop over tiles
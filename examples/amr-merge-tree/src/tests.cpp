@@ -272,7 +272,8 @@ void f2()
 
         for (int block_idx = 0; block_idx < n_blocks; ++block_idx) {
             auto& curr_block = blocks[block_idx];
-            for (size_t i = 0; i < curr_block.local_.mask_grid().size(); ++i) {
+            size_t mask_size = curr_block.local_.mask_grid().size();
+            for (size_t i = 0; i < mask_size; ++i) {
                 auto p_loc = curr_block.local_.local_position(reeber::AmrVertexId { curr_block.gid, i });
                 auto p_glob = curr_block.local_.global_position(reeber::AmrVertexId { curr_block.gid, i });
                 fmt::print("in block bound_from = {} bound_to = {}, i = {}, local pos = {}, global pos = {}\n",
@@ -1,5 +1,6 @@
 #include "catch/catch.hpp"
 
+#include <random>
 #include <sstream>
 #include <iostream>
 
@@ -11,6 +12,7 @@
 
 #include "fab-block.h"
 #include "fab-tmt-block.h"
+#include "amr-merge-tree-send-simple.h"
 #include "reader-interfaces.h"
 #include "diy/vertices.hpp"
 #include "reeber/grid.h"
@@ -319,6 +321,25 @@ TEST_CASE("Check masked_box in 2 dimensions", "[masked_box][dim2]")
 
         REQUIRE(upper_left_corner_link == correct_upper_left_corner_link);
     }
+
+    SECTION("check mask with more neighbor gids than the one-byte codes hold")
+    {
+        // every cell gets its own gid, twice: 2 * masked_box_size distinct gids
+        for(int round = 0; round < 2; ++round)
+            for(size_t i = 0; i < masked_box_size; ++i)
+                mb.set_mask(mb.local_position(AmrVertexId{gid, i}), int(1 + round * masked_box_size + i));
+
+        REQUIRE(2 * masked_box_size > 256);
+
+        auto mask = mb.mask_grid();
+        for(size_t i = 0; i < masked_box_size; ++i)
+            REQUIRE(mask(i) == int(1 + masked_box_size + i));
+
+        // cells that overflowed the table can be reset to a special value
+        mb.set_mask(mb.local_position(AmrVertexId{gid, masked_box_size - 1}), MaskedBox::ACTIVE);
+        REQUIRE(mb.mask(mb.local_position(AmrVertexId{gid, masked_box_size - 1})) == MaskedBox::ACTIVE);
+        REQUIRE(mb.mask(mb.local_position(AmrVertexId{gid, masked_box_size - 2})) == int(2 * masked_box_size - 1));
+    }
 }
 
 TEST_CASE("Ghosts and no ghosts", "[masked_box][dim2]")
@@ -615,7 +636,8 @@ TEST_CASE("Check blocks constructor in simplest case", "[FabTmtBlock][dim2]")
         for(int i = 0; i < n_blocks; ++i)
         {
             REQUIRE(blocks[i].components_.size() == 1);
-            if (correct_masks[i] != blocks[i].local_.mask_grid())
+            auto mask = blocks[i].local_.mask_grid();
+            if (correct_masks[i] != mask)
             {
                 fmt::print("ACHTUNG!, i = {}\n", i);
                 for(int kkk = 0; kkk < correct_masks[i].size(); ++kkk)
@@ -625,14 +647,14 @@ TEST_CASE("Check blocks constructor in simplest case", "[FabTmtBlock][dim2]")
                     v.vertex = kkk;
                     MaskedBox::Position local_pos = blocks[i].local_.local_position(v);
                     MaskedBox::Position global_pos = blocks[i].local_.global_position(v);
-                    auto my_value = blocks[i].local_.mask_grid()(v);
+                    auto my_value = mask(v);
                     auto correct_value = correct_masks[i](v);
                     if (my_value != correct_value)
                         fmt::print("i = {}, local pos = {}, global pos = {}, correct = {}, my = {}\n", i, local_pos,
                                 global_pos, correct_value, my_value);
                 }
             }
-            REQUIRE(correct_masks[i] == blocks[i].local_.mask_grid());
+            REQUIRE(correct_masks[i] == mask);
         }
 
 
@@ -856,7 +878,8 @@ TEST_CASE("Check blocks constructor in simplest case-no ghosts", "[FabTmtBlock][
         for(int i = 0; i < n_blocks; ++i)
         {
             REQUIRE(blocks[i].components_.size() == 1);
-            if (correct_masks[i] != blocks[i].local_.mask_grid())
+            auto mask = blocks[i].local_.mask_grid();
+            if (correct_masks[i] != mask)
             {
                 fmt::print("ACHTUNG!, i = {}\n", i);
                 for(int i1 = 0; i1 < correct_masks[i].size(); ++i1)
@@ -866,14 +889,14 @@ TEST_CASE("Check blocks constructor in simplest case-no ghosts", "[FabTmtBlock][
                     v.vertex = i1;
                     MaskedBox::Position local_pos = blocks[i].local_.local_position(v);
                     MaskedBox::Position global_pos = blocks[i].local_.global_position(v);
-                    auto my_value = blocks[i].local_.mask_grid()(v);
+                    auto my_value = mask(v);
                     auto correct_value = correct_masks[i](v);
                     if (my_value != correct_value)
                         fmt::print("i = {}, local pos = {}, global pos = {}, correct = {}, my = {}\n", i, local_pos,
                                 global_pos, correct_value, my_value);
                 }
             }
-            REQUIRE(correct_masks[i] == blocks[i].local_.mask_grid());
+            REQUIRE(correct_masks[i] == mask);
         }
 
 
@@ -1178,3 +1201,261 @@ TEST_CASE("Check blocks constructor in simple masked case", "[FabTmtBlock][dim2]
     }
 }
 */
+
+namespace
+{
+    void check_same_link(const diy::AMRLink& a, const diy::AMRLink& b)
+    {
+        REQUIRE(a.size() == b.size());
+        for(int k = 0; k < a.size(); ++k)
+        {
+            REQUIRE(a.target(k).gid == b.target(k).gid);
+            REQUIRE(a.level(k) == b.level(k));
+            REQUIRE(a.refinement(k) == b.refinement(k));
+            REQUIRE(a.core(k).min == b.core(k).min);
+            REQUIRE(a.core(k).max == b.core(k).max);
+            REQUIRE(a.bounds(k).min == b.bounds(k).min);
+            REQUIRE(a.bounds(k).max == b.bounds(k).max);
+        }
+    }
+}
+
+TEST_CASE("Delta exchange rebuilds the sender's link", "[FabTmtBlock][delta_exchange]")
+{
+    using Block = FabTmtBlock<double, 2>;
+    using DynPoint4 = diy::DynamicPoint<int, 4>;
+    using Bounds = diy::DiscreteBounds;
+
+    auto square = [](int x, int y, int size) { return Bounds { DynPoint4 { x, y, 0, 0 }, DynPoint4 { x + size - 1, y + size - 1, 0, 0 } }; };
+
+    diy::mpi::communicator world;
+    diy::Master master(world, 1, -1, &Block::create, &Block::destroy);
+
+    for(int gid = 0; gid < 2; ++gid)
+    {
+        Block* b = new Block;
+        b->delta_exchange_ = true;
+        b->original_link_gids_ = { 1 - gid, 7 };
+
+        diy::AMRLink* l = new diy::AMRLink(2, 0, 1, square(4 * gid, 0, 4), square(4 * gid - 1, -1, 6));
+        l->add_neighbor(diy::BlockID { 1 - gid, world.rank() });
+        l->add_bounds(0, 1, square(4 * (1 - gid), 0, 4), square(4 * (1 - gid) - 1, -1, 6));
+        master.add(gid, b, l);
+    }
+
+    // the link block 0 sends grows between the rounds, as in expand_link
+    diy::AMRLink grown = *static_cast<diy::AMRLink*>(master.link(0));
+    for(int round = 0; round < 3; ++round)
+    {
+        for(int k = 0; k <= round; ++k)
+        {
+            grown.add_neighbor(diy::BlockID { 10 * round + k + 2, world.rank() });
+            grown.add_bounds(1, 2, square(round, k, 2), square(round - 1, k - 1, 4));
+        }
+
+        master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
+        {
+            if (cp.gid() == 0)
+                send_link_delta(b, cp, &grown, diy::BlockID { 1, world.rank() });
+        });
+        master.exchange();
+        master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
+        {
+            if (cp.gid() != 1)
+                return;
+
+            std::vector<diy::AMRLink> received_links;
+            std::vector<std::vector<int>> received_original_gids;
+            receive_link_delta(b, cp, diy::BlockID { 0, world.rank() }, received_links, received_original_gids);
+
+            REQUIRE(received_links.size() == 1);
+            check_same_link(received_links[0], grown);
+            REQUIRE(received_original_gids == std::vector<std::vector<int>> { { 1, 7 } });
+        });
+
+        REQUIRE(master.block<Block>(0)->sent_link_size_[1] == grown.size());
+    }
+}
+
+namespace
+{
+    // link() steps through the offsets for the core cells; it must agree with the link of positions
+    template<class Connectivity>
+    void check_masked_box_links(bool c_order, int ghosts)
+    {
+        using MaskedBox = reeber::MaskedBox<3, Connectivity>;
+        using Position = typename MaskedBox::Position;
+        using DynPoint = typename MaskedBox::NewDynamicPoint;
+
+        const Position core_from { 3, 4, 5 }, core_to { 9, 11, 13 };
+        Position bounds_from = core_from, bounds_to = core_to;
+        for(unsigned i = 0; i < 3; ++i)
+        {
+            bounds_from[i] -= ghosts;
+            bounds_to[i] += ghosts;
+        }
+
+        MaskedBox mb(DynPoint(core_from), DynPoint(core_to), DynPoint(bounds_from), DynPoint(bounds_to), 1, 0, 2, c_order);
+
+        // outer cells belong to another block, a third of the core is low
+        std::mt19937 gen(5);
+        diy::for_each(mb.mask_shape(), [&](const Position& p) {
+            mb.set_mask(p, mb.is_outer(p) ? 7 : (gen() % 3 ? MaskedBox::ACTIVE : MaskedBox::LOW));
+        });
+
+        diy::for_each(mb.bounds_shape(), [&](const Position& p_local) {
+            if (not mb.is_in_core(p_local - mb.ghost_adjustment()))
+                return;
+            std::vector<reeber::AmrVertexId> link, position_link;
+            for(auto u : mb.link(mb.local_position_to_vertex(p_local)))
+                link.push_back(u);
+            for(auto q : mb.local_position_link(p_local))
+                position_link.push_back(mb.local_position_to_vertex(q));
+            REQUIRE(link == position_link);
+        });
+    }
+}
+
+TEST_CASE("MaskedBox link agrees with local_position_link", "[masked_box][connectivity]")
+{
+    for(bool c_order : { false, true })
+        for(int ghosts : { 0, 1 })
+        {
+            INFO("c_order = " << c_order << ", ghosts = " << ghosts);
+            check_masked_box_links<reeber::FreudenthalConnectivity<3>>(c_order, ghosts);
+            check_masked_box_links<reeber::FaceConnectivity<3>>(c_order, ghosts);
+            check_masked_box_links<reeber::EdgeConnectivity<3>>(c_order, ghosts);
+            check_masked_box_links<reeber::FullConnectivity<3>>(c_order, ghosts);
+        }
+}
+
+TEST_CASE("MaskedBox marks the low core cells", "[masked_box][mark_low]")
+{
+    using MaskedBox = reeber::MaskedBox<3>;
+    using Position = MaskedBox::Position;
+    using DynPoint = MaskedBox::NewDynamicPoint;
+
+    const Position core_from { 3, 4, 5 }, core_to { 9, 11, 13 };
+    auto is_low = [](double x) { return x < 0.5; };
+
+    for(bool mask_c_order : { false, true })
+        for(bool fab_c_order : { false, true })
+            for(int ghosts : { 0, 2 })
+            {
+                INFO("mask c_order = " << mask_c_order << ", fab c_order = " << fab_c_order << ", ghosts = " << ghosts);
+
+                Position bounds_from = core_from, bounds_to = core_to;
+                for(unsigned i = 0; i < 3; ++i)
+                {
+                    bounds_from[i] -= ghosts;
+                    bounds_to[i] += ghosts;
+                }
+
+                MaskedBox mb(DynPoint(core_from), DynPoint(core_to), DynPoint(bounds_from), DynPoint(bounds_to), 1, 0, 2, mask_c_order);
+
+                // core cells are active, already low or covered by block 7
+                std::mt19937 gen(11);
+                diy::for_each(mb.mask_shape(), [&](const Position& p) {
+                    int r = gen() % 4;
+                    mb.set_mask(p, mb.is_outer(p) ? MaskedBox::NOT_IN_DOMAIN : (r == 0 ? 7 : (r == 1 ? MaskedBox::LOW : MaskedBox::ACTIVE)));
+                });
+
+                diy::Grid<double, 3> fab(mb.bounds_shape(), fab_c_order);
+                std::uniform_real_distribution<double> dis(0, 1);
+                for(size_t i = 0; i < fab.size(); ++i)
+                    fab.data()[i] = dis(gen);
+
+                // one cell at a time
+                std::vector<MaskedBox::MaskValue> expected_mask;       // in the order of for_each
+                size_t n_low = 0, n_active = 0;
+                double sum_low = 0, sum_active = 0;
+                diy::for_each(mb.mask_shape(), [&](const Position& p_mask) {
+                    MaskedBox::MaskValue m = mb.mask(p_mask);
+                    if (not mb.is_outer(p_mask) and m == MaskedBox::ACTIVE)
+                    {
+                        double x = fab(p_mask - Position::one() + mb.ghost_adjustment());
+                        if (is_low(x))
+                        {
+                            m = MaskedBox::LOW;
+                            ++n_low;
+                            sum_low += x;
+                        } else
+                        {
+                            ++n_active;
+                            sum_active += x;
+                        }
+                    }
+                    expected_mask.push_back(m);
+                });
+                REQUIRE(n_low > 0);
+                REQUIRE(n_active > 0);
+
+                auto stats = mb.mark_low(diy::GridRef<double, 3>(fab.data(), fab.shape(), fab.c_order()), is_low);
+
+                REQUIRE(stats.n_low == n_low);
+                REQUIRE(stats.n_active == n_active);
+                REQUIRE(stats.sum_low == Approx(sum_low));
+                REQUIRE(stats.sum_active == Approx(sum_active));
+                size_t i = 0;
+                diy::for_each(mb.mask_shape(), [&](const Position& p_mask) {
+                    REQUIRE(mb.mask(p_mask) == expected_mask[i++]);
+                });
+            }
+}
+
+TEST_CASE("Mean of the cells not covered by a finer block", "[FabBlock][unmasked_stats]")
+{
+    using Block = FabBlock<double, 2>;
+    using Position = Block::Vertex;
+    using DynPoint4 = diy::DynamicPoint<int, 4>;
+    using Bounds = diy::DiscreteBounds;
+
+    auto rect = [](int x0, int y0, int x1, int y1) { return Bounds { DynPoint4 { x0, y0, 0, 0 }, DynPoint4 { x1, y1, 0, 0 } }; };
+
+    // core [0, 7] x [0, 5] on level 0, one layer of ghosts
+    const Position bounds_from { -1, -1 }, shape { 10, 8 };
+    double* data = new double[shape[0] * shape[1]];
+    Block b(data, shape);
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<double> dis(0, 1);
+    for(int i = 0; i < shape[0] * shape[1]; ++i)
+        data[i] = dis(gen);
+
+    diy::AMRLink l(2, 0, 1, rect(0, 0, 7, 5), rect(-1, -1, 8, 6));
+
+    // a finer block over coarse cells [2, 4] x [1, 3], and one that reaches into the ghosts only
+    l.add_neighbor(diy::BlockID { 1, 0 });
+    l.add_bounds(1, 2, rect(4, 2, 9, 7), rect(3, 1, 10, 8));
+    l.add_neighbor(diy::BlockID { 2, 0 });
+    l.add_bounds(1, 2, rect(16, 0, 19, 3), rect(15, -1, 20, 4));
+    // a neighbor on the same level and one two levels up mask nothing
+    l.add_neighbor(diy::BlockID { 3, 0 });
+    l.add_bounds(0, 1, rect(0, 0, 7, 5), rect(-1, -1, 8, 6));
+    l.add_neighbor(diy::BlockID { 4, 0 });
+    l.add_bounds(2, 4, rect(0, 0, 3, 3), rect(-1, -1, 4, 4));
+
+    double sum = 0;
+    long long int n = 0;
+    for(int x = 0; x <= 7; ++x)
+        for(int y = 0; y <= 5; ++y)
+        {
+            if (x >= 2 && x <= 4 && y >= 1 && y <= 3)
+                continue;
+            sum += b.fab(Position { x, y } - bounds_from);
+            ++n;
+        }
+
+    compute_unmasked_stats(&b, &l);
+
+    REQUIRE(b.has_unmasked_stats_);
+    REQUIRE(b.n_unmasked_ == n);
+    REQUIRE(b.n_unmasked_ == 48 - 9);
+    REQUIRE(b.unmasked_sum_ == Approx(sum));
+
+    SECTION("anisotropic refinement is refused")
+    {
+        l.add_neighbor(diy::BlockID { 5, 0 });
+        l.add_bounds(1, DynPoint4 { 2, 4, 1, 1 }, rect(0, 0, 1, 1), rect(-1, -1, 2, 2));
+        REQUIRE_THROWS_AS(compute_unmasked_stats(&b, &l), std::runtime_error);
+    }
+}
@@ -1,2 +1,11 @@
-#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_RUNNER
 #include "catch/catch.hpp"
+
+#include <diy/mpi.hpp>
+
+// the tests that exchange between blocks need a diy::Master, hence MPI
+int main(int argc, char* argv[])
+{
+    diy::mpi::environment   env(argc, argv);
+    return Catch::Session().run(argc, argv);
+}
@@ -1,5 +1,7 @@
 #include <iostream>
 #include <string>
+#include <limits>
+#include <cmath>
 
 #include <dlog/stats.h>
 #include <dlog/log.h>
@@ -9,6 +11,7 @@
 #include <diy/io/numpy.hpp>
 
 #include <reeber/triplet-merge-tree.h>
+#include <reeber/flat-triplet-merge-tree.h>
 #include <reeber/grid.h>
 #include <reeber/box.h>
 #include <reeber/triplet-merge-tree-serialization.h>
@@ -27,25 +30,28 @@ typedef     Grid::Vertex                      Vertex;
 typedef     Grid::Value                       Value;
 //typedef     r::Box<3>                         Box;
 typedef     r::TripletMergeTree<Index, Value> TripletMergeTree;
+typedef     r::FlatTripletMergeTree<Index, Value> FlatTripletMergeTree;
 
 struct OutputPairs
 {
-            OutputPairs(std::ostream& out_, TripletMergeTree &mt_):
-                out(out_), negate(mt_.negate()), mt(mt_)           {}
-
-    typedef       TripletMergeTree::Neighbor    Neighbor;
+            OutputPairs(std::ostream& out_, bool negate_, bool cut_ = false, Value rho_ = 0):
+                out(out_), negate(negate_), cut(cut_), rho(rho_)    {}
 
+    template<class Neighbor>
     void    operator()(const Neighbor from, const Neighbor through, const Neighbor to) const
     {
         if (from != to)
             fmt::print(out, "{} {} {} {} {} {}\n", from->vertex, from->value, through->vertex, through->value, to->vertex, to->value);
+        else if (cut)   // component of the thresholded domain dies at the threshold
+            fmt::print(out, "{} {} {} --\n",    from->vertex, from->value, rho);
         else
             fmt::print(out, "{} {} {} --\n",    from->vertex, from->value, (negate ? "-inf" : "inf"));
     }
 
     std::ostream&       out;
     bool                negate;
-    TripletMergeTree&          mt;
+    bool                cut;
+    Value               rho;
 };
 
 int main(int argc, char** argv)
@@ -65,6 +71,7 @@ int main(int argc, char** argv)
     int         jobs = r::task_scheduler_init::automatic;
     int         cmt = 2;
     int         d = 1;
+    Real        rho = std::numeric_limits<Real>::quiet_NaN();
     std::string tree_fn;
 
     Options ops(argc, argv);
@@ -72,12 +79,14 @@ int main(int argc, char** argv)
         >> Option('p', "profile", profile_path, "path to keep the execution profile")
         >> Option('l', "log",     log_level,    "log level")
         >> Option('j', "jobs",    jobs,         "number of threads to use (with TBB)")
-        >> Option('c', "cmt",     cmt,          "compute_merge_tree version")
+        >> Option('c', "cmt",     cmt,          "compute_merge_tree version (3 = flat tree)")
         >> Option('d', "scale",   d,            "downsampling factor")
+        >> Option('r', "rho",     rho,          "only build the tree where the function is past this threshold")
         >> Option('t', "tree",    tree_fn,      "file to save the tree");
     ;
     bool        negate      = ops >> Present('n', "negate", "sweep superlevel sets");
     bool        split       = ops >> Present('s', "split",  "split domain and merge");
+    bool        cut         = !std::isnan(rho);
 
     std::string infn, outfn;
     if (  ops >> Present('h', "help", "show help message") ||
@@ -174,10 +183,33 @@ int main(int argc, char** argv)
     TripletMergeTree mt1(negate);
     TripletMergeTree mt2(negate);
 
+    FlatTripletMergeTree fmt1(negate);
+    FlatTripletMergeTree fmt2(negate);
+    bool flat = (cmt == 3);
+
     if (split)
     {
-        r::compute_merge_tree2(mt1, domain1, g1);
-        r::compute_merge_tree2(mt2, domain2, g2);
+        if (flat)
+        {
+            // both halves share the index space of the whole domain, so that merge can splice them
+            if (cut)
+            {
+                r::compute_merge_tree2(fmt1, domain1, g1, domain.local_index(), rho);
+                r::compute_merge_tree2(fmt2, domain2, g2, domain.local_index(), rho);
+            } else
+            {
+                r::compute_merge_tree2(fmt1, domain1, g1, domain.local_index());
+                r::compute_merge_tree2(fmt2, domain2, g2, domain.local_index());
+            }
+        } else if (cut)
+        {
+            r::compute_merge_tree2(mt1, domain1, g1, rho);
+            r::compute_merge_tree2(mt2, domain2, g2, rho);
+        } else
+        {
+            r::compute_merge_tree2(mt1, domain1, g1);
+            r::compute_merge_tree2(mt2, domain2, g2);
+        }
 
         std::vector<std::tuple<Index, Index>> edges;
         it = r::VerticesIterator<Vertex>::begin(edges_domain.from(), edges_domain.to());
@@ -198,7 +230,11 @@ int main(int argc, char** argv)
         it = r::VerticesIterator<Vertex>::begin(domain1.from(), domain1.to()),
         end = r::VerticesIterator<Vertex>::end(domain1.from(), domain1.to());
         dlog::Timer t;
-        r::merge(mt1, mt2, edges);
+        // with the threshold, the edges may touch vertices that didn't make it into the trees
+        if (flat)
+            r::merge(fmt1, fmt2, edges, domain.local_index(), cut);
+        else
+            r::merge(mt1, mt2, edges, cut);
         dlog::Timer::duration elapsed = t.elapsed();
         fmt::print(std::cerr, "Time to merge: {}\n", t.elapsed());
         fmt::print("tmt-merge {} {}\n", jobs, elapsed);
@@ -206,7 +242,14 @@ int main(int argc, char** argv)
     else
     {
         dlog::Timer t;
-        if (cmt == 1) r::compute_merge_tree(mt1, domain, g);
+        if (cut)
+        {
+            if (cmt == 1) r::compute_merge_tree(mt1, domain, g, rho);
+            else if (flat) r::compute_merge_tree2(fmt1, domain, g, domain.local_index(), rho);
+            else r::compute_merge_tree2(mt1, domain, g, rho);
+        }
+        else if (cmt == 1) r::compute_merge_tree(mt1, domain, g);
+        else if (flat) r::compute_merge_tree2(fmt1, domain, g);
         else r::compute_merge_tree2(mt1, domain, g);
         dlog::Timer::duration elapsed = t.elapsed();
         fmt::print(std::cerr, "Time for compute_merge_tree{}: {}\n", cmt, elapsed);
@@ -216,11 +259,16 @@ int main(int argc, char** argv)
     if (outfn != "none")
     {
         std::ofstream ofs(outfn.c_str());
-        r::traverse_persistence(mt1, OutputPairs(ofs, mt1));
+        if (flat)
+            r::traverse_persistence(fmt1, OutputPairs(ofs, negate, cut, rho));
+        else
+            r::traverse_persistence(mt1, OutputPairs(ofs, negate, cut, rho));
     }
 
     if (!tree_fn.empty())
     {
+        if (flat)   // serialization works with the regular tree; keeping every vertex copies the whole tree
+            r::sparsify(mt1, fmt1, [](Index) { return true; });
         diy::MemoryBuffer bb;
         diy::save(bb, mt1);
         bb.write(tree_fn);
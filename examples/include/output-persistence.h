@@ -1,13 +1,66 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <diy/master.hpp>
 #include <diy/io/shared.hpp>
+#include <diy/mpi.hpp>
 #include <dlog/log.h>
 
 #include <reeber/triplet-merge-tree.h>
 
+// Clamps (birth, death) of a pair to the threshold and decides whether to keep it
+template<class RealType>
+struct PersistenceFilter
+{
+    PersistenceFilter(bool _negate, RealType _threshold, bool _ignore_zero_persistence, RealType _min_persistence = 0):
+        negate(_negate),
+        ignore_zero_persistence(_ignore_zero_persistence),
+        threshold(_threshold),
+        min_persistence(_min_persistence)
+    {
+    }
+
+    bool    operator()(RealType& birth_time, RealType& death_time) const
+    {
+        if (negate)
+        {
+            if (birth_time < threshold)
+                return false;
+            if (death_time < threshold)
+                death_time = threshold;
+        } else
+        {
+            if (birth_time > threshold)
+                return false;
+            if (death_time > threshold)
+                death_time = threshold;
+        }
+
+        if (ignore_zero_persistence and birth_time == death_time)
+            return false;
+
+        if (std::abs(death_time - birth_time) < min_persistence)
+            return false;
+
+        return true;
+    }
+
+    bool        negate;
+    bool        ignore_zero_persistence;
+    RealType    threshold;
+    RealType    min_persistence;
+};
+
 template<class Block, class LocalFunctor>
 struct OutputPairs
 {
@@ -27,9 +80,7 @@ struct OutputPairs
     using Neighbor = typename Block::Neighbor;
 
     OutputPairs(const Block& _block, ExtraInfo* _extra, const LocalFunctor& _test_local, RealType _threshold, bool _ignore_zero_persistence):
-        negate(_block.get_merge_tree().negate()),
-        ignore_zero_persistence(_ignore_zero_persistence),
-        threshold(_threshold),
+        filter(_block.get_merge_tree().negate(), _threshold, _ignore_zero_persistence),
         block(_block),
         extra(_extra),
         test_local(_test_local)
@@ -54,24 +105,7 @@ struct OutputPairs
             RealType birth_time, death_time;
             birth_time = from->value;
             death_time = through->value;
-            if (negate)
-            {
-//                LOG_SEV(info) << "in OutputPairs(), from = " << from->vertex << " recognized as local" << ", b = " << birth_time << ", d = " << death_time << ", to value = " << to->value << ", threshold = " << threshold;
-                if (birth_time < threshold)
-                    return;
-                if (death_time < threshold)
-                    //death_time = -std::numeric_limits<RealType>::infinity();
-                    death_time = threshold;
-            } else
-            {
-                if (birth_time > threshold)
-                    return;
-                if (death_time > threshold)
-                    //death_time = std::numeric_limits<RealType>::infinity();
-                    death_time = threshold;
-            }
-
-            if (ignore_zero_persistence and birth_time == death_time)
+            if (!filter(birth_time, death_time))
                 return;
 
 //            fmt::print("PERSISTENCE {} {}\n", birth_time, death_time);
@@ -80,9 +114,7 @@ struct OutputPairs
         }
     }
 
-    const bool             negate;
-    const bool             ignore_zero_persistence;
-    const RealType         threshold;
+    const PersistenceFilter<RealType> filter;
     const Block&           block;
     ExtraInfo*             extra;
     const LocalFunctor&    test_local;
@@ -102,3 +134,151 @@ void output_persistence(Block* b, const diy::Master::ProxyWithLink& cp,
                 OutputPairs<Block, LocalFunctor>(*b, extra, test_local, threshold, _ignore_zero_persistence));
     }
 }
+
+/**
+ * Writes the persistence diagram of all the blocks into a single binary file:
+ * the total number of pairs (uint64_t), followed by (birth, death) pairs of
+ * RealType, in no particular order. The pairs are collected by a parallel
+ * traversal into per-thread buffers of at most buffer_size pairs, which are
+ * written out with pwrite() as soon as they fill up, so memory stays bounded
+ * regardless of the size of the trees. A first counting pass over the blocks
+ * determines each rank's range of the file.
+ */
+template<class Block, class LocalFunctor>
+class DiagramWriter
+{
+    public:
+        using RealType = typename Block::RealType;
+        using Neighbor = typename Block::Neighbor;
+
+        struct Pair
+        {
+            RealType    birth;
+            RealType    death;
+        };
+
+        using Buffer   = std::vector<Pair>;
+
+                    DiagramWriter(const std::string& _outfn, diy::mpi::communicator& _world, const LocalFunctor& _test_local,
+                                  RealType _threshold, bool _ignore_zero_persistence, RealType _min_persistence = 0,
+                                  size_t _buffer_size = size_t(1) << 16):
+                        outfn(_outfn), world(_world), test_local(_test_local),
+                        threshold(_threshold), ignore_zero_persistence(_ignore_zero_persistence), min_persistence(_min_persistence),
+                        buffer_size(_buffer_size)       {}
+
+        void        write(diy::Master& master)
+        {
+            dlog::prof << "write-diagram";
+
+            std::atomic<std::uint64_t> count { 0 };
+            master.foreach([this,&count](Block* b, const diy::Master::ProxyWithLink&) { count += this->count(*b); });
+
+            std::uint64_t local = count, offset, total;
+            diy::mpi::scan(world, local, offset, std::plus<std::uint64_t>());
+            diy::mpi::all_reduce(world, local, total, std::plus<std::uint64_t>());
+            offset -= local;
+
+            if (world.rank() == 0)
+            {
+                int fd = open_file(O_WRONLY | O_CREAT | O_TRUNC);
+                write_at(fd, 0, reinterpret_cast<const char*>(&total), sizeof(total));
+                ::close(fd);
+            }
+            world.barrier();
+
+            fd_     = open_file(O_WRONLY);
+            cursor_ = offset;
+            master.foreach([this](Block* b, const diy::Master::ProxyWithLink&) { this->write(*b); });
+            ::close(fd_);
+
+            if (cursor_ != offset + local)
+                throw std::runtime_error("DiagramWriter: the number of written pairs doesn't match the count");
+
+            dlog::prof >> "write-diagram";
+        }
+
+    private:
+        template<class F>
+        void        traverse(const Block& b, const F& f) const
+        {
+            PersistenceFilter<RealType> filter(b.get_merge_tree().negate(), threshold, ignore_zero_persistence, min_persistence);
+            reeber::traverse_persistence_parallel(b.get_merge_tree(), [&](Neighbor from, Neighbor through, Neighbor to)
+            {
+                if (!test_local(b, from))
+                    return;
+
+                RealType birth_time = from->value, death_time = through->value;
+                if (filter(birth_time, death_time))
+                    f(birth_time, death_time);
+            });
+        }
+
+        std::uint64_t   count(const Block& b) const
+        {
+            reeber::thread_specific<std::uint64_t> counts;
+            traverse(b, [&counts](RealType, RealType) { ++counts.local(); });
+
+            std::uint64_t n = 0;
+            counts.combine_each([&n](std::uint64_t c) { n += c; });
+            return n;
+        }
+
+        void        write(const Block& b)
+        {
+            reeber::thread_specific<Buffer> buffers;
+            traverse(b, [this,&buffers](RealType birth_time, RealType death_time)
+            {
+                Buffer& buffer = buffers.local();
+                if (buffer.capacity() < buffer_size)
+                    buffer.reserve(buffer_size);
+                buffer.push_back(Pair { birth_time, death_time });
+                if (buffer.size() == buffer_size)
+                    flush(buffer);
+            });
+            buffers.combine_each([this](Buffer& buffer) { flush(buffer); });
+        }
+
+        // reserves the range of the file atomically, so concurrent flushes don't need a lock
+        void        flush(Buffer& buffer)
+        {
+            if (buffer.empty())
+                return;
+
+            std::uint64_t position = cursor_.fetch_add(buffer.size());
+            write_at(fd_, sizeof(std::uint64_t) + position * sizeof(Pair), reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(Pair));
+            buffer.clear();
+        }
+
+        int         open_file(int flags) const
+        {
+            int fd = ::open(outfn.c_str(), flags, 0644);
+            if (fd < 0)
+                throw std::runtime_error("DiagramWriter: cannot open " + outfn);
+            return fd;
+        }
+
+        static void write_at(int fd, std::uint64_t offset, const char* data, size_t size)
+        {
+            while (size)
+            {
+                ssize_t n = ::pwrite(fd, data, size, offset);
+                if (n < 0)
+                    throw std::runtime_error("DiagramWriter: write failed");
+                data   += n;
+                size   -= n;
+                offset += n;
+            }
+        }
+
+    private:
+        std::string                 outfn;
+        diy::mpi::communicator&     world;
+        const LocalFunctor&         test_local;
+        RealType                    threshold;
+        bool                        ignore_zero_persistence;
+        RealType                    min_persistence;
+        size_t                      buffer_size;
+
+        int                         fd_ = -1;
+        std::atomic<std::uint64_t>  cursor_ { 0 };
+};
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# tmt-distributed, with the reduction settings of MergeOptions, against the diagram of tmt-lg-ghosts
+
+b=8; ../tmt-distributed-double dens40.npy -b $b -n dens40-dist-b$b-n.tmt     || exit 1
+b=8; ../triplet-persistence-lg-double dens40-dist-b$b-n.tmt dens40-dist-pd-n-b$b
+b=8; diff dens40-tmt-pd-n.dgm <(./sort.sh dens40-dist-pd-n-b$b-b*) || exit 1
+
+# k-ary rounds
+
+b=8; ../tmt-distributed-double dens40.npy -b $b -n -k 4 dens40-dist-b$b-n-k4.tmt     || exit 1
+b=8; ../triplet-persistence-lg-double dens40-dist-b$b-n-k4.tmt dens40-dist-pd-n-k4-b$b
+b=8; diff dens40-tmt-pd-n.dgm <(./sort.sh dens40-dist-pd-n-k4-b$b-b*) || exit 1
+
+b=16; ../tmt-distributed-double dens40.npy -b $b -n -k 4 dens40-dist-b$b-n-k4.tmt     || exit 1
+b=16; ../triplet-persistence-lg-double dens40-dist-b$b-n-k4.tmt dens40-dist-pd-n-k4-b$b
+b=16; diff dens40-tmt-pd-n.dgm <(./sort.sh dens40-dist-pd-n-k4-b$b-b*) || exit 1
+
+# edges resolved in a single exchange
+
+b=8; ../tmt-distributed-double dens40.npy -b $b -n --lean dens40-dist-b$b-n-lean.tmt     || exit 1
+b=8; ../triplet-persistence-lg-double dens40-dist-b$b-n-lean.tmt dens40-dist-pd-n-lean-b$b
+b=8; diff dens40-tmt-pd-n.dgm <(./sort.sh dens40-dist-pd-n-lean-b$b-b*) || exit 1
+
+# blocks of each process merged in shared memory first
+
+b=8; ../tmt-distributed-double dens40.npy -b $b -n --premerge dens40-dist-b$b-n-premerge.tmt     || exit 1
+b=8; ../triplet-persistence-lg-double dens40-dist-b$b-n-premerge.tmt dens40-dist-pd-n-premerge-b$b
+b=8; diff dens40-tmt-pd-n.dgm <(./sort.sh dens40-dist-pd-n-premerge-b$b-b*) || exit 1
+
+# branches of persistence below epsilon cancelled in the trees sent; the pairs above it must not change
+# (there are no pairs of persistence near 2e8 for rounding to move across)
+
+persistent() { awk '{ d = $1 - $2; if (d < 0) d = -d; if (d >= 2e8) print }' "$@"; }
+
+b=8; ../tmt-distributed-double dens40.npy -b $b -n -k 4 -e 2e8 dens40-dist-b$b-n-e.tmt     || exit 1
+b=8; ../triplet-persistence-lg-double dens40-dist-b$b-n-e.tmt dens40-dist-pd-n-e-b$b
+b=8; diff <(persistent dens40-tmt-pd-n.dgm) <(./sort.sh dens40-dist-pd-n-e-b$b-b* | persistent) || exit 1
@@ -1,9 +1,10 @@
-#ifdef REEBER_USE_TBB
+#if defined(REEBER_USE_TBB) || defined(REEBER_USE_THREADS)
 #define DIY_NO_THREADS
 #endif
 
 #include <iostream>
 #include <string>
+#include <limits>
 
 #include <dlog/stats.h>
 #include <dlog/log.h>
@@ -65,6 +66,9 @@ int main(int argc, char** argv)
     std::string prefix     = "./DIY.XXXXXX";
     int         in_memory  = -1;
     int         jobs       = 1;
+    int         k          = 2;
+    Real        epsilon    = 0;
+    Real        rho        = std::numeric_limits<Real>::quiet_NaN();
 
     std::string profile_path;
     std::string log_level = "info";
@@ -75,6 +79,9 @@ int main(int argc, char** argv)
         >> Option('b', "blocks",    nblocks,      "number of blocks to use")
         >> Option('m', "memory",    in_memory,    "maximum blocks to store in memory")
         >> Option('j', "jobs",      jobs,         "threads to use during the computation")
+        >> Option('k', "k",         k,            "use k-ary swap")
+        >> Option('e', "epsilon",   epsilon,      "cancel the branches of lower persistence in the trees sent during the reduction")
+        >> Option('r', "rho",       rho,          "only build the trees where the function is past this threshold")
         >> Option('s', "storage",   prefix,       "storage prefix")
         >> Option('p', "profile",   profile_path, "path to keep the execution profile")
         >> Option('l', "log",       log_level,    "log level")
@@ -83,6 +90,8 @@ int main(int argc, char** argv)
     bool        negate      = ops >> Present('n', "negate", "sweep superlevel sets");
     bool        wrap_       = ops >> Present('w', "wrap",   "periodic boundary conditions");
     bool        split       = ops >> Present(     "split",  "use split IO");
+    bool        lean        = ops >> Present(     "lean",   "resolve edges in a single exchange, without edge statistics");
+    bool        premerge    = ops >> Present(     "premerge", "merge the blocks of each process in shared memory, then reduce across processes");
 
     std::string infn, outfn;
     if (  ops >> Present('h', "help", "show help message") ||
@@ -101,6 +110,13 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    if (premerge && in_memory != -1)
+    {
+        if (world.rank() == 0)
+            fmt::print("--premerge needs all the blocks in memory (-m -1)\n");
+        return 1;
+    }
+
     r::task_scheduler_init init(threads);
 
     dlog::add_stream(std::cerr, dlog::severity(log_level))
@@ -226,6 +242,13 @@ int main(int argc, char** argv)
                       return expanded;
                   };
 
+    reeber::MergeOptions options;
+    options.k           = k;
+    options.lean        = lean;
+    options.premerge    = premerge;
+    options.epsilon     = epsilon;
+    options.threshold   = rho;
+
     reeber::compute_merge_tree(master, assigner,
                                &TripletMergeTreeBlock::mt,
                                &TripletMergeTreeBlock::edge_maps,
@@ -244,7 +267,8 @@ int main(int argc, char** argv)
                                             int gid = decomposer.point_to_gid(p);
                                             return gid;
                                           };
-                               });
+                               },
+                               options);
 
     // save the result
     timer.restart();
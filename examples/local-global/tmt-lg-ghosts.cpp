@@ -1,4 +1,4 @@
-#ifdef REEBER_USE_TBB
+#if defined(REEBER_USE_TBB) || defined(REEBER_USE_THREADS)
 #define DIY_NO_THREADS
 #endif
 
@@ -10,6 +10,8 @@
 #include <diy/point.hpp>
 #include <diy/serialization.hpp>
 
+#include "vertex-codec.h"
+
 namespace reeber {
 
     struct AmrVertexId {
@@ -70,6 +72,24 @@ namespace reeber {
         }
     };
 
+    template<>
+    struct VertexCodec<AmrVertexId>
+    {
+        static constexpr bool enabled = true;
+
+        static void encode(detail::VarintWriter& out, const AmrVertexId& prev, const AmrVertexId& x)
+        {
+            out.put_signed(std::int64_t(x.vertex - prev.vertex));
+            out.put_signed(std::int64_t(x.gid) - prev.gid);
+        }
+
+        static void decode(detail::VarintReader& in, const AmrVertexId& prev, AmrVertexId& x)
+        {
+            x.vertex = prev.vertex + size_t(in.get_signed());
+            x.gid = int(prev.gid + in.get_signed());
+        }
+    };
+
     using AmrEdge = std::tuple<AmrVertexId, AmrVertexId>;
 
     inline AmrEdge reverse_amr_edge(const AmrEdge& e)
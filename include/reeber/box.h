@@ -1,17 +1,22 @@
 #ifndef REEBER_BOX_H
 #define REEBER_BOX_H
 
+#include <array>
+#include <cstddef>
+
 #include "range/filtered.h"
 #include "range/transformed.h"
 #include "range/utility.h"
 
 #include "grid.h"
 #include "vertices.h"
+#include "connectivity.h"
 
 namespace reeber
 {
 
-template<unsigned D>
+// Connectivity selects the link of a vertex (see connectivity.h)
+template<unsigned D, class Connectivity = FreudenthalConnectivity<D>>
 class Box
 {
     public:
@@ -22,9 +27,13 @@ class Box
         struct              BoundaryTest;
         struct              BoundsTest;
         struct              PositionToVertex;
+        struct              LocalIndex;
+
+        typedef             LinkPositionIterator<Position, Connectivity>            NeighborIterator;
+        typedef             range::iterator_range<NeighborIterator>                 NeighborRange;
 
-        class               FreudenthalLinkIterator;
-        typedef             range::iterator_range<FreudenthalLinkIterator>          FreudenthalLinkRange;
+        static constexpr unsigned   link_size = Connectivity::size;
+        typedef             std::array<std::ptrdiff_t, link_size>                   LinkOffsets;
 
         typedef             VerticesIterator<Position>                              VI;
         typedef             range::transformed_range
@@ -33,22 +42,24 @@ class Box
         // Topology interface
         typedef             typename GridProxy::Index                               Vertex;
         typedef             range::filtered_range
-                                     <FreudenthalLinkRange, BoundsTest>             PositionLink;
+                                     <NeighborRange, BoundsTest>                    PositionLink;
         typedef             range::transformed_range
-                                <PositionLink, PositionToVertex>                    Link;
+                                <PositionLink, PositionToVertex>                    ShellLink;      // filtered, wrapped around
+        class               LinkIterator;
+        class               Link;
 
 
-                            Box(): g_(0, Position())                                {}
+                            Box(): g_(0, Position())                                { set_offsets(); }
                             Box(const Position& shape):
-                                g_(0, shape), to_(shape - Position::one())          {}
+                                g_(0, shape), to_(shape - Position::one())          { set_offsets(); }
                             Box(const Position& shape,
                                 const Position& from,
                                 const Position& to):
-                                g_(0, shape), from_(from), to_(to)                  {}
+                                g_(0, shape), from_(from), to_(to)                  { set_offsets(); }
                             Box(const Position& from,
                                 const Position& to):
                                 g_(0, to - from + Position::one()),
-                                from_(from), to_(to)                                {}
+                                from_(from), to_(to)                                { set_offsets(); }
 
 
         const Position&     from() const                                            { return from_; }
@@ -67,11 +78,15 @@ class Box
         range::iterator_range<VI>
         positions() const                                                           { return range::iterator_range<VI>(VI::begin(from_, to_), VI::end(from_, to_)); }
 
-        Link                link(const Position& p) const                           { return position_link(p)
-                                                                                                | range::transformed(position_to_vertex()); }
+        // the vertices away from the faces of the box (and of the grid) step
+        // through the offsets; only the ones near them get filtered
+        Link                link(const Position& p) const;
         Link                link(const Vertex& v) const                             { return link(position(v)); }
+        ShellLink           shell_link(const Position& p) const                     { return position_link(p)
+                                                                                                | range::transformed(position_to_vertex()); }
+        bool                interior(const Position& p) const;
 
-        PositionLink        position_link(const Position& p) const                  { return FreudenthalLinkRange(FreudenthalLinkIterator::begin(p), FreudenthalLinkIterator::end(p))
+        PositionLink        position_link(const Position& p) const                  { return NeighborRange(NeighborIterator::begin(p), NeighborIterator::end(p))
                                                                                                 | range::filtered(bounds_test()); }
         PositionLink        position_link(const Vertex& v) const                    { return position_link(position(v)); }
 
@@ -90,9 +105,10 @@ class Box
         BoundaryTest        boundary_test() const                                   { return BoundaryTest(*this); }
         BoundsTest          bounds_test() const                                     { return BoundsTest(*this); }
         PositionToVertex    position_to_vertex() const                              { return PositionToVertex(*this); }
+        LocalIndex          local_index() const                                     { return LocalIndex(*this); }
 
 
-        void                swap(Box& other)                                        { g_.swap(other.g_); std::swap(from_, other.from_); std::swap(to_, other.to_); }
+        void                swap(Box& other)                                        { g_.swap(other.g_); std::swap(from_, other.from_); std::swap(to_, other.to_); std::swap(offsets_, other.offsets_); }
 
         bool                operator==(const Box& other) const                      { return from_ == other.from_ && to_ == other.to_; }
 
@@ -131,14 +147,38 @@ class Box
             const Box&      box_;
         };
 
+        // maps a vertex of the box onto [0, size()), row-major w.r.t. from()
+        struct LocalIndex
+        {
+                            LocalIndex(const Box& box): box_(box)                   {}
+            size_t          size() const                                            { return box_.size(); }
+            size_t          operator()(const Vertex& v) const
+            {
+                Position p = box_.g_.vertex(v);
+                size_t   idx = 0;
+                for (unsigned i = 0; i < D; ++i)
+                {
+                    auto c = (p[i] - box_.from()[i]) % box_.grid_shape()[i];       // wrap-around
+                    if (c < 0) c += box_.grid_shape()[i];
+                    idx = idx * (box_.to()[i] - box_.from()[i] + 1) + c;
+                }
+                return idx;
+            }
+            const Box&      box_;
+        };
+
         // computes position inside the box (adjusted for the wrap-around, if need be)
         Position            position(const Vertex& v) const                         { Position p = g_.vertex(v); for (unsigned i = 0; i < D; ++i) if (p[i] < from()[i]) p[i] += grid_shape()[i]; return p; }
 
         Position            positive_position(Position p) const                     { for (unsigned i = 0; i < D; ++i) if (p[i] < 0) p[i] += grid_shape()[i]; return p; }
 
+    private:
+        void                set_offsets();
+
     private:
         GridProxy           g_;
         Position            from_, to_;
+        LinkOffsets         offsets_;           // index offsets of the link, for the interior vertices
 };
 
 }
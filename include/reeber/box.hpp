@@ -1,8 +1,8 @@
 #include <dlog/log.h>
 
-template<unsigned D>
-reeber::Box<D>
-reeber::Box<D>::
+template<unsigned D, class C>
+reeber::Box<D,C>
+reeber::Box<D,C>::
 intersect(const Box& other) const
 {
     Position from, to;
@@ -15,9 +15,9 @@ intersect(const Box& other) const
     return Box(g_, from, to);
 }
 
-template<unsigned D>
+template<unsigned D, class C>
 bool
-reeber::Box<D>::
+reeber::Box<D,C>::
 intersects(const Box& other) const
 {
     for (unsigned i = 0; i < D; ++i)
@@ -27,9 +27,9 @@ intersects(const Box& other) const
     return true;
 }
 
-template<unsigned D>
+template<unsigned D, class C>
 bool
-reeber::Box<D>::
+reeber::Box<D,C>::
 contains(const Position& p) const
 {
     for (unsigned i = 0; i < D; ++i)
@@ -38,9 +38,9 @@ contains(const Position& p) const
     return true;
 }
 
-template<unsigned D>
+template<unsigned D, class C>
 bool
-reeber::Box<D>::
+reeber::Box<D,C>::
 boundary(const Position& p, bool degenerate) const
 {
     for (unsigned i = 0; i < D; ++i)
@@ -53,9 +53,9 @@ boundary(const Position& p, bool degenerate) const
     return false;
 }
 
-template<unsigned D>
-reeber::Box<D>
-reeber::Box<D>::
+template<unsigned D, class C>
+reeber::Box<D,C>
+reeber::Box<D,C>::
 side(unsigned axis, bool upper) const
 {
     Box res(*this);
@@ -68,9 +68,9 @@ side(unsigned axis, bool upper) const
     return res;
 }
 
-template<unsigned D>
+template<unsigned D, class C>
 void
-reeber::Box<D>::
+reeber::Box<D,C>::
 merge(const Box& other)
 {
 #if DEBUG
@@ -92,60 +92,86 @@ merge(const Box& other)
     }
 }
 
-/* Box::FreudenthalLinkIterator */
-template<unsigned D>
-class reeber::Box<D>::FreudenthalLinkIterator:
-    public std::iterator<std::forward_iterator_tag, Position>
+/* Box::LinkIterator */
+template<unsigned D, class C>
+class reeber::Box<D,C>::LinkIterator:
+    public std::iterator<std::forward_iterator_tag, Vertex>
 {
-    using Parent = std::iterator<std::forward_iterator_tag, Position>;
-
     public:
-        typedef     typename Parent::value_type                     value_type;
-        typedef     typename Parent::difference_type                difference_type;
-        typedef     typename Parent::reference                      reference;
-
-                    FreudenthalLinkIterator(): loc_(0), dir_(0)     {}
-                    FreudenthalLinkIterator(const Position& p, int loc = 0, int dir = 1):
-                        p_(p), v_(p), loc_(loc), dir_(dir)          {}
+        typedef     typename ShellLink::iterator                    ShellIterator;
 
-        static FreudenthalLinkIterator
-                    begin(const Position& p)                        { FreudenthalLinkIterator it(p); ++it; return it; }
-        static FreudenthalLinkIterator
-                    end(const Position& p)                          { return FreudenthalLinkIterator(p, 0, -1); }
+                    LinkIterator(Vertex base, const std::ptrdiff_t* offset, ShellIterator shell):
+                        base_(base), offset_(offset), shell_(shell) {}
 
-        const Position&             operator*() const               { return v_; }
-        const Position*             operator->() const              { return &v_; }
+        Vertex      operator*() const                               { return offset_ ? Vertex(std::ptrdiff_t(base_) + *offset_) : *shell_; }
 
-        FreudenthalLinkIterator&   operator++()                     { increment(); return *this; }
-        FreudenthalLinkIterator    operator++(int)                  { FreudenthalLinkIterator it = *this; increment(); return it; }
+        LinkIterator&   operator++()                                { if (offset_) ++offset_; else ++shell_; return *this; }
+        LinkIterator    operator++(int)                             { LinkIterator it = *this; ++(*this); return it; }
 
-        friend bool operator==(const FreudenthalLinkIterator& x, const FreudenthalLinkIterator& y)    { return x.v_ == y.v_; }
-        friend bool operator!=(const FreudenthalLinkIterator& x, const FreudenthalLinkIterator& y)    { return x.v_ != y.v_; }
+        friend bool operator==(const LinkIterator& x, const LinkIterator& y)      { return x.offset_ == y.offset_ && x.shell_ == y.shell_; }
+        friend bool operator!=(const LinkIterator& x, const LinkIterator& y)      { return !(x == y); }
 
     private:
-        void        increment();
+        Vertex                  base_;
+        const std::ptrdiff_t*   offset_;        // nullptr on the shell
+        ShellIterator           shell_;
+};
 
-    private:
-        Position    p_, v_;
-        int         loc_;
-        int         dir_;
+template<unsigned D, class C>
+class reeber::Box<D,C>::Link: public range::iterator_range<LinkIterator>
+{
+    public:
+        using Parent = range::iterator_range<LinkIterator>;
+
+                    Link(const LinkIterator& begin, const LinkIterator& end):
+                        Parent(begin, end)                          {}
 };
 
-template<unsigned D>
-void
-reeber::Box<D>::FreudenthalLinkIterator::
-increment()
+template<unsigned D, class C>
+typename reeber::Box<D,C>::Link
+reeber::Box<D,C>::
+link(const Position& p) const
 {
-    loc_ += dir_;
-    if (loc_ == (1 << D))
+    typedef     typename LinkIterator::ShellIterator                ShellIterator;
+    typedef     typename PositionLink::iterator                     FilteredIterator;
+
+    if (interior(p))
     {
-        dir_ = -1;
-        loc_ += dir_;
+        NeighborIterator        none = NeighborIterator::end(p);
+        ShellIterator           empty(FilteredIterator(none, none, bounds_test()), position_to_vertex());
+        Vertex                  base = g_.index(p);
+        return Link(LinkIterator(base, offsets_.data(), empty), LinkIterator(base, offsets_.data() + link_size, empty));
     }
 
+    ShellLink shell = shell_link(p);
+    return Link(LinkIterator(0, nullptr, shell.begin()), LinkIterator(0, nullptr, shell.end()));
+}
+
+// all the neighbors are in the box and in the grid, without wrapping around
+template<unsigned D, class C>
+bool
+reeber::Box<D,C>::
+interior(const Position& p) const
+{
     for (unsigned i = 0; i < D; ++i)
-        if (loc_ & (1 << i))
-            v_[i] = p_[i] + dir_;
-        else
-            v_[i] = p_[i];
+        if (p[i] <= from_[i] || p[i] >= to_[i] || p[i] <= 0 || p[i] + 1 >= grid_shape()[i])
+            return false;
+    return true;
+}
+
+template<unsigned D, class C>
+void
+reeber::Box<D,C>::
+set_offsets()
+{
+    const C& table = detail::ConnectivityTable<C>::value;
+
+    Position one = Position::one();
+    for (unsigned k = 0; k < link_size; ++k)
+    {
+        Position q = one;
+        for (unsigned i = 0; i < D; ++i)
+            q[i] += table.direction[k][i];
+        offsets_[k] = std::ptrdiff_t(g_.index(q) - g_.index(one));
+    }
 }
@@ -0,0 +1,153 @@
+#ifndef REEBER_CONNECTIVITY_H
+#define REEBER_CONNECTIVITY_H
+
+#include <iterator>
+
+namespace reeber
+{
+
+/**
+ * Connectivity policies for Box and MaskedBox. Each one lists the directions
+ * of the link of a vertex, direction[k][i] in {-1, 0, 1}, computed at compile
+ * time; the link must be symmetric (every direction comes with its negation).
+ */
+
+// Freudenthal triangulation (14 neighbors in 3D): the bit masks 1 .. 2^D - 1
+// going up, then 2^D - 1 .. 1 going down
+template<unsigned D>
+struct FreudenthalConnectivity
+{
+    static constexpr unsigned   dimension = D;
+    static constexpr unsigned   size = 2*((1u << D) - 1);
+
+    constexpr                   FreudenthalConnectivity(): direction()
+    {
+        for (unsigned k = 0; k < size; ++k)
+        {
+            unsigned loc = k < size/2 ? k + 1 : size - k;
+            int      dir = k < size/2 ? 1 : -1;
+            for (unsigned i = 0; i < D; ++i)
+                direction[k][i] = (loc & (1u << i)) ? dir : 0;
+        }
+    }
+
+    int                         direction[size][D];
+};
+
+namespace detail
+{
+    constexpr unsigned  pow3(unsigned d)        { return d == 0 ? 1 : 3*pow3(d - 1); }
+
+    // the directions of the cube [-1,1]^D with at most max_nonzero nonzero coordinates
+    template<unsigned D, unsigned max_nonzero>
+    struct CubeConnectivity
+    {
+        static constexpr unsigned   count()
+        {
+            unsigned n = 0;
+            for (unsigned x = 0; x < pow3(D); ++x)
+            {
+                unsigned nonzero = 0;
+                for (unsigned i = 0, y = x; i < D; ++i, y /= 3)
+                    nonzero += (y % 3 != 1);
+                if (nonzero > 0 && nonzero <= max_nonzero)
+                    ++n;
+            }
+            return n;
+        }
+
+        static constexpr unsigned   dimension = D;
+        static constexpr unsigned   size = count();
+
+        constexpr                   CubeConnectivity(): direction()
+        {
+            unsigned k = 0;
+            for (unsigned x = 0; x < pow3(D); ++x)
+            {
+                unsigned nonzero = 0;
+                for (unsigned i = 0, y = x; i < D; ++i, y /= 3)
+                    nonzero += (y % 3 != 1);
+                if (nonzero == 0 || nonzero > max_nonzero)
+                    continue;
+                for (unsigned i = 0, y = x; i < D; ++i, y /= 3)
+                    direction[k][i] = int(y % 3) - 1;
+                ++k;
+            }
+        }
+
+        int                         direction[size][D];
+    };
+}
+
+// neighbors across the faces (6 in 3D)
+template<unsigned D>
+struct FaceConnectivity: detail::CubeConnectivity<D, 1>         {};
+
+// neighbors across the faces and the edges (18 in 3D)
+template<unsigned D>
+struct EdgeConnectivity: detail::CubeConnectivity<D, 2>         {};
+
+// all the neighbors in the cube around the vertex (26 in 3D)
+template<unsigned D>
+struct FullConnectivity: detail::CubeConnectivity<D, D>         {};
+
+namespace detail
+{
+    // one instance of the table per connectivity, to iterate over
+    template<class Connectivity>
+    struct ConnectivityTable
+    {
+        static constexpr Connectivity   value {};
+    };
+
+    template<class Connectivity>
+    constexpr Connectivity ConnectivityTable<Connectivity>::value;
+}
+
+/* LinkPositionIterator: positions p + direction[k], without any bounds checks */
+template<class Position, class Connectivity>
+class LinkPositionIterator:
+    public std::iterator<std::forward_iterator_tag, Position>
+{
+    using Parent = std::iterator<std::forward_iterator_tag, Position>;
+
+    public:
+        typedef     typename Parent::value_type                     value_type;
+        typedef     typename Parent::difference_type                difference_type;
+        typedef     typename Parent::reference                      reference;
+
+                    LinkPositionIterator(): k_(0)                   {}
+                    LinkPositionIterator(const Position& p, unsigned k):
+                        p_(p), v_(p), k_(k)                         { set(); }
+
+        static LinkPositionIterator
+                    begin(const Position& p)                        { return LinkPositionIterator(p, 0); }
+        static LinkPositionIterator
+                    end(const Position& p)                          { return LinkPositionIterator(p, Connectivity::size); }
+
+        const Position&             operator*() const               { return v_; }
+        const Position*             operator->() const              { return &v_; }
+
+        LinkPositionIterator&       operator++()                    { ++k_; set(); return *this; }
+        LinkPositionIterator        operator++(int)                 { LinkPositionIterator it = *this; ++(*this); return it; }
+
+        friend bool operator==(const LinkPositionIterator& x, const LinkPositionIterator& y)  { return x.k_ == y.k_; }
+        friend bool operator!=(const LinkPositionIterator& x, const LinkPositionIterator& y)  { return !(x == y); }
+
+    private:
+        void        set()
+        {
+            if (k_ >= Connectivity::size) return;
+            const auto& direction = detail::ConnectivityTable<Connectivity>::value.direction[k_];
+            for (unsigned i = 0; i < Connectivity::dimension; ++i)
+                v_[i] = p_[i] + direction[i];
+        }
+
+    private:
+        Position    p_, v_;
+        unsigned    k_;
+};
+
+}
+
+#endif
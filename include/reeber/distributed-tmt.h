@@ -1,6 +1,11 @@
 #pragma once
 
 #include <tuple>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -9,44 +14,79 @@
 #include <diy/partners/swap.hpp>
 
 #include "triplet-merge-tree.h"
+#include "triplet-merge-tree-serialization.h"
 #include "edges.h"
+#include "box.h"
 
 namespace reeber
 {
 
+// options of the reduction in resolve_and_merge and compute_merge_tree, e.g.,
+//   MergeOptions options; options.k = 4; options.epsilon = 0.1;
+struct MergeOptions
+{
+    int         k           = 2;        // arity of the swap rounds
+    bool        lean        = false;    // resolve the edges in a single exchange, without edge statistics
+    bool        premerge    = false;    // merge the blocks of each process in shared memory, then reduce across processes
+    double      epsilon     = 0;        // > 0: the trees sent in the reduction lose their branches of lower
+                                        // persistence (see simplify); the pairs of persistence at least epsilon don't change
+    double      threshold   = std::numeric_limits<double>::quiet_NaN();
+                                        // compute_merge_tree only; unless NaN, the local trees are built only out of the
+                                        // vertices past the threshold, as in the serial threshold variants
+};
+
 namespace detail
 {
-    template<class Block, class Vertex, class Value, class Partners, class GidGenerator>
+    template<class Block, class Vertex, class Value, class Aggregate, class Partners, class GidGenerator>
     struct MergeSparsify;
 
-    template<class Topology, class LocalTest>
-    struct LocalTopology;
+    template<class Vertex, class Value, class Aggregate, class Topology, class Function, class GidGen, class AggregateOf>
+    void compute_local_merge_tree(TripletMergeTree<Vertex,Value,Aggregate>& mt,
+                                  EdgeMaps<Vertex,Value>&                   edge_maps,
+                                  const Topology&                           topology,
+                                  const Function&                           f,
+                                  const GidGen&                             gid_gen,
+                                  int                                       gid,
+                                  const AggregateWith<AggregateOf>&         aggregate);
 
-    template<class Topology, class LocalTest>
-    LocalTopology<Topology, LocalTest>
-    make_local_topology(const Topology& t, const LocalTest& lt)     { return LocalTopology<Topology, LocalTest>(t, lt); }
-}
+    // only the vertices (of gid) past the threshold, and the edges between them
+    template<class Vertex, class Value, class Aggregate, class Topology, class Function, class GidGen, class AggregateOf>
+    void compute_local_merge_tree(TripletMergeTree<Vertex,Value,Aggregate>& mt,
+                                  EdgeMaps<Vertex,Value>&                   edge_maps,
+                                  const Topology&                           topology,
+                                  const Function&                           f,
+                                  const GidGen&                             gid_gen,
+                                  int                                       gid,
+                                  const AggregateWith<AggregateOf>&         aggregate,
+                                  typename TripletMergeTree<Vertex,Value,Aggregate>::Value threshold);
 
-template<class Block, class Vertex, class Value>
-void
-resolve_edges(diy::Master&                            master,
-              TripletMergeTree<Vertex,Value> Block::* tmt_,
-              EdgeMaps<Vertex,Value> Block::*         edge_maps_);
-
-template<class Block, class Vertex, class Value, class GidGenerator, class Partners>
-void merge_trees(diy::Master&                            master,
-                 diy::Assigner&                          assigner,
-                 TripletMergeTree<Vertex,Value> Block::* tmt_,
-                 EdgeMaps<Vertex,Value> Block::*         edge_maps_,
-                 const GidGenerator&                     gid_generator,
-                 const Partners&                         partners)
-{
-    // remove (simplify into vertices vectors) degree-2 nodes
-    master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
+    // vertex u, and the value and the representative it's relabeled to
+    template<class Vertex, class Value>
+    struct Relabel
     {
-        auto& tmt       = b->*tmt_;
-        auto& edge_maps = b->*edge_maps_;
+        Vertex      u;
+        Value       value;
+        Vertex      u_;
+
+        bool        operator<(const Relabel& other) const   { return u < other.u; }
+    };
+
+    template<class Block, class Vertex, class Value, class Aggregate>
+    void send_relabels(diy::Master&                                      master,
+                       TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                       EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                       bool                                              edge_stats);
 
+    template<class Block, class Vertex, class Value, class Aggregate>
+    size_t receive_relabels(Block*                                            b,
+                            const diy::Master::ProxyWithLink&                 cp,
+                            TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                            EdgeMaps<Vertex,Value> Block::*                   edge_maps_);
+
+    // remove (simplify into vertices vectors) degree-2 nodes, keeping the ones the resolved edges go through
+    template<class Vertex, class Value, class Aggregate>
+    void remove_degree_two(TripletMergeTree<Vertex,Value,Aggregate>& tmt, const EdgeMaps<Vertex,Value>& edge_maps)
+    {
         std::unordered_set<Vertex> special;
         for (auto& kv_em : edge_maps)
         {
@@ -57,120 +97,208 @@ void merge_trees(diy::Master&                            master,
                 if (tmt.contains(s)) special.insert(s);
             }
         }
-        remove_degree_two(tmt, [&special](Vertex u) { return special.find(u) != special.end(); });
-        LOG_SEV(debug) << "[" << b->gid << "] " << "Tree size after pruning degree-2: " << tmt.size();
+        reeber::remove_degree_two(tmt, [&special](Vertex u) { return special.find(u) != special.end(); });
+    }
+
+    template<class Block, class Vertex, class Value, class Aggregate>
+    void resolve_and_prune(diy::Master&                                      master,
+                           TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                           EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                           bool                                              lean);
+
+    template<class Vertex, class Value, class Aggregate>
+    void match_edges(FlatEdgeMap<Vertex,Value>&                              ours,
+                     const typename FlatEdgeMap<Vertex,Value>::Records&      theirs,
+                     const TripletMergeTree<Vertex,Value,Aggregate>&         mt,
+                     std::vector<Edge<Vertex>>&                              merge_edges);
+
+    // all the blocks of a process, merged into one for the reduction across the processes
+    template<class Vertex, class Value, class Aggregate>
+    struct NodeBlock
+    {
+                    NodeBlock(int gid_, bool negate):
+                        gid(gid_), tmt(negate)                  {}
+
+        static void destroy(void* b)                            { delete static_cast<NodeBlock*>(b); }
+
+        int                                         gid;
+        TripletMergeTree<Vertex,Value,Aggregate>    tmt;
+        EdgeMaps<Vertex,Value>                      edge_maps;
+    };
+
+    template<class Block, class Vertex, class Value, class Aggregate, class GidGenerator>
+    void merge_trees_two_level(diy::Master&                                      master,
+                               diy::Assigner&                                    assigner,
+                               TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                               EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                               const GidGenerator&                               gid_generator,
+                               int                                               k,
+                               Value                                             epsilon);
+
+    // copies the part of in needed by the local vertices into out, with the collapsed vertices of the local ones;
+    // the aggregates of the rest of in fold into the nodes of out
+    template<class Vertex, class Value, class Aggregate, class Local>
+    void extract_local(TripletMergeTree<Vertex,Value,Aggregate>& out, TripletMergeTree<Vertex,Value,Aggregate>& in, const Local& local);
+}
+
+template<class Block, class Vertex, class Value, class Aggregate>
+void
+resolve_edges(diy::Master&                                      master,
+              TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+              EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+              bool                                              edge_stats = true);
+
+template<class Block, class Vertex, class Value, class Aggregate, class GidGenerator, class Partners>
+void merge_trees(diy::Master&                                      master,
+                 diy::Assigner&                                    assigner,
+                 TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                 EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                 const GidGenerator&                               gid_generator,
+                 const Partners&                                   partners)
+{
+    master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
+    {
+        detail::remove_degree_two(b->*tmt_, b->*edge_maps_);
+        LOG_SEV(debug) << "[" << b->gid << "] " << "Tree size after pruning degree-2: " << (b->*tmt_).size();
     });
 
     // perform the global swap-reduce
     diy::reduce(master, assigner, partners,
-                detail::MergeSparsify<Block, Vertex, Value, Partners, GidGenerator>(tmt_, edge_maps_, gid_generator));
+                detail::MergeSparsify<Block, Vertex, Value, Aggregate, Partners, GidGenerator>(tmt_, edge_maps_, gid_generator));
 }
 
-template<class Block, class Vertex, class Value, class GidGenerator, class Partners>
-void resolve_and_merge(diy::Master&                            master,
-                       diy::Assigner&                          assigner,
-                       TripletMergeTree<Vertex,Value> Block::* tmt_,
-                       EdgeMaps<Vertex,Value> Block::*         edge_maps_,
-                       const GidGenerator&                     gid_generator,
-                       const Partners&                         partners)
+// with explicit partners, options.k and options.premerge are ignored
+template<class Block, class Vertex, class Value, class Aggregate, class GidGenerator, class Partners>
+void resolve_and_merge(diy::Master&                                      master,
+                       diy::Assigner&                                    assigner,
+                       TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                       EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                       const GidGenerator&                               gid_generator,
+                       const Partners&                                   partners,
+                       const MergeOptions&                               options = MergeOptions())
 {
-    resolve_edges<Block, Vertex, Value>(master, tmt_, edge_maps_);
-    merge_trees<Block,Vertex,Value,GidGenerator,Partners>(master,assigner,tmt_,edge_maps_,gid_generator,partners);
+    static_assert(!std::is_arithmetic<Partners>::value, "pass k through MergeOptions");
+
+    detail::resolve_and_prune(master, tmt_, edge_maps_, options.lean);
+
+    // perform the global swap-reduce
+    diy::reduce(master, assigner, partners,
+                detail::MergeSparsify<Block, Vertex, Value, Aggregate, Partners, GidGenerator>(tmt_, edge_maps_, gid_generator, Value(options.epsilon)));
 }
 
-template<class Block, class Vertex, class Value, class GidGenerator>
-void resolve_and_merge(diy::Master&                            master,
-                       diy::Assigner&                          assigner,
-                       TripletMergeTree<Vertex,Value> Block::* tmt_,
-                       EdgeMaps<Vertex,Value> Block::*         edge_maps_,
-                       const GidGenerator&                     gid_generator)
+template<class Block, class Vertex, class Value, class Aggregate, class GidGenerator>
+void resolve_and_merge(diy::Master&                                      master,
+                       diy::Assigner&                                    assigner,
+                       TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                       EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                       const GidGenerator&                               gid_generator,
+                       const MergeOptions&                               options = MergeOptions())
 {
+    // premerge: first merge all the blocks of a process in shared memory, then
+    // reduce one tree per process (swapping among the processes, k at a time)
+    if (options.premerge)
+    {
+        detail::resolve_and_prune(master, tmt_, edge_maps_, options.lean);
+        detail::merge_trees_two_level(master, assigner, tmt_, edge_maps_, gid_generator, options.k, Value(options.epsilon));
+        return;
+    }
+
     // By default, use 1-D domain decomposition. Clearly inefficient, but the
     // best we can hope for in absence of other assumptions.
+    // k-ary rounds: fewer rounds (and global synchronizations), k trees merged per round
     int nblocks = assigner.nblocks();
     diy::RegularDecomposer<diy::DiscreteBounds>  decomposer(1, diy::interval(0, nblocks - 1), nblocks);
-    resolve_and_merge(master, assigner, tmt_, edge_maps_, gid_generator, diy::RegularSwapPartners(decomposer, 2, true));
+    resolve_and_merge(master, assigner, tmt_, edge_maps_, gid_generator, diy::RegularSwapPartners(decomposer, options.k, true), options);
 }
 
-template<class Block, class Vertex, class Value,
-         class TopologyGenerator, class FunctionGenerator, class GidGenerator,
-         class Partners>
-void compute_merge_tree(diy::Master&                            master,
-                        diy::Assigner&                          assigner,
-                        TripletMergeTree<Vertex,Value> Block::* tmt_,
-                        EdgeMaps<Vertex,Value> Block::*         edge_maps_,
-                        const TopologyGenerator&                topology_generator,
-                        const FunctionGenerator&                function_generator,
-                        const GidGenerator&                     gid_generator,
-                        const Partners&                         partners)
+namespace detail
 {
-    // This makes two passes over the topology: first to compute the local
-    // tree; second to figure out outgoing edges. Not super-efficient, but good
-    // enough for now.
-
-    // compute local tree
-    master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
+    template<class Block, class Vertex, class Value, class Aggregate,
+             class TopologyGenerator, class FunctionGenerator, class GidGenerator, class AggregateOf>
+    void compute_local_merge_trees(diy::Master&                                      master,
+                                   TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                                   EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                                   const TopologyGenerator&                          topology_generator,
+                                   const FunctionGenerator&                          function_generator,
+                                   const GidGenerator&                               gid_generator,
+                                   const AggregateWith<AggregateOf>&                 aggregate,
+                                   const MergeOptions&                               options)
     {
-        using Topology      = decltype(topology_generator(b));
-        using Function      = decltype(function_generator(b));
-        using GidGen        = decltype(gid_generator(b));
-
-        Topology topology   = topology_generator(b);
-        Function function   = function_generator(b);
-        GidGen   gid_gen    = gid_generator(b);
+        // compute local tree and outgoing edges in a single pass over the topology
+        master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
+        {
+            using Topology      = decltype(topology_generator(b));
+            using Function      = decltype(function_generator(b));
+            using GidGen        = decltype(gid_generator(b));
 
-        LOG_SEV(debug) << "Got topology: " << topology;
+            Topology topology   = topology_generator(b);
+            Function function   = function_generator(b);
+            GidGen   gid_gen    = gid_generator(b);
 
-        int   gid = cp.gid();
-        auto& tmt = b->*tmt_;
-        compute_merge_tree2(tmt, detail::make_local_topology(topology, [&](Vertex v) { return gid_gen(v) == gid; }), function);
-        LOG_SEV(debug) << "[" << b->gid << "] " << "Initial tree size: " << tmt.size();
-    });
+            LOG_SEV(debug) << "Got topology: " << topology;
 
-    // fill edges
-    master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
-    {
-        auto    topology    = topology_generator(b);
-        auto    gid_gen     = gid_generator(b);
-        int     gid         = cp.gid();
-        auto&   edge_maps   = b->*edge_maps_;
-
-        for (auto u : topology.vertices())
-        {
-            if (gid_gen(u) != gid)
-                continue;
+            auto& tmt = b->*tmt_;
+            if (std::isnan(options.threshold))
+                compute_local_merge_tree(tmt, b->*edge_maps_, topology, function, gid_gen, cp.gid(), aggregate);
+            else
+                compute_local_merge_tree(tmt, b->*edge_maps_, topology, function, gid_gen, cp.gid(), aggregate, Value(options.threshold));
+            LOG_SEV(debug) << "[" << b->gid << "] " << "Initial tree size: " << tmt.size();
+        });
+    }
+}
 
-            for (auto v : topology.link(u))
-            {
-                int v_gid = gid_gen(v);
-                if (v_gid == gid)      // need non-local neighbors
-                    continue;
+// topology_generator(b) gives the vertices of b (gid_generator(b) tells them apart)
+// and the layer of their neighbors around them
+template<class Block, class Vertex, class Value, class Aggregate,
+         class TopologyGenerator, class FunctionGenerator, class GidGenerator,
+         class Partners>
+void compute_merge_tree(diy::Master&                                      master,
+                        diy::Assigner&                                    assigner,
+                        TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                        EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                        const TopologyGenerator&                          topology_generator,
+                        const FunctionGenerator&                          function_generator,
+                        const GidGenerator&                               gid_generator,
+                        const Partners&                                   partners,
+                        const MergeOptions&                               options = MergeOptions())
+{
+    static_assert(!std::is_arithmetic<Partners>::value, "pass k through MergeOptions");
 
-                using ValueVertex   = std::tuple<Value, Vertex>;
-                edge_maps[v_gid].emplace(std::make_tuple(u,v), ValueVertex());     // just keep the edges
-            }
-        }
-    });
+    detail::compute_local_merge_trees(master, tmt_, edge_maps_, topology_generator, function_generator, gid_generator,
+                                      aggregate_with([](const Vertex&, Value) { return Aggregate(); }), options);
+    resolve_and_merge(master, assigner, tmt_, edge_maps_, gid_generator, partners, options);
+}
 
-    resolve_and_merge(master, assigner, tmt_, edge_maps_, gid_generator, partners);
+template<class Block, class Vertex, class Value, class Aggregate, class TopologyGenerator, class FunctionGenerator, class GidGenerator>
+void compute_merge_tree(diy::Master&                                      master,
+                        diy::Assigner&                                    assigner,
+                        TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                        EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                        const TopologyGenerator&                          topology_generator,
+                        const FunctionGenerator&                          function_generator,
+                        const GidGenerator&                               gid_generator,
+                        const MergeOptions&                               options = MergeOptions())
+{
+    detail::compute_local_merge_trees(master, tmt_, edge_maps_, topology_generator, function_generator, gid_generator,
+                                      aggregate_with([](const Vertex&, Value) { return Aggregate(); }), options);
+    resolve_and_merge(master, assigner, tmt_, edge_maps_, gid_generator, options);
 }
 
-template<class Block, class Vertex, class Value, class TopologyGenerator, class FunctionGenerator, class GidGenerator>
-void compute_merge_tree(diy::Master&                            master,
-                        diy::Assigner&                          assigner,
-                        TripletMergeTree<Vertex,Value> Block::* tmt_,
-                        EdgeMaps<Vertex,Value> Block::*         edge_maps_,
-                        const TopologyGenerator&                topology_generator,
-                        const FunctionGenerator&                function_generator,
-                        const GidGenerator&                     gid_generator)
+// Same, but sets the aggregate of every local node to aggregate.f(vertex, value) (see
+// compute_merge_tree2); every component of the resulting trees carries its total
+template<class Block, class Vertex, class Value, class Aggregate, class TopologyGenerator, class FunctionGenerator, class GidGenerator, class AggregateOf>
+void compute_merge_tree(diy::Master&                                      master,
+                        diy::Assigner&                                    assigner,
+                        TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                        EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                        const TopologyGenerator&                          topology_generator,
+                        const FunctionGenerator&                          function_generator,
+                        const GidGenerator&                               gid_generator,
+                        const detail::AggregateWith<AggregateOf>&         aggregate,
+                        const MergeOptions&                               options = MergeOptions())
 {
-    // By default, use 1-D domain decomposition. Clearly inefficient, but the
-    // best we can hope for in absence of other assumptions.
-    int nblocks = assigner.nblocks();
-    diy::RegularDecomposer<diy::DiscreteBounds>  decomposer(1, diy::interval(0, nblocks - 1), nblocks);
-    compute_merge_tree(master, assigner, tmt_, edge_maps_,
-                       topology_generator, function_generator, gid_generator,
-                       diy::RegularSwapPartners(decomposer, 2, true));
+    detail::compute_local_merge_trees(master, tmt_, edge_maps_, topology_generator, function_generator, gid_generator, aggregate, options);
+    resolve_and_merge(master, assigner, tmt_, edge_maps_, gid_generator, options);
 }
 
 }
@@ -1,43 +1,205 @@
-#include <reeber/range/filtered.h>
+namespace reeber
+{
+namespace detail
+{
+    // The vertices whose links are all the block's own, which is all a general
+    // topology can promise (none)
+    template<class Topology>
+    struct BlockCore
+    {
+                    BlockCore(const Topology&)                  {}
 
-// local both in vertices and in link
-template<class Topology, class LocalTest>
-struct reeber::detail::LocalTopology
+        template<class Vertex>
+        bool        operator()(const Vertex&) const             { return false; }
+    };
+
+    // A Box topology is the block and the layer of its neighbors around it (see
+    // compute_merge_tree), except where it ends at the grid; the vertices two
+    // layers in from its expanded faces have only the block's own neighbors
+    template<unsigned D, class C>
+    struct BlockCore<Box<D,C>>
+    {
+        using Position  = typename Box<D,C>::Position;
+        using Vertex    = typename Box<D,C>::Vertex;
+
+                    BlockCore(const Box<D,C>& topology):
+                        box(topology), from(topology.from()), to(topology.to())
+        {
+            for (unsigned i = 0; i < D; ++i)
+            {
+                if (from[i] != 0)                               from[i] += 2;
+                if (to[i] != topology.grid_shape()[i] - 1)      to[i]   -= 2;
+            }
+        }
+
+        bool        operator()(const Vertex& v) const
+        {
+            Position p = box.position(v);
+            for (unsigned i = 0; i < D; ++i)
+                if (p[i] < from[i] || p[i] > to[i])
+                    return false;
+            return true;
+        }
+
+        const Box<D,C>&     box;
+        Position            from, to;
+    };
+
+    // vertices are the ones of gid, plain or as (value, vertex) pairs (see compute_merge_tree2);
+    // passes(v) tells whether a neighbor outside of them would be in the tree of its own block
+    template<class Vertex, class Value, class Aggregate, class Topology, class Function, class GidGen, class AggregateOf, class Vertices, class Passes>
+    void compute_local_merge_tree_(TripletMergeTree<Vertex,Value,Aggregate>& mt,
+                                   EdgeMaps<Vertex,Value>&                   edge_maps,
+                                   const Topology&                           topology,
+                                   const Function&                           f,
+                                   const GidGen&                             gid_gen,
+                                   int                                       gid,
+                                   const AggregateWith<AggregateOf>&         aggregate,
+                                   const Vertices&                           vertices,
+                                   const Passes&                             passes)
+    {
+        using Neighbor      = typename TripletMergeTree<Vertex,Value,Aggregate>::Neighbor;
+        using ValueVertex   = std::tuple<Value, Vertex>;
+        using OutEdge       = std::tuple<int, Vertex, Vertex>;
+
+        // only the vertices near the boundary of the block look for the edges leaving it
+        BlockCore<Topology> core(topology);
+        thread_specific<std::vector<OutEdge>> out_edges;
+        compute_merge_tree2(mt, topology, f, vertices,
+                            [&aggregate](Neighbor u)        { u->aggregate() = aggregate.f(u->vertex, u->value); },
+                            [&](const Vertex& u, const Vertex& v)
+                            {
+                                // a vertex of ours outside the vertices is not an outgoing edge
+                                int v_gid = gid_gen(v);
+                                if (v_gid == gid || !passes(v))
+                                    return;
+                                out_edges.local().emplace_back(v_gid, u, v);
+                            },
+                            [&core](const Vertex& u)        { return !core(u); });
+
+        out_edges.combine_each([&](const std::vector<OutEdge>& edges)
+        {
+            for (auto& e : edges)
+                edge_maps[std::get<0>(e)].emplace(std::make_tuple(std::get<1>(e), std::get<2>(e)), ValueVertex());     // just keep the edges
+        });
+    }
+}
+}
+
+// Builds the tree of the vertices owned by gid and collects the edges leaving them, in the same pass over the links:
+// the tree only contains the local vertices, so gid_gen is only called on the shell of the block, to find them and
+// the neighbors outside of it
+template<class Vertex, class Value, class Aggregate, class Topology, class Function, class GidGen, class AggregateOf>
+void
+reeber::detail::compute_local_merge_tree(TripletMergeTree<Vertex,Value,Aggregate>& mt,
+                                         EdgeMaps<Vertex,Value>&                   edge_maps,
+                                         const Topology&                           topology,
+                                         const Function&                           f,
+                                         const GidGen&                             gid_gen,
+                                         int                                       gid,
+                                         const AggregateWith<AggregateOf>&         aggregate)
 {
-    using Vertices          = decltype(std::declval<Topology>().vertices());
-    using FilteredVertices  = reeber::range::filtered_range<Vertices, LocalTest>;
-    using Link              = decltype(std::declval<Topology>().link(*std::begin(std::declval<Vertices>())));
-    using FilteredLink      = reeber::range::filtered_range<Link, LocalTest>;
-    using Vertex            = typename std::remove_reference<decltype(*std::begin(std::declval<Vertices>()))>::type;
+    dlog::prof << "compute-merge-tree2";
 
-                LocalTopology(const Topology& topology_, const LocalTest& local_test_):
-                    topology(topology_), local_test(local_test_)        {}
+    BlockCore<Topology> core(topology);
+    std::vector<Vertex> vertices;
+    for (Vertex v : topology.vertices())
+        if (core(v) || gid_gen(v) == gid)
+            vertices.push_back(v);
 
-    FilteredVertices    vertices() const     { return topology.vertices() | reeber::range::filtered(local_test); }
-    FilteredLink        link(Vertex v) const { return topology.link(v)    | reeber::range::filtered(local_test); }
+    compute_local_merge_tree_(mt, edge_maps, topology, f, gid_gen, gid, aggregate, vertices, [](const Vertex&) { return true; });
 
-    const Topology&     topology;
-    const LocalTest&    local_test;
-};
+    dlog::prof >> "compute-merge-tree2";
+}
+
+// The neighbors of other blocks that don't pass the threshold aren't in their
+// trees, so they don't make outgoing edges either: both ends must agree on the edges
+template<class Vertex, class Value, class Aggregate, class Topology, class Function, class GidGen, class AggregateOf>
+void
+reeber::detail::compute_local_merge_tree(TripletMergeTree<Vertex,Value,Aggregate>& mt,
+                                         EdgeMaps<Vertex,Value>&                   edge_maps,
+                                         const Topology&                           topology,
+                                         const Function&                           f,
+                                         const GidGen&                             gid_gen,
+                                         int                                       gid,
+                                         const AggregateWith<AggregateOf>&         aggregate,
+                                         typename TripletMergeTree<Vertex,Value,Aggregate>::Value threshold)
+{
+    dlog::prof << "compute-merge-tree2";
+
+    BlockCore<Topology> core(topology);
+    std::vector<std::pair<Value, Vertex>> vertices;
+    for (Vertex v : topology.vertices())
+        if (core(v) || gid_gen(v) == gid)
+        {
+            Value val = f(v);
+            if (!mt.cmp(threshold, val))
+                vertices.emplace_back(val, v);
+        }
+
+    LOG_SEV(debug) << "Computing merge tree out of " << vertices.size() << " local vertices that pass the threshold";
+
+    compute_local_merge_tree_(mt, edge_maps, topology, f, gid_gen, gid, aggregate, vertices, [&](const Vertex& v) { return !mt.cmp(threshold, f(v)); });
+
+    dlog::prof >> "compute-merge-tree2";
+}
+
+// Merge-joins the edges of a tree about to be loaded into mt (theirs, sorted
+// by (u,v)) with ours (keyed by (v,u)). The common edges become merge edges,
+// determined against the tree accumulated in mt so far; the rest of theirs
+// are added to ours.
+template<class Vertex, class Value, class Aggregate>
+void
+reeber::detail::match_edges(FlatEdgeMap<Vertex,Value>&                              ours,
+                            const typename FlatEdgeMap<Vertex,Value>::Records&      theirs,
+                            const TripletMergeTree<Vertex,Value,Aggregate>&         mt,
+                            std::vector<Edge<Vertex>>&                              merge_edges)
+{
+    using FlatEdge = typename FlatEdgeMap<Vertex,Value>::Record;
+
+    typename FlatEdgeMap<Vertex,Value>::Records added;
+    ours.join(theirs,
+              [&](const FlatEdge& e, const FlatEdge&)
+              {
+                  // e is u - s - v, stored as (v,u); determine whether s is
+                  // local or remote (i.e., if we are merging (u,s) or (s,v))
+                  if (mt.contains(e.s))
+                      merge_edges.emplace_back(e.s, e.u);
+                  else
+                      merge_edges.emplace_back(e.v, e.s);
+              },
+              [&](const FlatEdge& e) { added.push_back(FlatEdge { e.v, e.u, e.value, e.s }); });
+    ours.insert(std::move(added));
+}
 
 // TODO: this needs to use gids as a mechanism to decide what to prune, not boxes
-// NB: this assumes binary reduction
-template<class Block, class Vertex, class Value, class Partners, class GidGenerator>
+// Works with k-ary reduction: the incoming trees are loaded one after another,
+// and a single merge pass connects them all
+// TODO: communication doesn't overlap with merging: diy::reduce delivers a round's
+//       trees only after every block is done with the previous round. Loading a
+//       partner's tree while the others are still in flight needs the rounds driven
+//       by iexchange, with each block tracking its own round.
+template<class Block, class Vertex, class Value, class Aggregate, class Partners, class GidGenerator>
 struct reeber::detail::MergeSparsify
 {
-    using TripletMergeTree  = reeber::TripletMergeTree<Vertex,Value>;
+    using TripletMergeTree  = reeber::TripletMergeTree<Vertex,Value,Aggregate>;
     using EdgeMap           = reeber::EdgeMap<Vertex,Value>;
     using EdgeMaps          = reeber::EdgeMaps<Vertex,Value>;
+    using FlatEdgeMap       = reeber::FlatEdgeMap<Vertex,Value>;
+    using FlatEdges         = typename FlatEdgeMap::Records;
 
     TripletMergeTree Block::*       tmt;
     EdgeMaps Block::*               edge_maps;
     const GidGenerator&             gid_generator;
+    Value                           epsilon;            // cancel the branches of lower persistence before sending (0 = keep all)
 
             MergeSparsify(TripletMergeTree Block::* tmt_,
                           EdgeMaps Block::*         edge_maps_,
-                          const GidGenerator&       gid_generator_):
+                          const GidGenerator&       gid_generator_,
+                          Value                     epsilon_ = 0):
                 tmt(tmt_), edge_maps(edge_maps_),
-                gid_generator(gid_generator_)       {}
+                gid_generator(gid_generator_),
+                epsilon(epsilon_)                   {}
 
     void    operator()(Block* b, const diy::ReduceProxy& srp, const Partners& partners) const
     {
@@ -56,77 +218,60 @@ struct reeber::detail::MergeSparsify
         LOG_SEV(debug) << "  incoming link size: " << in_size;
         if (in_size)
         {
-            dlog::prof << "dequeue";
-            std::vector<TripletMergeTree>  trees;
-            for (int i = 0; i < in_size; ++i)
-                trees.emplace_back((b->*tmt).negate());
-            EdgeMap out_edges;
-            int local_pos = -1;
+            // Each neighbor's edges come before its tree. Our edges, keyed by
+            // (v,u), are merge-joined with the neighbor's edges, sorted by
+            // (u,v); the merge edges are determined against the tree
+            // accumulated so far (ours and the ones already loaded), so that
+            // edges between two incoming trees are matched too. Then its tree
+            // is loaded straight into ours. A single merge connects everything
+            // at the end.
+            auto& mt = b->*tmt;
+            std::vector<Edge> merge_edges;
+            FlatEdgeMap ours(edges, true);
             for (int i = 0; i < in_size; ++i)
             {
-              int nbr_gid = srp.in_link().target(i).gid;
-              if (nbr_gid == srp.gid())
-              {
-                  local_pos = i;
-                  trees[i].swap(b->*tmt);
-                  LOG_SEV(debug) << "  swapped in tree of size: " << trees[i].size();
-              } else
-              {
-                  srp.dequeue(nbr_gid, trees[i]);
-                  srp.dequeue(nbr_gid, out_edges);
-                  LOG_SEV(debug) << "  received tree of size: " << trees[i].size();
-              }
+                int nbr_gid = srp.in_link().target(i).gid;
+                if (nbr_gid == srp.gid())
+                    continue;
+
+                dlog::prof << "dequeue";
+                FlatEdges out_edges;
+                srp.dequeue(nbr_gid, out_edges);
+                dlog::prof >> "dequeue";
+
+                dlog::prof << "compute edges";
+                match_edges(ours, out_edges, mt, merge_edges);
+                dlog::prof >> "compute edges";
+
+                dlog::prof << "load trees";
+                reeber::Serialization<TripletMergeTree>::load(srp.incoming(nbr_gid), mt);
+                srp.incoming(nbr_gid).wipe();       // don't hold on to the buffer until the end of the round
+                LOG_SEV(debug) << "  received tree from " << nbr_gid << ", merged size: " << mt.size();
+                dlog::prof >> "load trees";
             }
-            LOG_SEV(debug) << "  trees and bounds received";
-            dlog::prof >> "dequeue";
 
-            dlog::prof << "compute edges";
-            std::vector<Edge> merge_edges, discard;
-            auto& mt = trees[local_pos];
-            for (auto& kv : edges)
-            {
-                // Determine if (u,v) is an edge to this neighbor; if so, find
-                // u - s - v, and determine whether s is local or remote (i.e.,
-                // if we are mering (u,s) or (s,v))
-
-                auto& uv = kv.first;
-                Vertex u, v;
-                std::tie(u,v) = uv;
-                auto vu = std::make_tuple(v,u);
-                if (out_edges.find(vu) != out_edges.end())
-                {
-                    map_erase(out_edges, vu);
-                    Vertex s = std::get<1>(kv.second);
-
-                    if (mt.contains(s))
-                        merge_edges.emplace_back(s,v);
-                    else
-                        merge_edges.emplace_back(u,s);
-                    discard.push_back(uv);
-                }
-            }
-            for (Edge e : discard)
-                map_erase(edges, e);
-            edges.insert(out_edges.begin(), out_edges.end());
-            dlog::prof >> "compute edges";
+            reeber::merge(mt, merge_edges);
 
-            trees[0].swap(b->*tmt);
-            reeber::merge(b->*tmt, trees[1], merge_edges);
+            LOG_SEV(debug) << "  trees merged: " << mt.size();
 
-            trees.clear();
-            LOG_SEV(debug) << "  trees merged: " << (b->*tmt).size();
+            edges.clear();
+            ours.copy_to(edges, true);
         }
 
+        FlatEdgeMap flat_edges(edges);
+
         dlog::prof << "compute edge_vertices";
-        std::unordered_set<Vertex> edge_vertices;
-        for (auto& kv : edges)
+        std::vector<Vertex> edge_vertices;
+        edge_vertices.reserve(2*flat_edges.size());
+        for (auto& e : flat_edges)
         {
-            Vertex u_ = std::get<0>(kv.first);
-            edge_vertices.insert(u_);
-            Vertex s = std::get<1>(kv.second);
-            edge_vertices.insert(s);
+            edge_vertices.push_back(e.u);
+            edge_vertices.push_back(e.s);
             // s might not be in our "global" domain, but that's Ok; we ignore that optimization
         }
+        std::sort(edge_vertices.begin(), edge_vertices.end());
+        edge_vertices.erase(std::unique(edge_vertices.begin(), edge_vertices.end()), edge_vertices.end());
+        auto edge_vertex = [&edge_vertices](Vertex u) { return std::binary_search(edge_vertices.begin(), edge_vertices.end(), u); };
         dlog::prof >> "compute edge_vertices";
 
         auto gid_gen    = gid_generator(b);
@@ -134,8 +279,8 @@ struct reeber::detail::MergeSparsify
         auto local_test = [&gid_gen,gid](Vertex u)  { return gid_gen(u) == gid; };
 
         if (in_size)
-            reeber::sparsify(b->*tmt, [&edge_vertices, &local_test](Vertex u)
-                               { return local_test(u) || edge_vertices.find(u) != edge_vertices.end(); });
+            reeber::sparsify(b->*tmt, [&edge_vertex, &local_test](Vertex u)
+                               { return local_test(u) || edge_vertex(u); });
 
         // send (without the vertices) to the neighbors
         int out_size = srp.out_link().size();
@@ -148,17 +293,23 @@ struct reeber::detail::MergeSparsify
         }
 
         TripletMergeTree mt_out((b->*tmt).negate());
-        reeber::sparsify(mt_out, b->*tmt, [&edge_vertices](Vertex u) { return edge_vertices.find(u) != edge_vertices.end(); });
+        reeber::sparsify(mt_out, b->*tmt, edge_vertex);
+        if (epsilon > 0)
+        {
+            size_t cancelled = reeber::simplify(mt_out, epsilon, edge_vertex);
+            LOG_SEV(debug) << "[" << b->gid << "] " << "Cancelled " << cancelled << " nodes, sending " << mt_out.size();
+        }
 
+        // serialize once, and copy the bytes to every partner (there are k - 1 of them)
         dlog::prof << "enqueue";
+        diy::MemoryBuffer out;
+        diy::save(out, flat_edges.records());
+        save_no_vertices(out, mt_out);
         for (int i = 0; i < out_size; ++i)
         {
           diy::BlockID nbr_bid = srp.out_link().target(i);
           if (nbr_bid.gid != srp.gid())
-          {
-            srp.enqueue(nbr_bid, mt_out, &save_no_vertices);
-            srp.enqueue(nbr_bid, edges);
-          }
+            srp.outgoing(nbr_bid).save_binary(&out.buffer[0], out.buffer.size());
         }
         dlog::prof >> "enqueue";
     }
@@ -170,34 +321,44 @@ struct reeber::detail::MergeSparsify
 };
 
 
-// "Resolve" outgoing edges stored as keys in edge_maps[target_gid]. For each
-// one, find its canonical representation (representatives in both blocks) as
-// well as the value and vertex through which the connection is made
-template<class Block, class Vertex, class Value>
+// First half of resolve_edges: replace the local endpoint of every outgoing
+// edge with its representative, and send each neighbor the relabeling of the
+// vertices it's connected to
+template<class Block, class Vertex, class Value, class Aggregate>
 void
-reeber::
-resolve_edges(diy::Master&                            master,
-              TripletMergeTree<Vertex,Value> Block::* tmt_,
-              EdgeMaps<Vertex,Value> Block::*         edge_maps_)
+reeber::detail::
+send_relabels(diy::Master&                                      master,
+              TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+              EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+              bool                                              edge_stats)
 {
     using ValueVertex   = std::tuple<Value, Vertex>;
-    using RelabelMap    = std::unordered_map<Vertex, ValueVertex>;
-    using RelabelMaps   = std::unordered_map<int, RelabelMap>;
+    using Relabels      = std::vector<Relabel<Vertex,Value>>;
     using EdgeMap       = reeber::EdgeMap<Vertex,Value>;
 
     master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
     {
         auto&   tmt         = b->*tmt_;
         auto&   edge_maps   = b->*edge_maps_;
+        auto*   l           = cp.link();
 
         size_t edge_count = 0;
 
-        RelabelMaps relabel;
+        // one sorted array of relabels per link neighbor, in the order of the link
+        std::vector<Relabels> relabel(l->size());
         for (auto& em_kv : edge_maps)
         {
             int   v_gid    = em_kv.first;
             auto& edge_map = em_kv.second;
 
+            Relabels* v_relabel = nullptr;
+            for (int i = 0; i < l->size(); ++i)
+                if (l->target(i).gid == v_gid)
+                {
+                    v_relabel = &relabel[i];
+                    break;
+                }
+
             EdgeMap new_edge_map;
             for (auto& kv : edge_map)
             {
@@ -212,7 +373,8 @@ resolve_edges(diy::Master&                            master,
 
                 ++edge_count;
 
-                relabel[v_gid][u] = ValueVertex{ f_u, u_ };
+                if (v_relabel)
+                    v_relabel->push_back(Relabel<Vertex,Value> { u, f_u, u_ });
                 auto it = new_edge_map.find(std::tuple<Vertex, Vertex>{ u_, v });
                 if (it == new_edge_map.end())
                     new_edge_map.emplace(std::make_tuple(u_, v), uval);
@@ -222,70 +384,125 @@ resolve_edges(diy::Master&                            master,
             edge_map.swap(new_edge_map);
         }
 
-        auto* l = cp.link();
         for (int i = 0; i < l->size(); i++)
         {
-            int target_gid = l->target(i).gid;
-            cp.enqueue(l->target(i), relabel[target_gid]);
+            // u may have edges to several vertices of the neighbor; its relabels are all the same
+            std::sort(relabel[i].begin(), relabel[i].end());
+            relabel[i].erase(std::unique(relabel[i].begin(), relabel[i].end(),
+                                         [](const Relabel<Vertex,Value>& x, const Relabel<Vertex,Value>& y) { return x.u == y.u; }),
+                             relabel[i].end());
+            cp.enqueue(l->target(i), relabel[i]);
         }
 
-        cp.collectives()->clear();
-        cp.all_reduce(edge_count, std::plus<size_t>());
+        if (edge_stats)
+        {
+            cp.collectives()->clear();
+            cp.all_reduce(edge_count, std::plus<size_t>());
+        }
     });
+}
 
-    master.exchange();
+// Second half of resolve_edges (after the exchange): find the remote
+// representatives of the outgoing edges and move them into edge_maps[gid];
+// returns the number of the resolved edges
+template<class Block, class Vertex, class Value, class Aggregate>
+size_t
+reeber::detail::
+receive_relabels(Block*                                            b,
+                 const diy::Master::ProxyWithLink&                 cp,
+                 TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                 EdgeMaps<Vertex,Value> Block::*                   edge_maps_)
+{
+    using ValueVertex   = std::tuple<Value, Vertex>;
+    using Relabels      = std::vector<Relabel<Vertex,Value>>;
+    using EdgeMap       = reeber::EdgeMap<Vertex,Value>;
 
-    master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
+    auto&   tmt         = b->*tmt_;
+    auto&   edge_maps   = b->*edge_maps_;
+    auto&   edges       = edge_maps[cp.gid()];
+
+    size_t  new_edge_count = 0;
+    auto* l = cp.link();
+    for (int i = 0; i < l->size(); i++)
     {
-        auto&   tmt         = b->*tmt_;
-        auto&   edge_maps   = b->*edge_maps_;
-        auto&   edges       = edge_maps[cp.gid()];
+        int target_gid = l->target(i).gid;
 
-        size_t edge_count = cp.get<size_t>();
-        cp.scratch(edge_count);
+        Relabels relabel;
+        cp.dequeue(target_gid, relabel);
 
-        size_t  new_edge_count = 0;
-        auto* l = cp.link();
-        for (int i = 0; i < l->size(); i++)
+        // merge-join the edges, keyed by the remote endpoint, with the relabels, sorted by vertex
+        FlatEdgeMap<Vertex,Value> incident(edge_maps[target_gid], true);
+        auto rt = relabel.begin();
+
+        EdgeMap new_edges;
+        for (auto& e : incident)
         {
-            int target_gid = l->target(i).gid;
+            Vertex u = e.s, u_ = e.v, v = e.u, v_;
+            Value  f_u = e.value, f_v;
+
+            while (rt != relabel.end() && rt->u < v) ++rt;
+            if (rt == relabel.end() || rt->u != v)
+                throw std::runtime_error("receive_relabels: no relabel received for the remote end of an edge");
+            f_v = rt->value;
+            v_  = rt->u_;
 
-            RelabelMap relabel;
-            cp.dequeue(target_gid, relabel);
+            ValueVertex uval { f_u, u },
+                        vval { f_v, v };
 
-            EdgeMap new_edges;
-            for (auto& kv : edge_maps[target_gid])
+            // ensure u < v
+            if (tmt.cmp(vval, uval))
+                std::swap(uval, vval);
+
+            auto u_v_ = std::make_tuple(u_,v_);
+            auto it = new_edges.find(u_v_);
+            if (it != new_edges.end())
             {
-                Vertex u, u_, v, v_;
-                Value  f_u, f_v;
+                if (tmt.cmp(vval, it->second))
+                    it->second = vval;
+            } else
+                new_edges[u_v_] = vval;
+        }
+        edge_maps[target_gid].clear();
+        edges.insert(new_edges.begin(), new_edges.end());
+        new_edge_count += new_edges.size();
+    }
 
-                std::tie(u_, v)   = kv.first;
-                std::tie(f_u, u)  = kv.second;
-                std::tie(f_v, v_) = relabel[v];
+    return new_edge_count;
+}
 
-                ValueVertex uval { f_u, u },
-                            vval { f_v, v };
+// "Resolve" outgoing edges stored as keys in edge_maps[target_gid]. For each
+// one, find its canonical representation (representatives in both blocks) as
+// well as the value and vertex through which the connection is made.
+// Reporting the total edge counts (edge_stats) costs a second exchange.
+template<class Block, class Vertex, class Value, class Aggregate>
+void
+reeber::
+resolve_edges(diy::Master&                                      master,
+              TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+              EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+              bool                                              edge_stats)
+{
+    detail::send_relabels(master, tmt_, edge_maps_, edge_stats);
 
-                // ensure u < v
-                if (tmt.cmp(vval, uval))
-                    std::swap(uval, vval);
+    master.exchange();
 
-                auto u_v_ = std::make_tuple(u_,v_);
-                auto it = new_edges.find(u_v_);
-                if (it != new_edges.end())
-                {
-                    if (tmt.cmp(vval, it->second))
-                        it->second = vval;
-                } else
-                    new_edges[u_v_] = vval;
-            }
-            edge_maps[target_gid].clear();
-            edges.insert(new_edges.begin(), new_edges.end());
-            new_edge_count += new_edges.size();
+    master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
+    {
+        if (edge_stats)
+        {
+            size_t edge_count = cp.get<size_t>();
+            cp.scratch(edge_count);
         }
 
-        cp.all_reduce(new_edge_count, std::plus<size_t>());
+        size_t new_edge_count = detail::receive_relabels(b, cp, tmt_, edge_maps_);
+
+        if (edge_stats)
+            cp.all_reduce(new_edge_count, std::plus<size_t>());
     });
+
+    if (!edge_stats)
+        return;
+
     master.exchange();      // process collectives: add up the edges
     for (unsigned i = 0; i < master.size(); ++i)
     {
@@ -299,3 +516,162 @@ resolve_edges(diy::Master&                            master,
         master.proxy(i).collectives()->clear();
     }
 }
+
+template<class Block, class Vertex, class Value, class Aggregate>
+void
+reeber::detail::
+resolve_and_prune(diy::Master&                                      master,
+                  TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                  EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                  bool                                              lean)
+{
+    auto prune = [&](Block* b)
+    {
+        remove_degree_two(b->*tmt_, b->*edge_maps_);
+        LOG_SEV(debug) << "[" << b->gid << "] " << "Tree size after pruning degree-2: " << (b->*tmt_).size();
+    };
+
+    if (!lean)
+    {
+        resolve_edges(master, tmt_, edge_maps_);
+        master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp) { prune(b); });
+        return;
+    }
+
+    // lean: a single exchange before the reduction, no edge statistics;
+    // the relabels are applied in the same pass that prunes the trees
+    send_relabels(master, tmt_, edge_maps_, false);
+    master.exchange();
+    master.foreach([&](Block* b, const diy::Master::ProxyWithLink& cp)
+    {
+        receive_relabels(b, cp, tmt_, edge_maps_);
+        prune(b);
+    });
+}
+
+// The blocks of the process are loaded into one tree, without serialization,
+// and the edges among them are matched and merged, as in a round of
+// MergeSparsify. The resulting tree goes through the swap-reduce across the
+// processes as a single block (gid = rank), and at the end every block gets
+// the part of it that its vertices need. The blocks must all be in memory.
+template<class Block, class Vertex, class Value, class Aggregate, class GidGenerator>
+void
+reeber::detail::
+merge_trees_two_level(diy::Master&                                      master,
+                      diy::Assigner&                                    assigner,
+                      TripletMergeTree<Vertex,Value,Aggregate> Block::* tmt_,
+                      EdgeMaps<Vertex,Value> Block::*                   edge_maps_,
+                      const GidGenerator&                               gid_generator,
+                      int                                               k,
+                      Value                                             epsilon)
+{
+    using NodeBlock     = detail::NodeBlock<Vertex,Value,Aggregate>;
+    using Partners      = diy::RegularSwapPartners;
+
+    auto&   comm    = master.communicator();
+    int     rank    = comm.rank();
+    int     nranks  = comm.size();
+
+    if (master.size() == 0)
+        throw std::runtime_error("two-level merge needs at least one block on every process");
+
+    // the blocks are used outside of foreach, which would load the ones out of core
+    auto block = [&master](unsigned i)
+    {
+        Block* b = master.block<Block>(i);
+        if (!b)
+            throw std::runtime_error("two-level merge needs all the blocks in memory, but block " + std::to_string(master.gid(i)) +
+                                     " isn't (raise the limit of blocks in memory)");
+        return b;
+    };
+
+    dlog::prof << "premerge";
+    NodeBlock*  node = new NodeBlock(rank, (block(0)->*tmt_).negate());
+    auto&       mt   = node->tmt;
+    std::vector<Edge<Vertex>>   merge_edges;
+    FlatEdgeMap<Vertex,Value>   edges;
+    for (unsigned i = 0; i < master.size(); ++i)
+    {
+        Block* b = block(i);
+        auto&  b_edges = (b->*edge_maps_)[master.gid(i)];
+        match_edges(edges, FlatEdgeMap<Vertex,Value>(b_edges).records(), mt, merge_edges);
+        b_edges.clear();
+        splice(mt, b->*tmt_);
+    }
+    reeber::merge(mt, merge_edges);
+    edges.copy_to(node->edge_maps[rank], true);
+    LOG_SEV(debug) << "[" << rank << "] " << "Merged " << master.size() << " blocks into a tree of size " << mt.size();
+    dlog::prof >> "premerge";
+
+    // vertices belong to the process of their block
+    auto node_gid_generator = [&](NodeBlock*)
+    {
+        auto gid_gen = gid_generator(block(0));
+        return [gid_gen,&assigner](Vertex u) { return assigner.rank(gid_gen(u)); };
+    };
+    using NodeGidGenerator = decltype(node_gid_generator);
+
+    diy::Master                                 node_master(comm, master.threads(), -1, 0, &NodeBlock::destroy);
+    diy::ContiguousAssigner                     node_assigner(nranks, nranks);
+    diy::RegularDecomposer<diy::DiscreteBounds> decomposer(1, diy::interval(0, nranks - 1), nranks);
+    node_master.add(rank, node, new diy::Link);
+    diy::reduce(node_master, node_assigner, Partners(decomposer, k, true),
+                MergeSparsify<NodeBlock, Vertex, Value, Aggregate, Partners, NodeGidGenerator>(&NodeBlock::tmt, &NodeBlock::edge_maps, node_gid_generator, epsilon));
+
+    dlog::prof << "extract local trees";
+    for (unsigned i = 0; i < master.size(); ++i)
+    {
+        Block*  b       = block(i);
+        auto    gid_gen = gid_generator(b);
+        int     gid     = master.gid(i);
+        extract_local(b->*tmt_, node->tmt, [&gid_gen,gid](Vertex u) { return gid_gen(u) == gid; });
+        LOG_SEV(debug) << "[" << b->gid << "] " << "Final tree size: " << (b->*tmt_).size();
+    }
+    dlog::prof >> "extract local trees";
+}
+
+template<class Vertex, class Value, class Aggregate, class Local>
+void
+reeber::detail::
+extract_local(TripletMergeTree<Vertex,Value,Aggregate>& out, TripletMergeTree<Vertex,Value,Aggregate>& in, const Local& local)
+{
+    using Neighbor          = typename TripletMergeTree<Vertex,Value,Aggregate>::Neighbor;
+    using VerticesVector    = typename TripletMergeTree<Vertex,Value,Aggregate>::VerticesVector;
+    using VerticesRun       = typename TripletMergeTree<Vertex,Value,Aggregate>::VerticesRun;
+
+    TripletMergeTree<Vertex,Value,Aggregate>(in.negate()).swap(out);
+
+    KeepSet<Vertex> keep = sparsify_keep(in, local);
+
+    // removed degree-2 vertices still sit in the map, skip them
+    std::vector<Neighbor> kept;
+    size_t n_vertices = 0;
+    for (auto& x : static_cast<const TripletMergeTree<Vertex,Value,Aggregate>&>(in).nodes())
+        if (x.first == x.second->vertex && keep.contains(x.first))
+        {
+            kept.push_back(x.second);
+            if (local(x.first))
+                n_vertices += x.second->vertices.size();
+        }
+
+    VerticesVector block;
+    block.reserve(n_vertices);
+    for (Neighbor u : kept)
+    {
+        Neighbor ou = out.add(u->vertex, u->value);
+        ou->aggregate() = u->aggregate();
+        if (!local(u->vertex))
+            continue;
+        block.insert(block.end(), u->vertices.begin(), u->vertices.end());
+        ou->vertices = VerticesRun(block.data() + block.size() - u->vertices.size(), block.data() + block.size());
+    }
+    out.store_vertices(std::move(block));
+    fold_aggregates(in, [&keep](Neighbor u) { return keep.contains(u->vertex); }, [&out](Neighbor u) { return out[u->vertex]; });
+
+    for (Neighbor u : kept)
+    {
+        Neighbor s, v;
+        std::tie(s,v) = u->parent();
+        out.link(out[u->vertex], out[s->vertex], out[v->vertex]);
+    }
+}
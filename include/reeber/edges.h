@@ -1,5 +1,9 @@
 #pragma once
 
+#include <vector>
+#include <tuple>
+#include <algorithm>
+
 #include "parallel-tbb.h"
 
 namespace reeber
@@ -37,4 +41,113 @@ using EdgeMap = map<detail::Edge<Vertex>, std::tuple<Value, Vertex>, detail::edg
 template<class Vertex, class Value>
 using EdgeMaps = map<int, EdgeMap<Vertex,Value>>;
 
+namespace detail
+{
+    // edge (u,v) and the (value, vertex) through which it connects; trivially
+    // copyable, so a vector of them is serialized in one piece
+    template<class Vertex, class Value>
+    struct FlatEdge
+    {
+        Vertex      u, v;
+        Value       value;
+        Vertex      s;
+
+        bool        operator<(const FlatEdge& other) const      { return std::tie(u,v) < std::tie(other.u,other.v); }
+        bool        same_edge(const FlatEdge& other) const      { return u == other.u && v == other.v; }
+    };
+}
+
+/**
+ * The contents of an EdgeMap as a contiguous array sorted by (u,v). Lookups
+ * are binary searches, and matching against another sorted array is a
+ * merge-join, rather than a hash probe per edge.
+ */
+template<class Vertex, class Value>
+class FlatEdgeMap
+{
+    public:
+        using Record            = detail::FlatEdge<Vertex,Value>;
+        using Records           = std::vector<Record>;
+        using const_iterator    = typename Records::const_iterator;
+
+                        FlatEdgeMap()                                   =default;
+
+        // with swap_endpoints, edge (u,v) is stored as (v,u), i.e., keyed the way the other side of it knows it
+        template<class Map>
+                        FlatEdgeMap(const Map& m, bool swap_endpoints = false)
+        {
+            records_.reserve(m.size());
+            for (auto& kv : m)
+            {
+                Vertex u, v, s; Value value;
+                std::tie(u,v)     = kv.first;
+                std::tie(value,s) = kv.second;
+                if (swap_endpoints)
+                    std::swap(u,v);
+                records_.push_back(Record { u, v, value, s });
+            }
+            std::sort(records_.begin(), records_.end());
+        }
+
+        template<class Map>
+        void            copy_to(Map& m, bool swap_endpoints = false) const
+        {
+            for (auto& e : records_)
+                m.emplace(swap_endpoints ? std::make_tuple(e.v, e.u) : std::make_tuple(e.u, e.v), std::make_tuple(e.value, e.s));
+        }
+
+        const_iterator  find(const Vertex& u, const Vertex& v) const
+        {
+            Record x { u, v, Value(), Vertex() };
+            auto it = std::lower_bound(records_.begin(), records_.end(), x);
+            return (it != records_.end() && it->same_edge(x)) ? it : records_.end();
+        }
+
+        // Merge-join with other (sorted, distinct edges): matched(ours, theirs)
+        // is called on the common edges, which are then dropped from here;
+        // unmatched(theirs) on the rest of other.
+        template<class Matched, class Unmatched>
+        void            join(const Records& other, const Matched& matched, const Unmatched& unmatched)
+        {
+            auto out = records_.begin();
+            auto it  = records_.begin();
+            auto jt  = other.begin();
+            while (it != records_.end() || jt != other.end())
+            {
+                if (jt == other.end() || (it != records_.end() && *it < *jt))
+                    *out++ = *it++;
+                else if (it == records_.end() || *jt < *it)
+                    unmatched(*jt++);
+                else
+                {
+                    matched(*it, *jt);
+                    ++it; ++jt;
+                }
+            }
+            records_.erase(out, records_.end());
+        }
+
+        // adds edges not present here yet; xs need not be sorted
+        void            insert(Records xs)
+        {
+            std::sort(xs.begin(), xs.end());
+            size_t n = records_.size();
+            records_.insert(records_.end(), xs.begin(), xs.end());
+            std::inplace_merge(records_.begin(), records_.begin() + n, records_.end());
+        }
+
+        const_iterator  begin() const                                   { return records_.begin(); }
+        const_iterator  end() const                                     { return records_.end(); }
+        size_t          size() const                                    { return records_.size(); }
+        bool            empty() const                                   { return records_.empty(); }
+        void            clear()                                         { records_.clear(); }
+        void            swap(FlatEdgeMap& other)                        { records_.swap(other.records_); }
+
+        const Records&  records() const                                 { return records_; }
+        Records&        records()                                       { return records_; }
+
+    private:
+        Records         records_;
+};
+
 }
@@ -0,0 +1,171 @@
+#ifndef REEBER_FLAT_TRIPLET_MERGE_TREE_H
+#define REEBER_FLAT_TRIPLET_MERGE_TREE_H
+
+#include <vector>
+#include <tuple>
+#include <memory>
+#include <cstdint>
+
+#include "parallel-tbb.h"
+#include "triplet-merge-tree.h"
+
+#include "format.h"
+
+namespace reeber
+{
+
+/**
+ * Index-addressed variant of TripletMergeTree for topologies whose vertices
+ * map onto a dense range [0, n) (Box, MaskedBox). Nodes live in a single
+ * array; the (through, to) parent of a node is a pair of 32-bit indices
+ * packed into one word, so there are no per-node allocations and no hash
+ * lookups during construction.
+ */
+template<class Vertex_, class Value_>
+struct FlatTripletMergeTreeNode
+{
+    typedef                     Vertex_                         Vertex;
+    typedef                     Value_                          Value;
+
+    bool                        operator< (const FlatTripletMergeTreeNode& other) const     { return std::tie(value, vertex) <  std::tie(other.value, other.vertex); }
+    bool                        operator> (const FlatTripletMergeTreeNode& other) const     { return std::tie(value, vertex) >  std::tie(other.value, other.vertex); }
+
+    bool                        operator==(const FlatTripletMergeTreeNode& other) const     { return std::tie(vertex, value) == std::tie(other.vertex, other.value); }
+    bool                        operator!=(const FlatTripletMergeTreeNode& other) const     { return !(*this == other); }
+
+    Vertex                      vertex;
+    Value                       value;
+
+    friend std::ostream&        operator<<(std::ostream& os, const FlatTripletMergeTreeNode& n) { os << "Node(vertex = " << n.vertex  << ", value = " << n.value << ")"; return os; }
+};
+
+template<class Vertex_, class Value_>
+class FlatTripletMergeTree;
+
+namespace detail
+{
+    // vertices are plain vertices or (value, vertex) pairs, as in the TripletMergeTree version
+    template<class Vertex, class Value, class Topology, class Function, class Index, class Vertices>
+    void compute_merge_tree2(FlatTripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f, const Index& index, const Vertices& vertices);
+}
+
+template<class Vertex_, class Value_>
+class FlatTripletMergeTree
+{
+    public:
+        typedef     Vertex_                                 Vertex;
+        typedef     Value_                                  Value;
+
+        typedef     FlatTripletMergeTreeNode<Vertex,Value>  Node;
+        typedef     const Node*                             Neighbor;       // what traverse_persistence passes to the functor
+
+        typedef     std::uint32_t                           Index;
+        typedef     std::uint64_t                           Parent;         // (through, to) packed into one word
+
+        static constexpr Index  absent = Index(-1);
+
+    public:
+                    FlatTripletMergeTree(bool negate = false):
+                        negate_(negate)                 {}
+
+                    FlatTripletMergeTree(const FlatTripletMergeTree&)   =delete;
+        FlatTripletMergeTree&
+                    operator=(const FlatTripletMergeTree&)              =delete;
+                    FlatTripletMergeTree(FlatTripletMergeTree&&)        =default;
+        FlatTripletMergeTree&
+                    operator=(FlatTripletMergeTree&&)                   =default;
+
+        // allocates n empty slots; previous contents are discarded
+        void        reset(size_t n);
+
+        void        add(Index u, const Vertex& x, Value v)  { nodes_[u].vertex = x; nodes_[u].value = v; link(u, u, u); }
+
+        const Node& node(Index u) const                 { return nodes_[u]; }
+        bool        contains(Index u) const             { return u < capacity() && std::get<0>(parent(u)) != absent; }
+
+        std::tuple<Index, Index>
+                    parent(Index u) const               { Parent p = parents_[u]; return std::make_tuple(through(p), to(p)); }
+        static Parent
+                    make_parent(Index s, Index v)       { return (Parent(s) << 32) | Parent(v); }
+        static Index
+                    through(Parent p)                   { return Index(p >> 32); }
+        static Index
+                    to(Parent p)                        { return Index(p); }
+
+        void        link(Index u, Index s, Index v)     { parents_[u] = make_parent(s, v); }
+        bool        cas_link(Index u, Index os, Index ov, Index s, Index v)
+                                                        { Parent op = make_parent(os,ov); return compare_exchange(parents_[u], op, make_parent(s,v)); }
+
+        std::tuple<Index,Index>
+                    repair(Index u);
+        void        merge(Index u, Index v);
+        void        merge(Index u, Index s, Index v);
+        Index       representative(Index u, Index a) const;
+
+        size_t      size() const                        { return size_; }
+        size_t      capacity() const                    { return nodes_.size(); }
+
+        void        swap(FlatTripletMergeTree& other)   { std::swap(negate_, other.negate_); nodes_.swap(other.nodes_); parents_.swap(other.parents_); std::swap(size_, other.size_); }
+
+        bool        negate() const                      { return negate_; }
+        void        set_negate(bool negate)             { negate_ = negate; }
+
+        template<class T>
+        bool        cmp(const T& x, const T& y) const   { return negate_ ? x > y : x < y; }
+        bool        cmp(Index u, Index v) const         { return cmp(nodes_[u], nodes_[v]); }
+
+    private:
+        template<class Vert, class Val, class T, class F, class I, class Vs>
+        friend void
+        detail::compute_merge_tree2(FlatTripletMergeTree<Vert, Val>& mt, const T& t, const F& f, const I& index, const Vs& vertices);
+
+        template<class Vert, class Val, class E, class I>
+        friend void
+        merge(FlatTripletMergeTree<Vert, Val>& mt1, FlatTripletMergeTree<Vert, Val>& mt2, const E& edges, const I& index, bool ignore_missing_edges);
+
+    private:
+        bool                                    negate_;
+        std::vector<Node>                       nodes_;
+        std::unique_ptr<atomic<Parent>[]>       parents_;
+        size_t                                  size_ = 0;
+};
+
+/**
+ * Index is a functor that maps vertices of the topology onto [0, index.size());
+ * by default, the topology's own local_index() is used.
+ */
+template<class Vertex, class Value, class Topology, class Function, class Index>
+void compute_merge_tree2(FlatTripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f, const Index& index);
+
+template<class Vertex, class Value, class Topology, class Function>
+void compute_merge_tree2(FlatTripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f)
+{
+    compute_merge_tree2(mt, topology, f, topology.local_index());
+}
+
+// only the vertices that pass the threshold become nodes (see the TripletMergeTree version)
+template<class Vertex, class Value, class Topology, class Function, class Index>
+void compute_merge_tree2(FlatTripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f, const Index& index, typename FlatTripletMergeTree<Vertex, Value>::Value threshold);
+
+template<class Vertex, class Value>
+void repair(FlatTripletMergeTree<Vertex, Value>& mt);
+
+// mt1 and mt2 must share the index space (e.g., two halves of the same Box)
+template<class Vertex, class Value, class Edges, class Index>
+void merge(FlatTripletMergeTree<Vertex, Value>& mt1, FlatTripletMergeTree<Vertex, Value>& mt2, const Edges& edges, const Index& index, bool ignore_missing_edges = false);
+
+template<class Vertex, class Value, class Functor>
+void traverse_persistence(const FlatTripletMergeTree<Vertex, Value>& mt, const Functor& f);
+
+template<class Vertex, class Value, class Functor>
+void traverse_persistence_parallel(const FlatTripletMergeTree<Vertex, Value>& mt, const Functor& f);
+
+// sparsified tree is usually small, so it goes into a regular TripletMergeTree
+template<class Vertex, class Value, class Special>
+void sparsify(TripletMergeTree<Vertex, Value>& out, const FlatTripletMergeTree<Vertex, Value>& in, const Special& special);
+
+}
+
+#include "flat-triplet-merge-tree.hpp"
+
+#endif
@@ -0,0 +1,276 @@
+#include <cassert>
+
+#include <dlog/log.h>
+#include <dlog/stats.h>
+
+template<class Vertex, class Value>
+void
+reeber::FlatTripletMergeTree<Vertex, Value>::
+reset(size_t n)
+{
+    assert(n < size_t(absent));
+
+    std::vector<Node>(n).swap(nodes_);
+    parents_.reset(new atomic<Parent>[n]);
+    for_each(0, n, [&](size_t u) { parents_[u] = make_parent(absent, absent); });
+    size_ = 0;
+}
+
+template<class Vertex, class Value>
+typename reeber::FlatTripletMergeTree<Vertex, Value>::Index
+reeber::FlatTripletMergeTree<Vertex, Value>::
+representative(Index u, Index a) const
+{
+    Index s, v;
+    std::tie(s, v) = parent(u);
+    while (!cmp(a, s) && s != v)
+    {
+        u = v;
+        std::tie(s, v) = parent(u);
+    }
+    return u;
+}
+
+template<class Vertex, class Value>
+std::tuple<typename reeber::FlatTripletMergeTree<Vertex, Value>::Index, typename reeber::FlatTripletMergeTree<Vertex, Value>::Index>
+reeber::FlatTripletMergeTree<Vertex, Value>::
+repair(Index u)
+{
+    Index s, v, ov;
+    do
+    {
+        std::tie(s, ov) = parent(u);
+        v = representative(u, s);
+        if (u == v) return std::make_tuple(s,v);
+    } while (!cas_link(u,s,ov,s,v));
+
+    return std::make_tuple(s,v);
+}
+
+template<class Vertex, class Value>
+void
+reeber::FlatTripletMergeTree<Vertex, Value>::
+merge(Index u, Index s, Index v)
+{
+    while(true)
+    {
+        u = representative(u, s);
+        v = representative(v, s);
+        if (u == v)
+            break;
+
+        Index s_u, u_;
+        Index s_v, v_;
+        std::tie(s_u, u_) = parent(u);
+        std::tie(s_v, v_) = parent(v);
+
+        // check that s_u and s_v haven't changed since running representative
+        if (s_u != u_ && !cmp(s, s_u))
+            continue;
+        if (s_v != v_ && !cmp(s, s_v))
+            continue;
+
+        if (cmp(v, u))
+        {
+            std::swap(u, v);
+            std::swap(s_u, s_v);
+            std::swap(u_, v_);
+        }
+
+        bool success = cas_link(v, s_v, v_, s, u);
+        if (success)
+        {
+            if (v == v_)
+                break;
+
+            s = s_v;
+            v = v_;
+        } // else: rinse and repeat
+    }
+}
+
+template<class Vertex, class Value>
+void
+reeber::FlatTripletMergeTree<Vertex, Value>::
+merge(Index u, Index v)
+{
+    if (cmp(u, v))
+        merge(v, v, u);
+    else
+        merge(u, u, v);
+}
+
+template<class Vertex, class Value, class Topology, class Function, class Index, class Vertices>
+void
+reeber::detail::compute_merge_tree2(FlatTripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f, const Index& index, const Vertices& vertices)
+{
+    using VV = VertexValueOf<Vertex>;
+
+    mt.reset(index.size());
+    mt.size_ = vertices.size();
+
+    for_each(0, vertices.size(), [&](size_t i) { const Vertex& a = VV::vertex(vertices[i]); mt.add(index(a), a, VV::value(vertices[i], f)); });
+
+    for_each(0, vertices.size(), [&](size_t i)
+    {
+        Vertex a = VV::vertex(vertices[i]);
+        auto   u = index(a);
+        for (const Vertex& b : topology.link(a))
+        {
+            if (b < a) continue;
+            auto v = index(b);
+            if (!mt.contains(v)) continue;      // cut off by the threshold
+            mt.merge(u, v);
+        }
+    });
+
+    repair(mt);
+}
+
+template<class Vertex, class Value, class Topology, class Function, class Index>
+void
+reeber::compute_merge_tree2(FlatTripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f, const Index& index)
+{
+    dlog::prof << "compute-merge-tree2";
+
+    auto vertices_ = topology.vertices();
+
+    vector<Vertex> vertices(std::begin(vertices_), std::end(vertices_));
+
+    detail::compute_merge_tree2(mt, topology, f, index, vertices);
+
+    dlog::prof >> "compute-merge-tree2";
+}
+
+template<class Vertex, class Value, class Topology, class Function, class Index>
+void
+reeber::compute_merge_tree2(FlatTripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f, const Index& index, typename FlatTripletMergeTree<Vertex, Value>::Value threshold)
+{
+    dlog::prof << "compute-merge-tree2";
+
+    vector<std::pair<Value, Vertex>> vertices;
+    for (Vertex v : topology.vertices())
+    {
+        Value val = f(v);
+        if (!mt.cmp(threshold, val))
+            vertices.push_back(std::make_pair(val, v));
+    }
+
+    detail::compute_merge_tree2(mt, topology, f, index, vertices);
+
+    dlog::prof >> "compute-merge-tree2";
+}
+
+template<class Vertex, class Value>
+void
+reeber::repair(FlatTripletMergeTree<Vertex, Value>& mt)
+{
+    for_each(0, mt.capacity(), [&](size_t u) { if (mt.contains(u)) mt.repair(u); });
+}
+
+template<class Vertex, class Value, class Edges, class Index>
+void
+reeber::merge(FlatTripletMergeTree<Vertex, Value>& mt1, FlatTripletMergeTree<Vertex, Value>& mt2, const Edges& edges, const Index& index,
+              bool ignore_missing_edges)
+{
+    dlog::prof << "merge";
+
+    using Parent = typename FlatTripletMergeTree<Vertex, Value>::Parent;
+
+    assert(mt1.capacity() == mt2.capacity());
+
+    for_each(0, mt2.capacity(), [&](size_t u)
+    {
+        if (!mt2.contains(u)) return;
+        mt1.nodes_[u]   = mt2.nodes_[u];
+        mt1.parents_[u] = Parent(mt2.parents_[u]);
+    });
+    mt1.size_ += mt2.size_;
+    mt2.reset(0);
+
+    for_each(0, edges.size(), [&](size_t i)
+    {
+        Vertex a, b;
+        std::tie(a, b) = edges[i];
+        auto u = index(a), v = index(b);
+        if (!ignore_missing_edges || (mt1.contains(u) && mt1.contains(v)))
+            mt1.merge(u, v);
+    });
+
+    repair(mt1);
+
+    dlog::prof >> "merge";
+}
+
+template<class Vertex, class Value, class Functor>
+void
+reeber::traverse_persistence(const FlatTripletMergeTree<Vertex, Value>& mt, const Functor& f)
+{
+    typedef     typename FlatTripletMergeTree<Vertex, Value>::Index     Index;
+
+    Index s, v;
+    for (Index u = 0; u < mt.capacity(); ++u)
+    {
+        if (!mt.contains(u))
+            continue;
+
+        std::tie(s, v) = mt.parent(u);
+        if (u != s || u == v) f(&mt.node(u), &mt.node(s), &mt.node(v));
+    }
+}
+
+template<class Vertex, class Value, class Functor>
+void
+reeber::traverse_persistence_parallel(const FlatTripletMergeTree<Vertex, Value>& mt, const Functor& f)
+{
+    typedef     typename FlatTripletMergeTree<Vertex, Value>::Index     Index;
+
+    for_each(0, mt.capacity(), [&](size_t u)
+    {
+        if (!mt.contains(u))
+            return;
+
+        Index s, v;
+        std::tie(s, v) = mt.parent(u);
+        if (u != s || u == v) f(&mt.node(u), &mt.node(s), &mt.node(v));
+    });
+}
+
+template<class Vertex, class Value, class Special>
+void
+reeber::sparsify(TripletMergeTree<Vertex, Value>& out, const FlatTripletMergeTree<Vertex, Value>& in, const Special& special)
+{
+    dlog::prof << "sparsify";
+
+    typedef     typename FlatTripletMergeTree<Vertex, Value>::Index     Index;
+
+    // dense marks instead of set<Vertex>: the index space is already dense
+    std::unique_ptr<atomic<unsigned char>[]> keep(new atomic<unsigned char>[in.capacity()]());
+    for_each(0, in.capacity(), [&](size_t x)
+    {
+        if (!in.contains(x) || !special(in.node(x).vertex))
+            return;
+
+        Index u = x, s, v;
+        while (1)
+        {
+            std::tie(s, v) = in.parent(u);
+            keep[u] = 1;
+            keep[s] = 1;
+            if (keep[v]) break;
+            u = v;
+        }
+    });
+
+    for_each(0, in.capacity(), [&](size_t u) { if (keep[u]) out.add(in.node(u).vertex, in.node(u).value); });
+
+    for_each(0, in.capacity(), [&](size_t u)
+    {
+        if (!keep[u]) return;
+        Index s,v;
+        std::tie(s,v) = in.parent(u);
+        out.link(out[in.node(u).vertex], out[in.node(s).vertex], out[in.node(v).vertex]);
+    });
+
+    dlog::prof >> "sparsify";
+}
@@ -1,7 +1,14 @@
 #ifndef REEBER_MASKED_BOX_H
 #define REEBER_MASKED_BOX_H
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <functional>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
 
 #include "amr-vertex.h"
 #include "range/filtered.h"
@@ -14,17 +21,24 @@
 #include "grid.h"
 #include "box.h"
 #include "vertices.h"
+#include "connectivity.h"
 
 #include "amr_helper.h"
 
 namespace reeber {
 
-    template<unsigned D>
+    // Connectivity selects the link of a cell (see connectivity.h)
+    template<unsigned D, class Connectivity = FreudenthalConnectivity<D>>
     class MaskedBox
     {
     public:
-        using MaskValue = int;   // type of single cell in mask
+        using MaskValue = int;   // value of single cell in mask
         using MaskType = Grid<MaskValue, D>;
+        // the mask is stored one byte per cell: the special values are codes 0 .. n_special_codes - 1,
+        // the rest index the table of the gids of the neighbors, mask_gids_; once the table is full,
+        // the cells get overflow_code and their gids go to mask_overflow_, keyed by the cell index
+        using MaskCode = unsigned char;
+        using MaskCodeGrid = Grid<MaskCode, D>;
         using Position = typename MaskType::Vertex;
         using NewDynamicPoint = diy::DynamicPoint<int, D>;
 
@@ -40,9 +54,13 @@ namespace reeber {
         static constexpr MaskValue UNINIT = -4;
         // if wrap is false, then some mask cells don't correspond to any domain cells
         static constexpr MaskValue NOT_IN_DOMAIN = -5;
-        class FreudenthalLinkIterator;
+        static constexpr unsigned n_special_codes = 5;
+        static constexpr MaskCode overflow_code = std::numeric_limits<MaskCode>::max();
+        using NeighborIterator = LinkPositionIterator<Position, Connectivity>;
+        using NeighborRange = range::iterator_range<NeighborIterator>;
 
-        using FreudenthalLinkRange = range::iterator_range<FreudenthalLinkIterator>;
+        static constexpr unsigned link_size = Connectivity::size;
+        using LinkOffsets = std::array<std::ptrdiff_t, link_size>;
 
         using VI = VerticesIterator<Position>;
 
@@ -78,6 +96,7 @@ namespace reeber {
         {
             assert(ghost_adjustment_ == bounds_to_ - core_to_);
             diy::for_each(mask_.shape(), [this](const Position& p) { this->set_mask(p, this->UNINIT); });
+            set_offsets();
         }
 
         /**
@@ -93,7 +112,7 @@ namespace reeber {
         {
             bool debug = false;
             diy::for_each(mask_.shape(), [this, max_gid, debug](const Position& p_mask) {
-                MaskValue m = this->mask_(p_mask);
+                MaskValue m = this->mask(p_mask);
                 Position p_core = p_mask - Position::one();
 
                 bool is_valid = (m == ACTIVE and not is_outer(p_mask)) or
@@ -137,24 +156,25 @@ namespace reeber {
                    | range::filtered(std::bind(&MaskedBox::is_active_global, this, std::placeholders::_1));
         }
 
+        class LinkIterator;
+        class Link;
+
         /**
          *
          * @param v AmrVertexId: index of a cell
          * @return range of all vertex indices of active vertices
-         * in the link of v.
+         * in the link of v. The core cells step through precomputed
+         * index offsets, the others go through the positions.
          */
-        decltype(auto) link(const Vertex& v) const
-        {
-            return local_position_link_vertices(local_position(v));
-        }
+        Link link(const Vertex& v) const;
 
 
         // take global position p_glob
         // return outer positions in global coords
         decltype(auto) outer_edge_link(const Position& p_global) const
         {
-            return FreudenthalLinkRange(FreudenthalLinkIterator::begin(p_global),
-                                        FreudenthalLinkIterator::end(p_global))
+            return NeighborRange(NeighborIterator::begin(p_global),
+                                 NeighborIterator::end(p_global))
                    | range::filtered(std::bind(&MaskedBox::is_outer_edge_start_glob, this, std::placeholders::_1));
         }
 
@@ -181,6 +201,10 @@ namespace reeber {
             std::swap(core_to_, other.core_to_);
             std::swap(bounds_from_, other.bounds_from_);
             std::swap(bounds_to_, other.bounds_to_);
+            mask_gids_.swap(other.mask_gids_);
+            mask_overflow_.swap(other.mask_overflow_);
+            std::swap(mask_offsets_, other.mask_offsets_);
+            std::swap(local_offsets_, other.local_offsets_);
         }
 
         bool operator==(const MaskedBox& other) const
@@ -208,7 +232,8 @@ namespace reeber {
          */
         void set_mask(const Position& p_mask, MaskValue value)
         {
-            mask_(p_mask) = value;
+            size_t i = mask_.index(p_mask);
+            mask_(i) = encode(value, i);
         }
 
         /**
@@ -226,14 +251,44 @@ namespace reeber {
             }
 #endif
             //assert(is_valid_mask_position(p_bounds));
-            return mask_(p_mask);
+            return decode(mask_.index(p_mask));
         }
 
-        const MaskType& mask_grid() const
+        /**
+         *
+         * @return decoded copy of the mask, for tests and debugging
+         */
+        MaskType mask_grid() const
         {
-            return mask_;
+            MaskType result(mask_shape_, mask_.c_order());
+            for(size_t i = 0; i < mask_.size(); ++i)
+                result(i) = decode(i);
+            return result;
         }
 
+        bool c_order() const { return mask_.c_order(); }
+
+        template<class Real>
+        struct LowStats
+        {
+            size_t n_low { 0 };
+            size_t n_active { 0 };
+            Real sum_low { 0 };
+            Real sum_active { 0 };
+        };
+
+        /**
+         *
+         * @param fab values of the cells in local coordinates (w.r.t. bounds_from)
+         * @param is_low predicate on the values
+         * @return number and sum of the values of the cells marked LOW and of the cells left ACTIVE
+         *
+         * marks the ACTIVE core cells whose value is low as LOW; sweeps the core
+         * row by row along the contiguous axis, the inner loop is branch-free
+         */
+        template<class Real, class IsLow>
+        LowStats<Real> mark_low(const diy::GridRef<Real, D>& fab, const IsLow& is_low);
+
 
         /**
          *
@@ -285,7 +340,7 @@ namespace reeber {
         // (i.e, to get mask at bounds_from supply (0,0,0), not (-1,-1,-1)
         std::string pretty_mask_value(const Position& p_mask) const
         {
-            return pretty_mask_value(mask_(p_mask));
+            return pretty_mask_value(mask(p_mask));
         }
 
         // get readable mask by index w.r.t to core (i,e, does not support ghost vertices)
@@ -302,7 +357,7 @@ namespace reeber {
 
             //assert(Position::zero().is_less_or_eq(p_mask) && mask_shape().is_greater_or_eq(p_mask));
 
-            return mask_(p_mask);
+            return decode(mask_.index(p_mask));
         }
 
         Position bounds_shape() const { return bounds_shape_; }
@@ -419,18 +474,37 @@ namespace reeber {
         /**
          *
          * @param p Cell in local coordinates
-         * @return range of all active local vertices of Freudenthal link of p
+         * @return range of all active local vertices of the link of p
          * in local coordinates
          */
         decltype(auto) local_position_link(const Position& p_local) const
         {
-            return FreudenthalLinkRange(FreudenthalLinkIterator::begin(p_local), FreudenthalLinkIterator::end(p_local))
+            return NeighborRange(NeighborIterator::begin(p_local), NeighborIterator::end(p_local))
                    | range::filtered(std::bind(&MaskedBox::is_active_local, this, std::placeholders::_1));
         }
 
         // for test only
         decltype(auto) local_position_link(const NewDynamicPoint& p) const { return local_position_link(point_from_dynamic_point<D>(p)); }
 
+        /**
+         * maps a vertex onto [0, size()); AmrVertexId already stores
+         * the index of the cell w.r.t. bounds
+         */
+        struct LocalIndex
+        {
+            size_t size() const { return size_; }
+            size_t operator()(const Vertex& v) const { return v.vertex; }
+            size_t size_;
+        };
+
+        LocalIndex local_index() const
+        {
+            size_t n = 1;
+            for(size_t i = 0; i < D; ++i)
+                n *= bounds_shape_[i];
+            return LocalIndex { n };
+        }
+
         Vertex local_position_to_vertex(const Position& p_local) const
         {
             return AmrVertexId { gid(), local_box_.index(p_local) };
@@ -468,7 +542,7 @@ namespace reeber {
          */
         bool is_active_global(const Position& p_global) const
         {
-            return mask_(mask_position_from_global(p_global)) == ACTIVE;
+            return mask_(mask_position_from_global(p_global)) == special_code(ACTIVE);
         }
 
         /**
@@ -482,7 +556,7 @@ namespace reeber {
             if (not is_valid_mask_position(p_mask))
                 return false;
             else
-                return mask(p_mask) == ACTIVE;
+                return mask_(p_mask) == special_code(ACTIVE);
         }
 
         /**
@@ -492,7 +566,7 @@ namespace reeber {
          */
         bool is_active_index(const Vertex& v) const
         {
-            return mask_(mask_position(v)) == ACTIVE;
+            return mask_(mask_position(v)) == special_code(ACTIVE);
         }
 
         /**
@@ -508,14 +582,15 @@ namespace reeber {
                 return false;
 
 #ifdef REEBER_ENABLE_CHECKS
-            if ((mask_(p_mask) == ACTIVE or mask_(p_mask) == LOW) and is_outer(p_mask))
+            if ((mask(p_mask) == ACTIVE or mask(p_mask) == LOW) and is_outer(p_mask))
             {
                 fmt::print("Error in is_outer_edge_start, p_global = {}, p_mask = {}, this = {}, is outer\n", p_global, p_mask, *this);
                 throw std::runtime_error("Error in is_outer_edge_start-2");
             }
 #endif
 
-            return mask_(p_mask) != ACTIVE and mask_(p_mask) != LOW;
+            MaskCode c = mask_(p_mask);
+            return c != special_code(ACTIVE) and c != special_code(LOW);
         }
 
         bool is_valid_mask_position(const Position& p_mask) const
@@ -550,6 +625,23 @@ namespace reeber {
             return local_position_to_vertex(local_position_from_global(p_global));
         }
 
+        void set_offsets();
+
+        static constexpr MaskCode special_code(MaskValue value) { return MaskCode(-1 - value); }
+
+        // i: index of the cell in mask_
+        MaskCode encode(MaskValue value, size_t i);
+
+        MaskValue decode(size_t i) const
+        {
+            MaskCode code = mask_(i);
+            if (code < n_special_codes)
+                return -1 - MaskValue(code);
+            if (code == overflow_code)
+                return mask_overflow_.find(i)->second;
+            return mask_gids_[code - n_special_codes];
+        }
+
 
         // data
         const Position core_from_, core_to_;
@@ -561,10 +653,15 @@ namespace reeber {
         const Position mask_shape_;
         const Position ghost_adjustment_;
         const Position mask_adjustment_;
-        MaskType mask_;
+        MaskCodeGrid mask_;
+        std::vector<MaskValue> mask_gids_;
+        std::unordered_map<size_t, MaskValue> mask_overflow_;
         const int refinement_ { 0 };
         const int level_ { -1 };
         const int gid_ { -1 };
+        // index offsets of the link in mask_ and in local_box_, for the core cells
+        LinkOffsets mask_offsets_ {};
+        LinkOffsets local_offsets_ {};
     };
 
 }
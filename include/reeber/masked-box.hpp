@@ -2,8 +2,8 @@
 
 // TODO: think about methods inherited from Box
 
-template<unsigned D>
-bool reeber::MaskedBox<D>::core_contains_global(const Position& p) const
+template<unsigned D, class C>
+bool reeber::MaskedBox<D, C>::core_contains_global(const Position& p) const
 {
     for (unsigned i = 0; i < D; ++i)
         if (p[i] > core_to_[i] || p[i] < core_from_[i]) {
@@ -12,8 +12,8 @@ bool reeber::MaskedBox<D>::core_contains_global(const Position& p) const
     return true;
 }
 
-template<unsigned D>
-bool reeber::MaskedBox<D>::is_on_boundary(const Position& p_global) const
+template<unsigned D, class C>
+bool reeber::MaskedBox<D, C>::is_on_boundary(const Position& p_global) const
 {
     bool result = false;
     for (unsigned i = 0; i < D; ++i)
@@ -30,8 +30,8 @@ bool reeber::MaskedBox<D>::is_on_boundary(const Position& p_global) const
     return result;
 }
 
-template<unsigned D>
-bool reeber::MaskedBox<D>::is_strictly_inside(const Position& p_global) const
+template<unsigned D, class C>
+bool reeber::MaskedBox<D, C>::is_strictly_inside(const Position& p_global) const
 {
     for (unsigned i = 0; i < D; ++i)
     {
@@ -43,8 +43,8 @@ bool reeber::MaskedBox<D>::is_strictly_inside(const Position& p_global) const
     return true;
 }
 
-template<unsigned D>
-bool reeber::MaskedBox<D>::bounds_contains_global(const Position& p) const
+template<unsigned D, class C>
+bool reeber::MaskedBox<D, C>::bounds_contains_global(const Position& p) const
 {
     for (unsigned i = 0; i < D; ++i)
         if (p[i] > bounds_to_[i] || p[i] < bounds_from_[i]) {
@@ -53,8 +53,8 @@ bool reeber::MaskedBox<D>::bounds_contains_global(const Position& p) const
     return true;
 }
 
-template<unsigned D>
-bool reeber::MaskedBox<D>::is_in_core(const Position& p_core) const
+template<unsigned D, class C>
+bool reeber::MaskedBox<D, C>::is_in_core(const Position& p_core) const
 {
     for (unsigned i = 0; i < D; ++i)
         if (p_core[i] < 0 || p_core[i] >= core_shape_[i]) {
@@ -63,110 +63,210 @@ bool reeber::MaskedBox<D>::is_in_core(const Position& p_core) const
     return true;
 }
 
-template<unsigned D>
-void reeber::MaskedBox<D>::save(const void* mb, diy::BinaryBuffer& bb)
+template<unsigned D, class C>
+typename reeber::MaskedBox<D, C>::MaskCode
+reeber::MaskedBox<D, C>::encode(MaskValue value, size_t i)
 {
+    if (!mask_overflow_.empty())
+        mask_overflow_.erase(i);
+
+    if (value < 0)
+    {
+        assert(-value <= (int) n_special_codes);
+        return special_code(value);
+    }
+
+    // a block has few neighbors, a linear search is fine
+    auto it = std::find(mask_gids_.begin(), mask_gids_.end(), value);
+    if (it != mask_gids_.end())
+        return MaskCode(n_special_codes + (it - mask_gids_.begin()));
+
+    if (n_special_codes + mask_gids_.size() == overflow_code)
+    {
+        mask_overflow_[i] = value;
+        return overflow_code;
+    }
+
+    mask_gids_.push_back(value);
+    return MaskCode(n_special_codes + mask_gids_.size() - 1);
 }
 
-template<unsigned D>
-void reeber::MaskedBox<D>::load(void* mb, diy::BinaryBuffer& bb)
+template<unsigned D, class C>
+template<class Real, class IsLow>
+typename reeber::MaskedBox<D, C>::template LowStats<Real>
+reeber::MaskedBox<D, C>::mark_low(const diy::GridRef<Real, D>& fab, const IsLow& is_low)
 {
-}
+    LowStats<Real> stats;
+
+    unsigned axis = mask_.c_order() ? D - 1 : 0;
+    Position rows = core_shape_;
+    rows[axis] = 1;
 
+    Position step = Position::zero();
+    step[axis] = 1;
+    std::ptrdiff_t mask_stride = std::ptrdiff_t(mask_.index(Position::one() + step) - mask_.index(Position::one()));
+    std::ptrdiff_t fab_stride = std::ptrdiff_t(fab.index(Position::one() + step) - fab.index(Position::one()));
 
-/* MaskedBox::FreudenthalLinkIterator */
-template<unsigned D>
-class reeber::MaskedBox<D>::FreudenthalLinkIterator :
-        public std::iterator<std::forward_iterator_tag, Position>
+    const MaskCode active_code = special_code(ACTIVE);
+    const MaskCode low_code = special_code(LOW);
+    const int n = core_shape_[axis];
+
+    diy::for_each(rows, [&](const Position& p_core) {
+        MaskCode* m = mask_.data() + mask_.index(p_core + Position::one());
+        const Real* f = fab.data() + fab.index(p_core + ghost_adjustment_);
+
+        size_t n_low = 0, n_active = 0;
+        Real sum_low = 0, sum_active = 0;
+        for(int i = 0; i < n; ++i)
+        {
+            MaskCode c = m[i * mask_stride];
+            Real x = f[i * fab_stride];
+            bool active = c == active_code;
+            bool low = active & is_low(x);
+            bool high = active & not low;
+            m[i * mask_stride] = low ? low_code : c;
+            n_low += low;
+            n_active += high;
+            sum_low += low ? x : Real(0);
+            sum_active += high ? x : Real(0);
+        }
+
+        stats.n_low += n_low;
+        stats.n_active += n_active;
+        stats.sum_low += sum_low;
+        stats.sum_active += sum_active;
+    });
+
+    return stats;
+}
+
+template<unsigned D, class C>
+void reeber::MaskedBox<D, C>::save(const void* mb, diy::BinaryBuffer& bb)
 {
-    using Parent = std::iterator<std::forward_iterator_tag, Position>;
+}
 
-public:
-    typedef typename Parent::value_type value_type;
-    typedef typename Parent::difference_type difference_type;
-    typedef typename Parent::reference reference;
+template<unsigned D, class C>
+void reeber::MaskedBox<D, C>::load(void* mb, diy::BinaryBuffer& bb)
+{
+}
 
-    FreudenthalLinkIterator() :
-            loc_(0), dir_(0)
-    {
-    }
 
-    FreudenthalLinkIterator(const Position& p, int loc = 0, int dir = 1) :
-            p_(p), v_(p), loc_(loc), dir_(dir)
+/* MaskedBox::LinkIterator */
+template<unsigned D, class C>
+class reeber::MaskedBox<D, C>::LinkIterator :
+        public std::iterator<std::forward_iterator_tag, Vertex>
+{
+public:
+    LinkIterator(const MaskedBox& box, const Position& p_local, unsigned k) :
+            box_(&box), p_(p_local), k_(k)
     {
+        core_ = box.is_in_core(p_local - box.ghost_adjustment_);
+        if (core_)
+        {
+            mask_base_ = box.mask_.index(box.mask_position_from_local(p_local));
+            local_base_ = box.local_box_.index(p_local);
+        }
+        skip();
     }
 
-    static FreudenthalLinkIterator
-    begin(const Position& p)
+    Vertex operator*() const
     {
-        FreudenthalLinkIterator it(p);
-        ++it;
-        return it;
+        if (core_)
+            return AmrVertexId { box_->gid(), size_t(std::ptrdiff_t(local_base_) + box_->local_offsets_[k_]) };
+        else
+            return box_->local_position_to_vertex(position());
     }
 
-    static FreudenthalLinkIterator
-    end(const Position& p)
+    LinkIterator& operator++()
     {
-        return FreudenthalLinkIterator(p, 0, -1);
+        ++k_;
+        skip();
+        return *this;
     }
 
-    const Position& operator*() const
+    LinkIterator operator++(int)
     {
-        return v_;
+        LinkIterator it = *this;
+        ++(*this);
+        return it;
     }
 
-    const Position* operator->() const
+    friend bool operator==(const LinkIterator& x, const LinkIterator& y)
     {
-        return &v_;
+        return x.k_ == y.k_;
     }
 
-    FreudenthalLinkIterator& operator++()
+    friend bool operator!=(const LinkIterator& x, const LinkIterator& y)
     {
-        increment();
-        return *this;
+        return x.k_ != y.k_;
     }
 
-    FreudenthalLinkIterator operator++(int)
+private:
+    Position position() const
     {
-        FreudenthalLinkIterator it = *this;
-        increment();
-        return it;
+        const auto& direction = detail::ConnectivityTable<C>::value.direction[k_];
+        Position q = p_;
+        for (unsigned i = 0; i < D; ++i)
+            q[i] += direction[i];
+        return q;
     }
 
-    friend bool operator==(const FreudenthalLinkIterator& x, const FreudenthalLinkIterator& y)
+    bool active() const
     {
-        return x.v_ == y.v_;
+        // the link of a core cell is always inside the mask
+        if (core_)
+            return box_->mask_(size_t(std::ptrdiff_t(mask_base_) + box_->mask_offsets_[k_])) == special_code(ACTIVE);
+        else
+            return box_->is_active_local(position());
     }
 
-    friend bool operator!=(const FreudenthalLinkIterator& x, const FreudenthalLinkIterator& y)
+    void skip()
     {
-        return x.v_ != y.v_;
+        while (k_ < link_size and not active())
+            ++k_;
     }
 
 private:
-    void increment();
-
-private:
-    Position p_, v_;
-    int loc_;
-    int dir_;
+    const MaskedBox* box_;
+    Position p_;
+    bool core_;
+    size_t mask_base_ { 0 };
+    size_t local_base_ { 0 };
+    unsigned k_;
 };
 
-template<unsigned D>
-void
-reeber::MaskedBox<D>::FreudenthalLinkIterator::
-increment()
+template<unsigned D, class C>
+class reeber::MaskedBox<D, C>::Link : public range::iterator_range<LinkIterator>
 {
-    loc_ += dir_;
-    if (loc_ == (1 << D)) {
-        dir_ = -1;
-        loc_ += dir_;
+public:
+    using Parent = range::iterator_range<LinkIterator>;
+
+    Link(const LinkIterator& begin, const LinkIterator& end) :
+            Parent(begin, end)
+    {
     }
+};
 
-    for (unsigned i = 0; i < D; ++i)
-        if (loc_ & (1 << i)) {
-            v_[i] = p_[i] + dir_;
-        } else {
-            v_[i] = p_[i];
-        }
+template<unsigned D, class C>
+typename reeber::MaskedBox<D, C>::Link
+reeber::MaskedBox<D, C>::link(const Vertex& v) const
+{
+    Position p_local = local_position(v);
+    return Link(LinkIterator(*this, p_local, 0), LinkIterator(*this, p_local, link_size));
+}
+
+template<unsigned D, class C>
+void reeber::MaskedBox<D, C>::set_offsets()
+{
+    const C& table = detail::ConnectivityTable<C>::value;
+
+    Position one = Position::one();
+    for (unsigned k = 0; k < link_size; ++k)
+    {
+        Position q = one;
+        for (unsigned i = 0; i < D; ++i)
+            q[i] += table.direction[k][i];
+        mask_offsets_[k] = std::ptrdiff_t(mask_.index(q) - mask_.index(one));
+        local_offsets_[k] = std::ptrdiff_t(local_box_.index(q) - local_box_.index(one));
+    }
 }
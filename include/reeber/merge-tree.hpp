@@ -5,6 +5,7 @@
 #include <dlog/counters.h>
 
 #include "range/utility.h"
+#include "radix-sort.h"
 
 template<class Vertex, class Value>
 typename reeber::MergeTree<Vertex, Value>::Neighbor
@@ -102,10 +103,7 @@ reeber::compute_merge_tree(MergeTree& mt, const Topology& topology, const Functi
     for(Vertex v : topology.vertices())
         vertices.push_back(std::make_pair(f(v), v));
 
-    if (mt.negate())
-        std::sort(vertices.begin(), vertices.end(), std::greater<ValueVertexPair>());
-    else
-        std::sort(vertices.begin(), vertices.end(), std::less<ValueVertexPair>());
+    sort_value_vertex(vertices, mt.negate());
 
     LOG_SEV(debug) << "Computing merge tree out of " << vertices.size() << " vertices";
 
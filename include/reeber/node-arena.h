@@ -0,0 +1,189 @@
+#ifndef REEBER_NODE_ARENA_H
+#define REEBER_NODE_ARENA_H
+
+#include <vector>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <cstdint>
+#include <stdexcept>
+
+#include "parallel-tbb.h"
+
+namespace reeber
+{
+
+/**
+ * Arena for tree nodes. Nodes are carved out of fixed-size slabs through a
+ * per-thread cursor, so concurrent allocation (e.g., in compute_merge_tree2)
+ * doesn't contend. Freed nodes go onto the freeing thread's free list.
+ * Destroying the arena returns all of its slabs at once to a process-wide
+ * pool, from which the next arena of the same type takes them; the pool
+ * keeps at most pool_limit() slabs and frees the rest (set_pool_limit()).
+ *
+ * Every slab gets a permanent process-wide number when it's first created, so
+ * a node can also be identified by a 32-bit id (slab number, offset), which
+ * pointer() turns back into the address; this lets REEBER_COMPACT_PARENT pack
+ * two nodes into a single word.
+ */
+template<class T>
+class NodeArena
+{
+    public:
+        typedef     std::uint32_t           Id;
+
+        static constexpr unsigned   slab_bits  = 10;
+        static constexpr unsigned   chunk_bits = 10;
+        static constexpr size_t     slab_size  = size_t(1) << slab_bits;        // nodes per slab
+        static constexpr Id         no_id      = Id(-1);
+
+    private:
+        union Slot
+        {
+            struct
+            {
+                Slot*           next;
+                Id              id;
+            }                                                       link;       // while on a free list
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        };
+
+        struct Slab
+        {
+            Slot*       slots;
+            Id          index;
+        };
+
+        struct Local
+        {
+            Slot*       cur  = nullptr;
+            Slot*       end  = nullptr;
+            Id          id   = 0;               // id of *cur
+            Slot*       free = nullptr;
+        };
+
+        // slab number -> slab; two levels, so that it can grow without moving
+        static constexpr size_t     n_chunks   = size_t(1) << (32 - slab_bits - chunk_bits);
+
+        static constexpr size_t     chunk_mask = (size_t(1) << chunk_bits) - 1;
+
+        // zero-initialized before anything runs, so pointer() needs no guard
+        static Slot**               directory_[n_chunks];
+
+        struct SlabPool
+        {
+                        ~SlabPool()                     { for (Slot**& c : directory_) { if (!c) break; for (size_t i = 0; i <= chunk_mask; ++i) delete[] c[i]; delete[] c; c = nullptr; } }
+
+            Slab        get()
+            {
+                std::lock_guard<mutex> lock(m);
+                if (!slabs.empty()) { Slab s = slabs.back(); slabs.pop_back(); return s; }
+
+                Id index;
+                if (!free_indices.empty())
+                {
+                    index = free_indices.back();
+                    free_indices.pop_back();
+                } else
+                {
+                    if (count == n_chunks << chunk_bits)
+                        throw std::runtime_error("NodeArena: out of node ids");
+                    index = Id(count++);
+                    Slot**& chunk = directory_[index >> chunk_bits];
+                    if (!chunk) chunk = new Slot*[chunk_mask + 1]();
+                }
+                Slab s { new Slot[slab_size], index };
+                directory_[index >> chunk_bits][index & chunk_mask] = s.slots;
+                return s;
+            }
+
+            void        put(std::vector<Slab>& ss)      { std::lock_guard<mutex> lock(m); slabs.insert(slabs.end(), ss.begin(), ss.end()); ss.clear(); trim(); }
+
+            // frees the slabs above the limit; their numbers go to the next new slabs
+            void        trim()
+            {
+                while (slabs.size() > limit)
+                {
+                    Slab s = slabs.back();
+                    slabs.pop_back();
+                    directory_[s.index >> chunk_bits][s.index & chunk_mask] = nullptr;
+                    delete[] s.slots;
+                    free_indices.push_back(s.index);
+                }
+            }
+
+            mutex               m;
+            std::vector<Slab>   slabs;
+            std::vector<Id>     free_indices;
+            size_t              count = 0;
+            size_t              limit = 256;
+        };
+
+        // constructed on first use; since every arena touches it in its
+        // constructor, the pool outlives all (static) arenas
+        static SlabPool&    pool()                      { static SlabPool p; return p; }
+
+    public:
+                    NodeArena()                         { pool(); }
+                    ~NodeArena()                        { release(); }
+
+                    NodeArena(const NodeArena&)         =delete;
+        NodeArena&  operator=(const NodeArena&)         =delete;
+
+        T*          allocate()                          { Id id; return allocate(id); }
+        T*          allocate(Id& id)
+        {
+            Local& l = locals_.local();
+            Slot* p;
+            if (l.free)
+            {
+                p = l.free;
+                l.free = p->link.next;
+                id = p->link.id;
+            } else
+            {
+                if (l.cur == l.end)
+                {
+                    Slab s = pool().get();
+                    { std::lock_guard<mutex> lock(m_); slabs_.push_back(s); }
+                    l.cur = s.slots;
+                    l.end = s.slots + slab_size;
+                    l.id  = s.index << slab_bits;
+                }
+                p = l.cur++;
+                id = l.id++;
+            }
+            return new (&p->storage) T();
+        }
+
+        // id must be the one returned by allocate(), if the arena is used with ids
+        void        deallocate(T* x, Id id = no_id)     { x->~T(); Local& l = locals_.local(); Slot* p = reinterpret_cast<Slot*>(x); p->link.next = l.free; p->link.id = id; l.free = p; }
+
+        static T*   pointer(Id id)                      { Slot* s = directory_[id >> (slab_bits + chunk_bits)][(id >> slab_bits) & chunk_mask];
+                                                          return reinterpret_cast<T*>(&s[id & (slab_size - 1)].storage); }
+
+        // takes over all the slabs of other (the nodes allocated by other now belong to this arena)
+        void        splice(NodeArena& other)            { std::lock_guard<mutex> lock(m_); slabs_.insert(slabs_.end(), other.slabs_.begin(), other.slabs_.end()); other.slabs_.clear(); other.locals_.clear(); }
+
+        // returns all slabs to the pool; live nodes must have been destroyed by the caller
+        void        release()                           { locals_.clear(); pool().put(slabs_); }
+
+        size_t      n_slabs() const                     { return slabs_.size(); }
+
+        // the most free slabs (of slab_size nodes) the pool keeps for the next arenas
+        static size_t   pool_limit()                    { SlabPool& p = pool(); std::lock_guard<mutex> lock(p.m); return p.limit; }
+        static void     set_pool_limit(size_t n)        { SlabPool& p = pool(); std::lock_guard<mutex> lock(p.m); p.limit = n; p.trim(); }
+        static size_t   pool_size()                     { SlabPool& p = pool(); std::lock_guard<mutex> lock(p.m); return p.slabs.size(); }
+
+    private:
+        mutex                       m_;
+        std::vector<Slab>           slabs_;
+        thread_specific<Local>      locals_;
+};
+
+template<class T>
+typename NodeArena<T>::Slot** NodeArena<T>::directory_[NodeArena<T>::n_chunks];
+
+}
+
+#endif
@@ -28,7 +28,9 @@ struct Serialization< vector<U> >
         diy::load(bb, v[i]);
     }
 };
+#endif
 
+#if defined(REEBER_USE_TBB) || defined(REEBER_USE_THREADS)
 template<class K, class V, class H, class E, class A>
 struct Serialization< map<K,V,H,E,A> >
 {
@@ -70,7 +72,9 @@ struct Serialization<::reeber::vector<T>>
     static void save(BinaryBuffer& bb, const Vector& v)     { ::reeber::Serialization<Vector>::save(bb, v); }
     static void load(BinaryBuffer& bb, Vector& v)           { ::reeber::Serialization<Vector>::load(bb, v); }
 };
+#endif
 
+#if defined(REEBER_USE_TBB) || defined(REEBER_USE_THREADS)
 template<class K, class V, class H, class E, class A>
 struct Serialization<::reeber::map<K,V,H,E,A>>
 {
@@ -40,6 +40,12 @@ namespace reeber
         tbb::parallel_for(c.range(), [&](const typename Container::range_type& r) { for_each_range_(r, f); });
     }
 
+    template<class Container, class F>
+    void                for_each_range(const Container& c, const F& f)
+    {
+        tbb::parallel_for(c.range(), [&](const typename Container::const_range_type& r) { for_each_range_(r, f); });
+    }
+
     template<class F>
     void                for_each(size_t from, size_t to, const F& f)                { tbb::parallel_for(from, to, f); }
 
@@ -76,6 +82,112 @@ namespace reeber
     // allocator
     template<class T>
     using allocator = tbb::scalable_allocator<T>;
+
+    // mutex
+    using mutex = tbb::spin_mutex;
+
+    // thread-local storage; local() returns the calling thread's copy
+    template<class T>
+    using thread_specific = tbb::enumerable_thread_specific<T>;
+}
+
+#elif defined(REEBER_USE_THREADS)
+
+#include "parallel-threads.h"
+
+namespace reeber
+{
+    struct task_scheduler_init
+    {
+                        task_scheduler_init(int n)      { if (n != automatic) threads::ThreadPool::instance().resize(n); }
+        static const int automatic = -1;
+    };
+
+    // atomic
+    template<class T>
+    using atomic = std::atomic<T>;
+
+    template<class T>
+    bool compare_exchange(atomic<T>& x, T& expected, T desired)     { return x.compare_exchange_weak(expected, desired); }
+
+    // vector
+    template<class T>
+    using vector = std::vector<T>;
+
+    // foreach
+    template<class F>
+    void                for_each(size_t from, size_t to, const F& f)                { threads::ThreadPool::instance().parallel_for(from, to, f); }
+
+    template<class Iterator, class F>
+    void                do_foreach_(Iterator begin, Iterator end, const F& f, std::random_access_iterator_tag)
+    {
+        for_each(0, end - begin, [&](size_t i) { f(begin[i]); });
+    }
+
+    template<class Iterator, class F>
+    void                do_foreach_(Iterator begin, Iterator end, const F& f, std::input_iterator_tag)
+    {
+        std::for_each(begin, end, f);
+    }
+
+    template<class Iterator, class F>
+    void                do_foreach(Iterator begin, Iterator end, const F& f)
+    {
+        do_foreach_(begin, end, f, typename std::iterator_traits<Iterator>::iterator_category());
+    }
+
+    template<class Inner, class F>
+    void                for_each_range(threads::sharded<Inner>& c, const F& f)
+    {
+        for_each(0, c.n_shards, [&](size_t s) { for (auto& x : c.shard_map(s)) f(x); });
+    }
+
+    template<class Inner, class F>
+    void                for_each_range(const threads::sharded<Inner>& c, const F& f)
+    {
+        for_each(0, c.n_shards, [&](size_t s) { for (auto& x : c.shard_map(s)) f(x); });
+    }
+
+    template<class Container, class F>
+    void                for_each_range(Container& c, const F& f)
+    {
+        do_foreach(std::begin(c), std::end(c), f);
+    }
+
+    // map
+    template<class Key, class T,
+             class Hash = std::hash<Key>,
+             class KeyEqual = std::equal_to<Key>,
+             class Allocator = std::allocator<std::pair<const Key, T>>>
+    using map = threads::sharded<std::unordered_map<Key, T, Hash, KeyEqual, Allocator>>;
+
+    template<class Key, class T, class H, class KE, class A>
+    void map_erase(map<Key, T, H, KE, A>& m, const Key& k)                             { m.erase(k); }
+
+    template<class Key, class T, class H, class KE, class A>
+    typename map<Key, T, H, KE, A>::iterator
+    map_erase(map<Key, T, H, KE, A>& m, typename map<Key, T, H, KE, A>::const_iterator it)  { return m.erase(it); }
+
+    // set
+    template<class Key,
+             class Hash = std::hash<Key>,
+             class KeyEqual = std::equal_to<Key>,
+             class Allocator = std::allocator<Key>>
+    using set = threads::sharded<std::unordered_set<Key, Hash, KeyEqual, Allocator>>;
+
+    template<class Key, class H, class KE, class A>
+    void set_erase(set<Key, H, KE, A>& s, const Key& k)                             { s.erase(k); }
+
+    // allocator
+    template<class T>
+    using allocator = std::allocator<T>;
+
+    // mutex
+    using mutex = threads::spin_mutex;
+
+    // thread-local storage; local() returns the calling thread's copy
+    template<class T>
+    using thread_specific = threads::thread_specific<T>;
 }
 
 #else
@@ -151,6 +263,27 @@ namespace reeber
     // allocator
     template<class T>
     using allocator = std::allocator<T>;
+
+    // mutex
+    struct mutex
+    {
+        void            lock()                          {}
+        void            unlock()                        {}
+    };
+
+    // thread-local storage; local() returns the calling thread's copy
+    template<class T>
+    struct thread_specific
+    {
+        T&              local()                         { return x; }
+        T*              begin()                         { return &x; }
+        T*              end()                           { return &x + 1; }
+        template<class F>
+        void            combine_each(const F& f)        { f(x); }
+        void            clear()                         { x = T(); }
+
+        T               x {};
+    };
 }
 
 #endif
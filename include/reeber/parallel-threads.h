@@ -0,0 +1,458 @@
+#pragma once
+
+// Work-stealing std::thread backend for parallel-tbb.h (REEBER_USE_THREADS)
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace reeber
+{
+namespace threads
+{
+    struct spin_mutex
+    {
+        void            lock()                          { while (flag_.test_and_set(std::memory_order_acquire)) std::this_thread::yield(); }
+        void            unlock()                        { flag_.clear(std::memory_order_release); }
+
+        std::atomic_flag    flag_ = ATOMIC_FLAG_INIT;
+    };
+
+    /**
+     * Small dense id of the calling thread, assigned on first use. A thread
+     * gives its id back when it exits and the next new thread reuses it, so
+     * the ids stay bounded by the number of threads alive at once (diy::Master
+     * starts fresh threads in every foreach). The new owner also inherits the
+     * thread_specific slots of the old one, which is fine since only one
+     * thread at a time uses them.
+     */
+    class ThreadIndex
+    {
+        public:
+            static unsigned     get()                           { thread_local Holder h; return h.idx; }
+
+        private:
+            struct Registry
+            {
+                std::mutex              m;
+                std::vector<unsigned>   free;
+                unsigned                next = 0;
+            };
+
+            // constructed before the first Holder, so it outlives all of them
+            static Registry&    registry()                      { static Registry r; return r; }
+
+            struct Holder
+            {
+                                Holder()
+                {
+                    Registry& r = registry();
+                    std::lock_guard<std::mutex> lock(r.m);
+                    if (r.free.empty())
+                        idx = r.next++;
+                    else
+                    {
+                        idx = r.free.back();
+                        r.free.pop_back();
+                    }
+                }
+
+                                ~Holder()                       { Registry& r = registry(); std::lock_guard<std::mutex> lock(r.m); r.free.push_back(idx); }
+
+                unsigned        idx;
+            };
+    };
+
+    inline unsigned     thread_index()                  { return ThreadIndex::get(); }
+
+    /**
+     * Every thread (the pool's workers and the callers) owns a deque of ranges.
+     * Executing a range splits it in halves down to the grain size, pushing the
+     * upper halves onto the owner's deque; the owner pops from the back, idle
+     * threads steal from the front (i.e., the largest pieces).
+     */
+    class ThreadPool
+    {
+        public:
+            struct Task
+            {
+                void                    (*run)(const void*, size_t, size_t);
+                const void*             f;
+                size_t                  from, to, grain;
+                std::atomic<size_t>*    remaining;
+            };
+
+            static ThreadPool&  instance()                      { static ThreadPool pool; return pool; }
+
+                                ~ThreadPool()                   { stop(); }
+
+            // total number of threads, including the caller
+            void                resize(unsigned n);
+            unsigned            size() const                    { return workers_.size() + 1; }
+
+            template<class F>
+            void                parallel_for(size_t from, size_t to, const F& f);
+
+        private:
+                                ThreadPool()                    { unsigned n = std::thread::hardware_concurrency(); resize(n ? n : 1); }
+
+            struct Queue
+            {
+                spin_mutex          m;
+                std::deque<Task>    tasks;
+            };
+
+            template<class F>
+            static void         invoke(const void* f, size_t from, size_t to)      { const F& f_ = *static_cast<const F*>(f); for (size_t i = from; i < to; ++i) f_(i); }
+
+            void                execute(Task t);
+            void                push(const Task& t);
+            bool                pop(Task& t);
+            void                worker(unsigned i);
+            void                stop();
+
+            // workers use their own queue; everybody else shares the last one
+            static int&         worker_id()                     { thread_local int id = -1; return id; }
+            size_t              my_queue() const                { int id = worker_id(); return id < 0 ? n_queues_ - 1 : id; }
+
+        private:
+            std::vector<std::thread>    workers_;
+            std::unique_ptr<Queue[]>    queues_;
+            size_t                      n_queues_ = 0;
+
+            std::atomic<size_t>         queued_   { 0 };
+            std::atomic<int>            sleeping_ { 0 };
+            std::mutex                  m_;
+            std::condition_variable     cv_;
+            bool                        stop_ = false;
+    };
+
+    inline void
+    ThreadPool::resize(unsigned n)
+    {
+        stop();
+
+        stop_     = false;
+        n_queues_ = n;
+        queues_.reset(new Queue[n_queues_]);
+        for (unsigned i = 0; i + 1 < n; ++i)
+            workers_.emplace_back([this,i]() { worker(i); });
+    }
+
+    inline void
+    ThreadPool::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : workers_)
+            t.join();
+        workers_.clear();
+    }
+
+    inline void
+    ThreadPool::push(const Task& t)
+    {
+        Queue& q = queues_[my_queue()];
+        {
+            std::lock_guard<spin_mutex> lock(q.m);
+            q.tasks.push_back(t);
+        }
+        ++queued_;
+        if (sleeping_ > 0)
+        {
+            { std::lock_guard<std::mutex> lock(m_); }
+            cv_.notify_one();
+        }
+    }
+
+    inline bool
+    ThreadPool::pop(Task& t)
+    {
+        size_t me = my_queue();
+        {
+            Queue& q = queues_[me];
+            std::lock_guard<spin_mutex> lock(q.m);
+            if (!q.tasks.empty())
+            {
+                t = q.tasks.back();
+                q.tasks.pop_back();
+                --queued_;
+                return true;
+            }
+        }
+
+        for (size_t k = 1; k < n_queues_; ++k)
+        {
+            Queue& q = queues_[(me + k) % n_queues_];
+            std::lock_guard<spin_mutex> lock(q.m);
+            if (!q.tasks.empty())
+            {
+                t = q.tasks.front();
+                q.tasks.pop_front();
+                --queued_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline void
+    ThreadPool::execute(Task t)
+    {
+        while (t.to - t.from > t.grain)
+        {
+            Task upper = t;
+            upper.from = t.from + (t.to - t.from) / 2;
+            t.to = upper.from;
+            push(upper);
+        }
+        t.run(t.f, t.from, t.to);
+        t.remaining->fetch_sub(t.to - t.from);        // the range owner may return right after this
+    }
+
+    inline void
+    ThreadPool::worker(unsigned i)
+    {
+        worker_id() = i;
+        while (true)
+        {
+            Task t;
+            if (pop(t))
+            {
+                execute(t);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_);
+            ++sleeping_;
+            cv_.wait(lock, [this]() { return stop_ || queued_ > 0; });
+            --sleeping_;
+            if (stop_)
+                return;
+        }
+    }
+
+    template<class F>
+    void
+    ThreadPool::parallel_for(size_t from, size_t to, const F& f)
+    {
+        if (from >= to)
+            return;
+
+        size_t n = to - from;
+        if (workers_.empty() || n == 1)
+        {
+            for (size_t i = from; i < to; ++i)
+                f(i);
+            return;
+        }
+
+        std::atomic<size_t> remaining { n };
+        execute(Task { &invoke<F>, &f, from, to, std::max<size_t>(1, n / (8 * size())), &remaining });
+
+        // help out (possibly with other ranges) until all of ours are done
+        Task t;
+        while (remaining > 0)
+        {
+            if (pop(t))
+                execute(t);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+
+    // per-thread copies; local() is lock-free, iteration and clear() must not race with it
+    template<class T>
+    class thread_specific
+    {
+        public:
+            static constexpr size_t max_threads = 1024;
+
+        public:
+                                thread_specific()               {}
+                                ~thread_specific()              { clear(); }
+
+                                thread_specific(const thread_specific&)     =delete;
+            thread_specific&    operator=(const thread_specific&)           =delete;
+
+            T&                  local()
+            {
+                unsigned i = thread_index();
+                if (i >= max_threads)
+                    throw std::runtime_error("thread_specific: too many threads alive at once");
+
+                std::atomic<T*>* slots = slots_.load();
+                if (!slots)
+                {
+                    std::atomic<T*>* fresh = new std::atomic<T*>[max_threads]();
+                    if (slots_.compare_exchange_strong(slots, fresh))
+                        slots = fresh;
+                    else
+                        delete[] fresh;
+                }
+                T* x = slots[i];
+                if (!x)
+                {
+                    x = new T();
+                    slots[i] = x;
+                }
+                return *x;
+            }
+
+            template<class F>
+            void                combine_each(const F& f)        { std::atomic<T*>* slots = slots_.load(); if (!slots) return; for (size_t i = 0; i < max_threads; ++i) if (slots[i]) f(*slots[i].load()); }
+
+            void                clear()                         { std::atomic<T*>* slots = slots_.exchange(nullptr); if (!slots) return; for (size_t i = 0; i < max_threads; ++i) delete slots[i].load(); delete[] slots; }
+
+        private:
+            std::atomic<std::atomic<T*>*>   slots_ { nullptr };
+    };
+
+
+    /**
+     * Hash container split into independently locked shards. Insertion and
+     * lookup lock one shard; iteration, erase and clear are not thread-safe
+     * (same as unsafe_erase in TBB). References to elements stay valid under
+     * concurrent insertion; iterators returned by find() should be
+     * dereferenced right away.
+     */
+    template<class Inner>
+    class sharded
+    {
+        public:
+            using key_type          = typename Inner::key_type;
+            using value_type        = typename Inner::value_type;
+            using hasher            = typename Inner::hasher;
+            using key_equal         = typename Inner::key_equal;
+            using size_type         = size_t;
+
+            static constexpr unsigned   shard_bits = 6;
+            static constexpr size_t     n_shards   = size_t(1) << shard_bits;
+
+            template<bool Const>
+            class iterator_
+            {
+                public:
+                    using Container         = typename std::conditional<Const, const sharded, sharded>::type;
+                    using InnerIterator     = typename std::conditional<Const, typename Inner::const_iterator, typename Inner::iterator>::type;
+
+                    using iterator_category = std::forward_iterator_tag;
+                    using value_type        = typename sharded::value_type;
+                    using difference_type   = std::ptrdiff_t;
+                    using reference         = typename std::conditional<Const, const value_type&, typename std::iterator_traits<InnerIterator>::reference>::type;
+                    using pointer           = typename std::conditional<Const, const value_type*, typename std::iterator_traits<InnerIterator>::pointer>::type;
+
+                                    iterator_()                                         {}
+                                    iterator_(Container* c, size_t s, InnerIterator it):
+                                        c_(c), s_(s), it_(it)                           {}
+                    template<bool C, class = typename std::enable_if<Const && !C>::type>
+                                    iterator_(const iterator_<C>& other):
+                                        c_(other.c_), s_(other.s_), it_(other.it_)      {}
+
+                    reference       operator*() const                                   { return *it_; }
+                    pointer         operator->() const                                  { return &*it_; }
+
+                    iterator_&      operator++()                                        { ++it_; skip_empty(); return *this; }
+                    iterator_       operator++(int)                                     { iterator_ it = *this; ++(*this); return it; }
+
+                    friend bool     operator==(const iterator_& x, const iterator_& y)  { return x.s_ == y.s_ && (x.s_ == n_shards || x.it_ == y.it_); }
+                    friend bool     operator!=(const iterator_& x, const iterator_& y)  { return !(x == y); }
+
+                    void            skip_empty()                                        { while (s_ < n_shards && it_ == c_->shards_[s_].map.end()) { if (++s_ < n_shards) it_ = c_->shards_[s_].map.begin(); } }
+
+                private:
+                    template<bool>  friend class iterator_;
+                    friend class    sharded;
+
+                    Container*      c_ = nullptr;
+                    size_t          s_ = n_shards;
+                    InnerIterator   it_;
+            };
+
+            using iterator          = iterator_<false>;
+            using const_iterator    = iterator_<true>;
+
+        public:
+                                sharded()                                               {}
+                                sharded(const sharded& other)                           { for (size_t s = 0; s < n_shards; ++s) shards_[s].map = other.shards_[s].map; }
+                                sharded(sharded&& other)                                { swap(other); }
+            sharded&            operator=(const sharded& other)                         { for (size_t s = 0; s < n_shards; ++s) shards_[s].map = other.shards_[s].map; return *this; }
+            sharded&            operator=(sharded&& other)                              { swap(other); return *this; }
+
+            iterator            begin()                                                 { iterator it(this, 0, shards_[0].map.begin()); it.skip_empty(); return it; }
+            iterator            end()                                                   { return iterator(); }
+            const_iterator      begin() const                                           { const_iterator it(this, 0, shards_[0].map.begin()); it.skip_empty(); return it; }
+            const_iterator      end() const                                             { return const_iterator(); }
+
+            size_t              size() const                                            { size_t n = 0; for (auto& s : shards_) n += s.map.size(); return n; }
+            bool                empty() const                                           { return size() == 0; }
+            void                clear()                                                 { for (auto& s : shards_) s.map.clear(); }
+            void                swap(sharded& other)                                    { for (size_t s = 0; s < n_shards; ++s) shards_[s].map.swap(other.shards_[s].map); }
+
+            iterator            find(const key_type& k)                                 { size_t s = shard(k); Lock lock(shards_[s].m); auto it = shards_[s].map.find(k); return it == shards_[s].map.end() ? end() : iterator(this, s, it); }
+            const_iterator      find(const key_type& k) const                           { size_t s = shard(k); Lock lock(shards_[s].m); auto it = shards_[s].map.find(k); return it == shards_[s].map.end() ? end() : const_iterator(this, s, it); }
+            size_t              count(const key_type& k) const                          { size_t s = shard(k); Lock lock(shards_[s].m); return shards_[s].map.count(k); }
+
+            template<class... Args>
+            std::pair<iterator,bool>
+                                emplace(Args&&... args)                                 { return insert(value_type(std::forward<Args>(args)...)); }
+            std::pair<iterator,bool>
+                                insert(value_type&& x)                                  { size_t s = shard(key_of(x)); Lock lock(shards_[s].m); auto r = shards_[s].map.insert(std::move(x)); return { iterator(this, s, r.first), r.second }; }
+            std::pair<iterator,bool>
+                                insert(const value_type& x)                             { return insert(value_type(x)); }
+            template<class Iterator>
+            void                insert(Iterator first, Iterator last)                   { for (; first != last; ++first) insert(*first); }
+
+            template<class I = Inner>
+            typename I::mapped_type&
+                                operator[](const key_type& k)                           { size_t s = shard(k); Lock lock(shards_[s].m); return shards_[s].map[k]; }
+            template<class I = Inner>
+            const typename I::mapped_type&
+                                at(const key_type& k) const                             { size_t s = shard(k); Lock lock(shards_[s].m); return shards_[s].map.at(k); }
+
+            size_t              erase(const key_type& k)                                { return shards_[shard(k)].map.erase(k); }
+            iterator            erase(const_iterator it)                                { iterator next(this, it.s_, shards_[it.s_].map.erase(it.it_)); next.skip_empty(); return next; }
+
+            // direct access to the shards, e.g., to iterate over them in parallel
+            Inner&              shard_map(size_t s)                                     { return shards_[s].map; }
+            const Inner&        shard_map(size_t s) const                               { return shards_[s].map; }
+
+        private:
+            using Lock = std::lock_guard<spin_mutex>;
+
+            struct Shard
+            {
+                mutable spin_mutex  m;
+                Inner               map;
+            };
+
+            static size_t       shard(const key_type& k)                                { return (size_t(hasher()(k)) * 0x9E3779B97F4A7C15ull) >> (64 - shard_bits); }
+
+            static const key_type&
+                                key_of(const key_type& k)                               { return k; }
+            template<class T>
+            static const key_type&
+                                key_of(const std::pair<const key_type, T>& x)           { return x.first; }
+
+        private:
+            Shard               shards_[n_shards];
+    };
+
+    template<class Inner>
+    void                swap(sharded<Inner>& x, sharded<Inner>& y)                      { x.swap(y); }
+}
+}
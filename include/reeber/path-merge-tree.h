@@ -26,7 +26,7 @@ struct PathMergeTreeNode
     Vertex                      vertex;
     Value                       value;
     atomic<Neighbor>            parent;
-#ifndef REEBER_USE_TBB
+#if !defined(REEBER_USE_TBB) && !defined(REEBER_USE_THREADS)
     std::vector<Neighbor>       children;
 #endif
 };
@@ -29,7 +29,7 @@ merge(Neighbor u, Neighbor v)
             u = up;
         else if (compare_exchange(u->parent, up, v))
         {
-#ifndef REEBER_USE_TBB
+#if !defined(REEBER_USE_TBB) && !defined(REEBER_USE_THREADS)
             auto it = std::find(up->children.begin(), up->children.end(), u);
             if (it != up->children.end())
                 up->children.erase(it);
@@ -92,7 +92,7 @@ compute_merge_tree2(PathMergeTree<Vertex, Value>& mt, const Topology& topology,
             Neighbor v = mt[b];
             mt.merge(u, v);
         }
-#ifndef REEBER_USE_TBB
+#if !defined(REEBER_USE_TBB) && !defined(REEBER_USE_THREADS)
         if (u->children.size() == 1)   // degree-2 node
         {
             // collapse node down
@@ -0,0 +1,201 @@
+#ifndef REEBER_RADIX_SORT_H
+#define REEBER_RADIX_SORT_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+
+#include "parallel-tbb.h"
+
+namespace reeber
+{
+
+namespace detail
+{
+    // unsigned integer whose order matches the order of T
+    template<class T, class Enable = void>
+    struct RadixKey
+    {
+        static constexpr bool   enabled = false;
+    };
+
+    template<class T>
+    struct RadixKey<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+    {
+        static constexpr bool   enabled = true;
+        using                   Key     = typename std::make_unsigned<T>::type;
+
+        static constexpr Key    sign    = std::is_signed<T>::value ? Key(Key(1) << (8*sizeof(Key) - 1)) : Key(0);
+
+        static Key              key(T x)            { return Key(x) ^ sign; }
+        static T                value(Key k)        { return T(Key(k ^ sign)); }
+    };
+
+    template<class T>
+    struct RadixKey<T, typename std::enable_if<std::is_floating_point<T>::value && (sizeof(T) == 4 || sizeof(T) == 8)>::type>
+    {
+        static constexpr bool   enabled = true;
+        using                   Key     = typename std::conditional<sizeof(T) == 4, std::uint32_t, std::uint64_t>::type;
+
+        static constexpr Key    sign    = Key(1) << (8*sizeof(Key) - 1);
+
+        // flip all the bits of negative numbers, only the sign bit of positive ones;
+        // -0 becomes 0, since the two compare equal
+        static Key              key(T x)            { if (x == 0) x = 0; Key k; std::memcpy(&k, &x, sizeof(T)); return (k & sign) ? Key(~k) : Key(k | sign); }
+        static T                value(Key k)        { k = (k & sign) ? Key(k ^ sign) : Key(~k); T x; std::memcpy(&x, &k, sizeof(T)); return x; }
+    };
+
+    template<class Value, class Vertex>
+    struct can_radix_sort
+    {
+        static constexpr bool   value = RadixKey<Value>::enabled && RadixKey<Vertex>::enabled;
+    };
+
+    // one stable counting pass over the digit of the keys given by digit_of, from in to out;
+    // the chunks are histogrammed and scattered in parallel
+    template<class T, class DigitOf>
+    void radix_pass(const std::vector<T>& in, std::vector<T>& out, const DigitOf& digit_of, size_t n_buckets, size_t n_chunks)
+    {
+        size_t n     = in.size();
+        size_t chunk = (n + n_chunks - 1) / n_chunks;
+
+        std::vector<size_t> counts(n_chunks * n_buckets, 0);
+        for_each(0, n_chunks, [&](size_t c)
+        {
+            size_t* cnt = &counts[c * n_buckets];
+            for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i)
+                ++cnt[digit_of(in[i])];
+        });
+
+        // exclusive prefix sum in (bucket, chunk) order, so the pass stays stable
+        size_t total = 0;
+        for (size_t b = 0; b < n_buckets; ++b)
+            for (size_t c = 0; c < n_chunks; ++c)
+            {
+                size_t x = counts[c * n_buckets + b];
+                counts[c * n_buckets + b] = total;
+                total += x;
+            }
+
+        for_each(0, n_chunks, [&](size_t c)
+        {
+            size_t* offset = &counts[c * n_buckets];
+            for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i)
+                out[offset[digit_of(in[i])]++] = in[i];
+        });
+    }
+
+    template<class Value, class Vertex>
+    void radix_sort(std::vector<std::pair<Value,Vertex>>& vertices, bool descending)
+    {
+        using ValueKey      = RadixKey<Value>;
+        using VertexKey     = RadixKey<Vertex>;
+        using VK            = typename ValueKey::Key;
+        using XK            = typename VertexKey::Key;
+
+        struct Keys { VK value; XK vertex; };
+
+        size_t n = vertices.size();
+        if (n < 2)
+            return;
+
+        // wide digits mean fewer passes over memory, but their histograms only pay off on large inputs
+        unsigned bits       = n >= (size_t(1) << 20) ? 16 : 8;
+        size_t   n_buckets  = size_t(1) << bits;
+        size_t   n_chunks   = std::max<size_t>(1, std::min<size_t>(8, n >> 20));
+        size_t   chunk      = (n + n_chunks - 1) / n_chunks;
+
+        // descending order is ascending order of the complemented keys
+        VK vflip = descending ? VK(~VK(0)) : VK(0);
+        XK xflip = descending ? XK(~XK(0)) : XK(0);
+
+        std::vector<Keys> keys(n), buffer(n);
+        for_each(0, n_chunks, [&](size_t c)
+        {
+            for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i)
+                keys[i] = Keys { VK(ValueKey::key(vertices[i].first) ^ vflip), XK(VertexKey::key(vertices[i].second) ^ xflip) };
+        });
+
+        // skip the digits that are the same in all keys (e.g., high bytes of vertex ids)
+        VK vdiff = 0;
+        XK xdiff = 0;
+        bool vertices_sorted = true, vertices_reversed = true;
+        for (size_t i = 1; i < n; ++i)
+        {
+            vdiff |= keys[i].value  ^ keys[0].value;
+            xdiff |= keys[i].vertex ^ keys[0].vertex;
+            vertices_sorted   &= keys[i-1].vertex <= keys[i].vertex;
+            vertices_reversed &= keys[i-1].vertex >= keys[i].vertex;
+        }
+
+        // vertices come in order from the topology; with negate, they're in the opposite order
+        if (!vertices_sorted && vertices_reversed)
+        {
+            std::reverse(keys.begin(), keys.end());
+            vertices_sorted = true;
+        }
+
+        std::vector<Keys>* in  = &keys;
+        std::vector<Keys>* out = &buffer;
+
+        // vertex is the tiebreak, so it goes first (vertices usually come in order, then it's free)
+        size_t mask = n_buckets - 1;
+        if (!vertices_sorted)
+            for (unsigned shift = 0; shift < 8*sizeof(XK); shift += bits)
+            {
+                if (!((xdiff >> shift) & mask)) continue;
+                radix_pass(*in, *out, [shift,mask](const Keys& k) { return (k.vertex >> shift) & mask; }, n_buckets, n_chunks);
+                std::swap(in, out);
+            }
+
+        for (unsigned shift = 0; shift < 8*sizeof(VK); shift += bits)
+        {
+            if (!((vdiff >> shift) & mask)) continue;
+            radix_pass(*in, *out, [shift,mask](const Keys& k) { return (k.value >> shift) & mask; }, n_buckets, n_chunks);
+            std::swap(in, out);
+        }
+
+        const std::vector<Keys>& sorted = *in;
+        for_each(0, n_chunks, [&](size_t c)
+        {
+            for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i)
+                vertices[i] = std::make_pair(ValueKey::value(VK(sorted[i].value ^ vflip)), VertexKey::value(XK(sorted[i].vertex ^ xflip)));
+        });
+    }
+
+    template<class Value, class Vertex>
+    void sort_value_vertex(std::vector<std::pair<Value,Vertex>>& vertices, bool descending, std::true_type)
+    {
+        radix_sort(vertices, descending);
+    }
+
+    template<class Value, class Vertex>
+    void sort_value_vertex(std::vector<std::pair<Value,Vertex>>& vertices, bool descending, std::false_type)
+    {
+        using ValueVertex = std::pair<Value,Vertex>;
+        if (descending)
+            std::sort(vertices.begin(), vertices.end(), std::greater<ValueVertex>());
+        else
+            std::sort(vertices.begin(), vertices.end(), std::less<ValueVertex>());
+    }
+}
+
+/**
+ * Sorts (value, vertex) pairs lexicographically, ascending or descending.
+ * Uses LSD radix sort when both are arithmetic (vertex ids, float/double
+ * values), std::sort otherwise (e.g., for AmrVertexId). NaN values are not
+ * supported (neither are they by std::sort).
+ */
+template<class Value, class Vertex>
+void sort_value_vertex(std::vector<std::pair<Value,Vertex>>& vertices, bool descending)
+{
+    detail::sort_value_vertex(vertices, descending, std::integral_constant<bool, detail::can_radix_sort<Value,Vertex>::value>());
+}
+
+}
+
+#endif
@@ -1,47 +1,181 @@
 #ifndef REEBER_TRIPLET_MERGE_TREE_SERIALIZATION_H
 #define REEBER_TRIPLET_MERGE_TREE_SERIALIZATION_H
 
+#include <type_traits>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
 #include <diy/serialization.hpp>
 #include "parallel-tbb.h"
 #include "parallel-tbb-serialization.h"
 #include "triplet-merge-tree.h"
+#include "vertex-codec.h"
 #include "range/map.h"
 
 namespace reeber
 {
 
-template<class Vertex, class Value>
-struct Serialization< TripletMergeTree<Vertex, Value> >
+template<class Vertex, class Value, class Aggregate>
+struct Serialization< TripletMergeTree<Vertex, Value, Aggregate> >
 {
-    typedef     ::reeber::TripletMergeTree<Vertex, Value>          TripletMergeTree;
+    typedef     ::reeber::TripletMergeTree<Vertex, Value, Aggregate>   TripletMergeTree;
     typedef     typename TripletMergeTree::Neighbor                Neighbor;
+    typedef     typename TripletMergeTree::ValueVertex             ValueVertex;
+    typedef     typename TripletMergeTree::VerticesRun             VerticesRun;
+    typedef     typename TripletMergeTree::VerticesVector          VerticesVector;
+
+    // first byte of the format: 0 or 1 is the save_vertices flag of the original format
+    static constexpr unsigned char  compact_format = 2;
 
+    /**
+     * Compact format: the nodes are listed once, sorted by vertex (which
+     * VertexCodec turns into small deltas); parents are varint indices into
+     * that list, so load() rebuilds the tree without looking anything up.
+     * load() puts the nodes straight into the given tree, which need not be
+     * empty, so a received tree can be merged without an intermediate copy.
+     * The aggregates come next, also without the vertices (they already
+     * include those of the dropped nodes, see sparsify). The collapsed
+     * vertices of all nodes go last, as one contiguous block.
+     */
     static void save(::diy::BinaryBuffer& bb, const TripletMergeTree& mt, bool save_vertices = true)
     {
+        unsigned char format = compact_format;
+        diy::save(bb, format);
         diy::save(bb, save_vertices);
         diy::save(bb, mt.negate_);
-        size_t sz = mt.nodes_.size();
+
+        std::vector<Neighbor> nodes;
+        nodes.reserve(mt.nodes_.size());
+        for (auto& x : mt.nodes_)
+            if (x.first == x.second->vertex)          // skip stale entries of removed vertices
+                nodes.push_back(x.second);
+        std::sort(nodes.begin(), nodes.end(), [](Neighbor x, Neighbor y) { return x->vertex < y->vertex; });
+
+        size_t sz = nodes.size();
         diy::save(bb, sz);
-        for(Neighbor n : mt.nodes_ | range::map_values)
+
+        auto index = [&nodes](Neighbor x) -> size_t
+        {
+            auto it = std::lower_bound(nodes.begin(), nodes.end(), x, [](Neighbor y, Neighbor x) { return y->vertex < x->vertex; });
+            if (it == nodes.end() || (*it)->vertex != x->vertex)
+                throw std::runtime_error("Serialization<TripletMergeTree>: parent is not a node of the tree");
+            return it - nodes.begin();
+        };
+
+        detail::VarintWriter out;
+        save_vertices_(bb, out, nodes, std::integral_constant<bool, VertexCodec<Vertex>::enabled>());
+        for (Neighbor n : nodes)
         {
-            diy::save(bb, n->vertex);
-            diy::save(bb, n->value);
             Neighbor s, v;
             std::tie(s, v) = n->parent();
-            diy::save(bb, s->vertex);
-            diy::save(bb, v->vertex);
+            out.put(index(s));
+            out.put(index(v));
             if (save_vertices)
-                diy::save(bb, n->vertices);
+                out.put(n->vertices.size());
         }
+        save_bytes(bb, out);
+
+        save_values(bb, nodes, std::integral_constant<bool, std::is_trivially_copyable<Value>::value>());
+
+        for (Neighbor n : nodes)
+            diy::save(bb, n->aggregate());
+
+        if (save_vertices)
+            for (Neighbor n : nodes)
+                save_vertices_run(bb, n->vertices, std::integral_constant<bool, std::is_trivially_copyable<ValueVertex>::value>());
     }
 
     static void load(::diy::BinaryBuffer& bb, TripletMergeTree& mt)
     {
+        unsigned char format;
+        diy::load(bb, format);
+        if (format < compact_format)
+        {
+            load_legacy(bb, mt, format);
+            return;
+        }
+        if (format != compact_format)
+            throw std::runtime_error("Serialization<TripletMergeTree>: unknown format");
+
         bool load_vertices;
         diy::load(bb, load_vertices);
         diy::load(bb, mt.negate_);
         size_t sz;
         diy::load(bb, sz);
+
+        std::vector<Vertex> vertices(sz);
+        std::vector<Value>  values(sz);
+        std::vector<size_t> parents(2*sz), counts(load_vertices ? sz : 0);
+
+        std::vector<unsigned char> bytes;
+        detail::VarintReader in = load_vertices_(bb, bytes, vertices, std::integral_constant<bool, VertexCodec<Vertex>::enabled>());
+        for (size_t i = 0; i < sz; ++i)
+        {
+            parents[2*i]     = in.get();
+            parents[2*i + 1] = in.get();
+            if (load_vertices)
+                counts[i] = in.get();
+        }
+
+        load_values(bb, values, std::integral_constant<bool, std::is_trivially_copyable<Value>::value>());
+
+        // adopt the nodes into mt directly; a vertex it already has keeps its node, parent
+        // and aggregate, as in merge()
+        std::vector<Neighbor>       nodes(sz);
+        std::vector<unsigned char>  adopted(sz);
+        for_each(0, sz, [&](size_t i)
+        {
+            Neighbor n = mt.new_node();
+            n->vertex = vertices[i];
+            n->value = values[i];
+            n->set_deepest(n);
+            auto res = mt.nodes_.emplace(vertices[i], n);
+            adopted[i] = res.second;
+            if (res.second)
+                nodes[i] = n;
+            else
+            {
+                nodes[i] = res.first->second;
+                mt.delete_node(n);
+            }
+        });
+
+        for_each(0, sz, [&](size_t i) { if (adopted[i]) mt.link(nodes[i], nodes[parents[2*i]], nodes[parents[2*i + 1]]); });
+
+        for (size_t i = 0; i < sz; ++i)
+        {
+            Aggregate copy;
+            diy::load(bb, adopted[i] ? nodes[i]->aggregate() : copy);
+        }
+
+        if (!load_vertices)
+            return;
+
+        VerticesVector block(std::accumulate(counts.begin(), counts.end(), size_t(0)));
+        load_vertices_block(bb, block, std::integral_constant<bool, std::is_trivially_copyable<ValueVertex>::value>());
+        const ValueVertex* start = mt.store_vertices(std::move(block));
+        for (size_t i = 0; i < sz; ++i)
+        {
+            if (adopted[i])
+                nodes[i]->vertices = VerticesRun(start, start + counts[i]);
+            start += counts[i];
+        }
+    }
+
+    // the original format: per node, its vertex, value and the vertices of its parents,
+    // followed by its collapsed vertices (if load_vertices); there are no aggregates
+    static void load_legacy(::diy::BinaryBuffer& bb, TripletMergeTree& mt, bool load_vertices)
+    {
+        diy::load(bb, mt.negate_);
+        size_t sz;
+        diy::load(bb, sz);
+
+        std::vector<std::pair<Neighbor, size_t>> runs;
+        VerticesVector block;
+        if (load_vertices)
+            runs.reserve(sz);
+
         for (size_t i = 0; i < sz; ++i)
         {
             Vertex u, s, v; Value val;
@@ -58,9 +192,125 @@ struct Serialization< TripletMergeTree<Vertex, Value> >
             mt.link(n_u, n_s, n_v);
 
             if (load_vertices)
-                diy::load(bb, n_u->vertices);
+            {
+                VerticesVector vertices;
+                diy::load(bb, vertices);
+                runs.emplace_back(n_u, vertices.size());
+                block.insert(block.end(), vertices.begin(), vertices.end());
+            }
+        }
+
+        if (!load_vertices)
+            return;
+
+        const ValueVertex* start = mt.store_vertices(std::move(block));
+        for (auto& run : runs)
+        {
+            run.first->vertices = VerticesRun(start, start + run.second);
+            start += run.second;
         }
     }
+
+    static void save_bytes(::diy::BinaryBuffer& bb, const detail::VarintWriter& out)
+    {
+        diy::save(bb, out.bytes.size());
+        bb.save_binary(reinterpret_cast<const char*>(out.bytes.data()), out.bytes.size());
+    }
+
+    static void load_bytes(::diy::BinaryBuffer& bb, std::vector<unsigned char>& bytes)
+    {
+        size_t n;
+        diy::load(bb, n);
+        bytes.resize(n);
+        bb.load_binary(reinterpret_cast<char*>(bytes.data()), n);
+    }
+
+    static void save_vertices_(::diy::BinaryBuffer&, detail::VarintWriter& out, const std::vector<Neighbor>& nodes, std::true_type)
+    {
+        Vertex prev = Vertex();
+        for (Neighbor n : nodes)
+        {
+            VertexCodec<Vertex>::encode(out, prev, n->vertex);
+            prev = n->vertex;
+        }
+    }
+
+    static void save_vertices_(::diy::BinaryBuffer& bb, detail::VarintWriter&, const std::vector<Neighbor>& nodes, std::false_type)
+    {
+        for (Neighbor n : nodes)
+            diy::save(bb, n->vertex);
+    }
+
+    // returns the reader of the byte block, positioned after the vertices
+    static detail::VarintReader
+                load_vertices_(::diy::BinaryBuffer& bb, std::vector<unsigned char>& bytes, std::vector<Vertex>& vertices, std::true_type)
+    {
+        load_bytes(bb, bytes);
+        detail::VarintReader in(bytes.data());
+        Vertex prev = Vertex();
+        for (Vertex& x : vertices)
+        {
+            VertexCodec<Vertex>::decode(in, prev, x);
+            prev = x;
+        }
+        return in;
+    }
+
+    static detail::VarintReader
+                load_vertices_(::diy::BinaryBuffer& bb, std::vector<unsigned char>& bytes, std::vector<Vertex>& vertices, std::false_type)
+    {
+        for (Vertex& x : vertices)
+            diy::load(bb, x);
+        load_bytes(bb, bytes);
+        return detail::VarintReader(bytes.data());
+    }
+
+    static void save_values(::diy::BinaryBuffer& bb, const std::vector<Neighbor>& nodes, std::true_type)
+    {
+        std::vector<Value> values(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i)
+            values[i] = nodes[i]->value;
+        bb.save_binary(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(Value));
+    }
+
+    static void save_values(::diy::BinaryBuffer& bb, const std::vector<Neighbor>& nodes, std::false_type)
+    {
+        for (Neighbor n : nodes)
+            diy::save(bb, n->value);
+    }
+
+    static void load_values(::diy::BinaryBuffer& bb, std::vector<Value>& values, std::true_type)
+    {
+        bb.load_binary(reinterpret_cast<char*>(values.data()), values.size() * sizeof(Value));
+    }
+
+    static void load_values(::diy::BinaryBuffer& bb, std::vector<Value>& values, std::false_type)
+    {
+        for (Value& x : values)
+            diy::load(bb, x);
+    }
+
+    static void save_vertices_run(::diy::BinaryBuffer& bb, const VerticesRun& vertices, std::true_type)
+    {
+        bb.save_binary(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(ValueVertex));
+    }
+
+    static void save_vertices_run(::diy::BinaryBuffer& bb, const VerticesRun& vertices, std::false_type)
+    {
+        for (const ValueVertex& x : vertices)
+            diy::save(bb, x);
+    }
+
+    static void load_vertices_block(::diy::BinaryBuffer& bb, VerticesVector& block, std::true_type)
+    {
+        bb.load_binary(reinterpret_cast<char*>(block.data()), block.size() * sizeof(ValueVertex));
+    }
+
+    static void load_vertices_block(::diy::BinaryBuffer& bb, VerticesVector& block, std::false_type)
+    {
+        for (ValueVertex& x : block)
+            diy::load(bb, x);
+    }
 };
 
 }
@@ -69,10 +319,18 @@ struct Serialization< TripletMergeTree<Vertex, Value> >
 namespace diy
 {
 
-template<class Vertex, class Value>
-struct Serialization< ::reeber::TripletMergeTree<Vertex, Value> >
+// nothing to write for the default aggregate
+template<>
+struct Serialization< ::reeber::NoAggregate >
+{
+    static void save(BinaryBuffer&, const ::reeber::NoAggregate&)     {}
+    static void load(BinaryBuffer&, ::reeber::NoAggregate&)           {}
+};
+
+template<class Vertex, class Value, class Aggregate>
+struct Serialization< ::reeber::TripletMergeTree<Vertex, Value, Aggregate> >
 {
-    typedef     ::reeber::TripletMergeTree<Vertex, Value>              TripletMergeTree;
+    typedef     ::reeber::TripletMergeTree<Vertex, Value, Aggregate>   TripletMergeTree;
 
     static void save(BinaryBuffer& bb, const TripletMergeTree& mt)     { ::reeber::Serialization<TripletMergeTree>::save(bb, mt, true); }
     static void load(BinaryBuffer& bb, TripletMergeTree& mt)           { ::reeber::Serialization<TripletMergeTree>::load(bb, mt); }
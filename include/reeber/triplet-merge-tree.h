@@ -3,31 +3,167 @@
 
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <tuple>
 #include <set>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
 
 #include "parallel-tbb.h"
+#include "node-arena.h"
+
+#include "range/utility.h"
 
 #include "serialization.h"
 #include "format.h"
 
 namespace reeber
 {
-template<class Vertex_, class Value_>
-struct TripletMergeTreeNode
+
+/**
+ * Per-node aggregate: by default nodes carry nothing. A user-defined
+ * Aggregate must be default-constructible (the identity) and combine
+ * associatively with operator+= (e.g., cell count, sums of extra fields,
+ * bounding box, moments). A node's aggregate covers its own vertex and the
+ * vertices collapsed into it. The nodes that remove_degree_two, sparsify and
+ * simplify drop fold their aggregates into the node they collapse into (the
+ * first remaining one down their chain of parents), so every component keeps
+ * its total, also in the trees sent without vertices. A vertex found in both
+ * trees of merge() (or in a tree loaded into another) is a copy: it keeps one
+ * aggregate, the copies are not added up.
+ */
+struct NoAggregate
+{
+    NoAggregate&                operator+=(const NoAggregate&)                          { return *this; }
+};
+
+namespace detail
+{
+    template<class Aggregate>
+    struct NodeAggregate
+    {
+        Aggregate&              aggregate()                                             { return aggregate_; }
+        const Aggregate&        aggregate() const                                       { return aggregate_; }
+
+        Aggregate               aggregate_;
+    };
+
+    // empty base, so that the default nodes don't grow
+    template<>
+    struct NodeAggregate<NoAggregate>: public NoAggregate
+    {
+        NoAggregate&            aggregate()                                             { return *this; }
+        const NoAggregate&      aggregate() const                                       { return *this; }
+    };
+
+    template<class F>
+    struct AggregateWith
+    {
+        F                       f;
+    };
+
+    // run of a contiguous array owned by the tree
+    template<class T>
+    struct Run: public range::iterator_range<const T*>
+    {
+        using Parent = range::iterator_range<const T*>;
+
+                                Run(const T* b = nullptr, const T* e = nullptr):
+                                    Parent(b, e)                                        {}
+
+        size_t                  size() const                                            { return this->end_ - this->begin_; }
+        bool                    empty() const                                           { return this->begin_ == this->end_; }
+        const T*                data() const                                            { return this->begin_; }
+        const T&                operator[](size_t i) const                              { return this->begin_[i]; }
+    };
+
+    // Set of tree vertices, filled concurrently while walking the parent
+    // chains in remove_degree_two and sparsify. Only vertices of the tree
+    // may be inserted. This is the fallback for sparse ids (e.g., AmrVertexId).
+    template<class Vertex, class Enable = void>
+    class KeepSet
+    {
+        public:
+            template<class Nodes>
+                        KeepSet(const Nodes&)                                           {}
+
+            void        insert(const Vertex& v)                                         { set_.insert(v); }
+            bool        contains(const Vertex& v) const                                 { return set_.find(v) != set_.end(); }
+
+        private:
+            set<Vertex>                 set_;
+    };
+
+    // integral ids that are dense among the tree's vertices (e.g., grid
+    // indices within a block) get a flat marker array indexed by v - min
+    template<class Vertex>
+    class KeepSet<Vertex, typename std::enable_if<std::is_integral<Vertex>::value>::type>
+    {
+        public:
+            static constexpr size_t     max_spread = 8;         // markers per node, before giving up on the array
+
+            template<class Nodes>
+                        KeepSet(const Nodes& nodes)
+            {
+                if (nodes.empty())
+                    return;
+
+                min_ = max_ = std::begin(nodes)->first;
+                for (auto& x : nodes)
+                {
+                    min_ = std::min(min_, x.first);
+                    max_ = std::max(max_, x.first);
+                }
+
+                size_t spread = size_t(max_ - min_) + 1;
+                if (spread <= max_spread * nodes.size())
+                    marks_.reset(new atomic<unsigned char>[spread]());
+            }
+
+            void        insert(const Vertex& v)                                         { if (marks_) marks_[size_t(v - min_)] = 1; else set_.insert(v); }
+            bool        contains(const Vertex& v) const
+            {
+                if (!marks_)
+                    return set_.find(v) != set_.end();
+                return v >= min_ && v <= max_ && marks_[size_t(v - min_)];
+            }
+
+        private:
+            Vertex                                      min_ = 0, max_ = 0;
+            std::unique_ptr<atomic<unsigned char>[]>    marks_;
+            set<Vertex>                                 set_;
+    };
+}
+
+// aggregate_of(vertex, value) gives the aggregate of a single vertex; see compute_merge_tree2
+template<class F>
+detail::AggregateWith<F>        aggregate_with(const F& aggregate_of)                   { return { aggregate_of }; }
+
+template<class Vertex_, class Value_, class Aggregate_ = NoAggregate>
+struct TripletMergeTreeNode: public detail::NodeAggregate<Aggregate_>
 {
     typedef                     Vertex_                         Vertex;
     typedef                     Value_                          Value;
+    typedef                     Aggregate_                      Aggregate;
 
     typedef                     std::pair<Value, Vertex>        ValueVertex;
     typedef                     std::vector<ValueVertex>        VerticesVector;
+    typedef                     detail::Run<ValueVertex>        VerticesRun;
 
     typedef                     TripletMergeTreeNode*           Neighbor;
+#ifdef REEBER_COMPACT_PARENT
+    // (through, to) as a pair of 32-bit node ids (see NodeArena) packed into one word
+    typedef                     std::uint32_t                   Id;
+    typedef                     std::uint64_t                   Parent;
+#else
     struct Parent
     {
         Neighbor    through;
         Neighbor    to;
     };
+#endif
 
     bool                        operator< (const TripletMergeTreeNode& other) const     { return std::tie(value, vertex) <  std::tie(other.value, other.vertex); }
     bool                        operator<=(const TripletMergeTreeNode& other) const     { return std::tie(value, vertex) <= std::tie(other.value, other.vertex); }
@@ -37,44 +173,76 @@ struct TripletMergeTreeNode
     bool                        operator==(const TripletMergeTreeNode& other) const     { return std::tie(vertex, value) == std::tie(other.vertex, other.value); }
     bool                        operator!=(const TripletMergeTreeNode& other) const     { return !(*this == other); }
 
+#ifdef REEBER_COMPACT_PARENT
+    std::tuple<Neighbor, Neighbor>
+                                parent() const                                          { Parent p = parent_; return std::make_tuple(node(Id(p >> 32)), node(Id(p))); }
+    static Parent               make_parent(Neighbor s, Neighbor v)                     { return (Parent(s->id) << 32) | Parent(v->id); }
+    static Neighbor             node(Id id)                                             { return NodeArena<TripletMergeTreeNode>::pointer(id); }
+
+    Neighbor                    deepest() const                                         { return node(cur_deepest_); }
+    void                        set_deepest(Neighbor d)                                 { cur_deepest_ = d->id; }
+#else
     std::tuple<Neighbor, Neighbor>
                                 parent() const                                          { Parent p = parent_; return std::make_tuple(p.through, p.to); }
     static Parent               make_parent(Neighbor s, Neighbor v)                     { return { s, v }; }
 
+    Neighbor                    deepest() const                                         { return cur_deepest_; }
+    void                        set_deepest(Neighbor d)                                 { cur_deepest_ = d; }
+#endif
+
     Vertex                      vertex;
     Value                       value;
+#ifdef REEBER_COMPACT_PARENT
+    // the deepest node is an id too: the two ids share a word, where a lone id would only leave padding
+    Id                          id;
+    Id                          cur_deepest_;
+#endif
     atomic<Parent>              parent_;
-    Neighbor                    cur_deepest;
-    VerticesVector              vertices;
+#ifndef REEBER_COMPACT_PARENT
+    Neighbor                    cur_deepest_;
+#endif
+    VerticesRun                 vertices;           // collapsed vertices, sorted in the sweep order
 
     friend std::ostream&        operator<<(std::ostream& os, const TripletMergeTreeNode& n) { os << "Node(vertex = " << n.vertex  << ", value = " << n.value << ")"; return os; }
 
 };
 
-template<class Vertex_, class Value_>
+#ifdef REEBER_COMPACT_PARENT
+static_assert(sizeof(void*) != 8 || sizeof(TripletMergeTreeNode<std::uint64_t, double>) == 48, "compact-parent nodes should be a word smaller than the 56 bytes with pointers");
+#endif
+
+template<class Vertex_, class Value_, class Aggregate_ = NoAggregate>
 class TripletMergeTree
 {
     public:
         typedef     Vertex_                             Vertex;
         typedef     Value_                              Value;
+        typedef     Aggregate_                          Aggregate;
 
-        typedef     TripletMergeTreeNode<Vertex,Value>  Node;
+        typedef     TripletMergeTreeNode<Vertex,Value,Aggregate>
+                                                        Node;
         typedef     typename Node::Neighbor             Neighbor;
+        typedef     typename Node::ValueVertex          ValueVertex;
+        typedef     typename Node::VerticesVector       VerticesVector;
+        typedef     typename Node::VerticesRun          VerticesRun;
 
         typedef     map<Vertex, Neighbor>               VertexNeighborMap;
 
     public:
                     TripletMergeTree(bool negate = false):
-                        negate_(negate)                 {}
-                    ~TripletMergeTree()                 { for (auto n : nodes_) delete_node(n.second); }
+                        negate_(negate),
+                        arena_(new NodeArena<Node>)     {}
+                    // destroy the live nodes; the arena releases their memory in bulk
+                    ~TripletMergeTree()                 { if (!std::is_trivially_destructible<Node>::value) for (auto n : nodes_) n.second->~Node(); }
 
         // It's Ok to move the tree; it's not Ok to copy it (because of the dynamically allocated nodes)
                     TripletMergeTree(const TripletMergeTree&)   =delete;
         TripletMergeTree&
                     operator=(const TripletMergeTree&)          =delete;
-                    TripletMergeTree(TripletMergeTree&&)        =default;
+                    TripletMergeTree(TripletMergeTree&& other):
+                        TripletMergeTree(other.negate_)         { swap(other); }
         TripletMergeTree&
-                    operator=(TripletMergeTree&&)               =default;
+                    operator=(TripletMergeTree&& other)         { swap(other); return *this; }
 
         std::tuple<Neighbor,Neighbor>
                     repair(const Neighbor u);
@@ -97,7 +265,7 @@ class TripletMergeTree
 
         bool        contains(const Vertex& x) const     { return nodes_.find(x) != nodes_.end(); }
 
-        void        swap(TripletMergeTree& other)       { std::swap(negate_, other.negate_); nodes_.swap(other.nodes_); }
+        void        swap(TripletMergeTree& other)       { std::swap(negate_, other.negate_); nodes_.swap(other.nodes_); arena_.swap(other.arena_); vertex_blocks_.swap(other.vertex_blocks_); }
 
         bool        negate() const                      { return negate_; }
         void        set_negate(bool negate)             { negate_ = negate; }
@@ -112,96 +280,161 @@ class TripletMergeTree
 
         friend struct ::reeber::Serialization<TripletMergeTree>;
 
-        Neighbor    new_node()                          { Neighbor p = alloc_.allocate(1); alloc_.construct(p); return p; }
-        void        delete_node(Neighbor p)             { alloc_.destroy(p); alloc_.deallocate(p,1); }
+#ifdef REEBER_COMPACT_PARENT
+        Neighbor    new_node()                          { typename Node::Id id; Neighbor p = arena_->allocate(id); p->id = id; return p; }
+        void        delete_node(Neighbor p)             { arena_->deallocate(p, p->id); }
+#else
+        Neighbor    new_node()                          { return arena_->allocate(); }
+        void        delete_node(Neighbor p)             { arena_->deallocate(p); }
+#endif
 
         // return total number of vertices in all nodes
         size_t      n_vertices_total() const;
 
+        // takes over a block of collapsed vertices; the nodes' runs may then point into it
+        const ValueVertex*
+                    store_vertices(VerticesVector&& block)  { vertex_blocks_.emplace_back(std::move(block)); return vertex_blocks_.back().data(); }
+
     private:
         VertexNeighborMap& nodes()                      { return nodes_; }
 
-        template<class Vert, class Val, class T, class F>
+        template<class Vert, class Val, class Agg, class T, class F>
         friend void
-        compute_merge_tree(TripletMergeTree<Vert, Val>& mt, const T& t, const F& f);
+        compute_merge_tree(TripletMergeTree<Vert, Val, Agg>& mt, const T& t, const F& f);
 
-        template<class Vert, class Val, class S>
+        template<class Vert, class Val, class Agg, class S>
         friend void
-        remove_degree_two(TripletMergeTree<Vert, Val>& mt, const S& s);
+        remove_degree_two(TripletMergeTree<Vert, Val, Agg>& mt, const S& s);
 
-        template<class Vertex, class Value>
+        template<class Vert, class Val, class Agg>
         friend void
-        repair(TripletMergeTree<Vertex, Value>& mt);
+        repair(TripletMergeTree<Vert, Val, Agg>& mt);
 
-        template<class Vert, class Val, class T, class F>
+        template<class Vert, class Val, class Agg, class T, class F>
         friend void
-        compute_merge_tree2(TripletMergeTree<Vert, Val>& mt, const T& t, const F& f);
+        compute_merge_tree2(TripletMergeTree<Vert, Val, Agg>& mt, const T& t, const F& f);
 
-        template<class Vert, class Val, class F>
+        template<class Vert, class Val, class Agg, class F>
         friend void
-        traverse_persistence(const TripletMergeTree<Vert, Val>& mt, const F& f);
+        traverse_persistence(const TripletMergeTree<Vert, Val, Agg>& mt, const F& f);
 
-        template<class Vert, class Val, class S>
-        friend set<Vert>
-        sparsify_keep(TripletMergeTree<Vert, Val>& mt, const S& s);
+        template<class Vert, class Val, class Agg, class S>
+        friend detail::KeepSet<Vert>
+        sparsify_keep(TripletMergeTree<Vert, Val, Agg>& mt, const S& s);
 
-        template<class Vert, class Val, class S>
+        template<class Vert, class Val, class Agg, class S>
         friend void
-        sparsify(TripletMergeTree<Vert, Val>& out, TripletMergeTree<Vert, Val>& in, const S& s);
+        sparsify(TripletMergeTree<Vert, Val, Agg>& out, TripletMergeTree<Vert, Val, Agg>& in, const S& s);
 
-        template<class Vert, class Val, class S>
+        template<class Vert, class Val, class Agg, class S>
         friend void
-        sparsify(TripletMergeTree<Vert, Val>& mt, const S& s);
+        sparsify(TripletMergeTree<Vert, Val, Agg>& mt, const S& s);
+
+        template<class Vert, class Val, class Agg, class S>
+        friend size_t
+        simplify(TripletMergeTree<Vert, Val, Agg>& mt, Val epsilon, const S& s);
 
-        template<class Vert, class Val>
-        friend typename TripletMergeTree<Vert, Val>::Neighbor
-        representative(TripletMergeTree<Vert, Val>& mt, typename TripletMergeTree<Vert, Val>::Neighbor u, typename TripletMergeTree<Vert, Val>::Neighbor a);
+        template<class Vert, class Val, class Agg>
+        friend typename TripletMergeTree<Vert, Val, Agg>::Neighbor
+        representative(TripletMergeTree<Vert, Val, Agg>& mt, typename TripletMergeTree<Vert, Val, Agg>::Neighbor u, typename TripletMergeTree<Vert, Val, Agg>::Neighbor a);
 
-        template<class Vert, class Val, class E>
+        template<class Vert, class Val, class Agg>
         friend void
-        merge(TripletMergeTree<Vert, Val>& mt1, TripletMergeTree<Vert, Val>& mt2, const E& edges, bool ignore_missing_edges);
+        splice(TripletMergeTree<Vert, Val, Agg>& mt1, TripletMergeTree<Vert, Val, Agg>& mt2);
 
     private:
         bool                        negate_;
         VertexNeighborMap           nodes_;
-        allocator<Node>             alloc_;
+        std::unique_ptr<NodeArena<Node>>
+                                    arena_;
+        std::vector<VerticesVector> vertex_blocks_;     // CSR storage for the collapsed vertices of all nodes
 };
 
 /**
  * Topology defines a range vertices() and a link(v) function;
  *          vertices should be allowed to repeat (will simplify uniting multiple trees).
  */
-template<class Vertex, class Value, class Topology, class Function>
-void compute_merge_tree(TripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f);
+template<class Vertex, class Value, class Aggregate, class Topology, class Function>
+void compute_merge_tree(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f);
 
-template<class Vertex, class Value, class Special>
-void remove_degree_two(TripletMergeTree<Vertex, Value>& mt, const Special& special);
+template<class Vertex, class Value, class Aggregate, class Special>
+void remove_degree_two(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Special& special);
 
-template<class Vertex, class Value>
-void repair(TripletMergeTree<Vertex, Value>& mt);
+template<class Vertex, class Value, class Aggregate>
+void repair(TripletMergeTree<Vertex, Value, Aggregate>& mt);
 
-template<class Vertex, class Value, class Topology, class Function>
-void compute_merge_tree2(TripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f);
+template<class Vertex, class Value, class Aggregate, class Topology, class Function>
+void compute_merge_tree2(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f);
 
-template<class Vertex, class Value, class Functor>
-void traverse_persistence(const TripletMergeTree<Vertex, Value>& mt, const Functor& f);
+/**
+ * Threshold variants: only the vertices on the interesting side of the
+ * threshold (f(v) <= threshold, or f(v) >= threshold with negate) become
+ * nodes; edges to the rest of the domain are dropped. Every component of the
+ * sublevel (superlevel) set then ends in its own root, i.e., the root marks
+ * where the component is cut off by the threshold.
+ */
+template<class Vertex, class Value, class Aggregate, class Topology, class Function>
+void compute_merge_tree(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f, typename TripletMergeTree<Vertex, Value, Aggregate>::Value threshold);
+
+template<class Vertex, class Value, class Aggregate, class Topology, class Function>
+void compute_merge_tree2(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f, typename TripletMergeTree<Vertex, Value, Aggregate>::Value threshold);
+
+/**
+ * Same as above, but also sets the aggregate of every node to
+ * aggregate.f(vertex, value), e.g.,
+ *   compute_merge_tree2(mt, topology, f, aggregate_with([&](Vertex v, Value x) { return Mass { 1, x }; }));
+ */
+template<class Vertex, class Value, class Aggregate, class Topology, class Function, class AggregateOf>
+void compute_merge_tree2(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f, const detail::AggregateWith<AggregateOf>& aggregate);
+
+template<class Vertex, class Value, class Aggregate, class Topology, class Function, class AggregateOf>
+void compute_merge_tree2(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f, typename TripletMergeTree<Vertex, Value, Aggregate>::Value threshold, const detail::AggregateWith<AggregateOf>& aggregate);
+
+template<class Vertex, class Value, class Aggregate, class Functor>
+void traverse_persistence(const TripletMergeTree<Vertex, Value, Aggregate>& mt, const Functor& f);
+
+// same as traverse_persistence, but f is called concurrently from multiple threads, in no particular order
+template<class Vertex, class Value, class Aggregate, class Functor>
+void traverse_persistence_parallel(const TripletMergeTree<Vertex, Value, Aggregate>& mt, const Functor& f);
+
+template<class Vertex, class Value, class Aggregate, class Special>
+void sparsify(TripletMergeTree<Vertex, Value, Aggregate>& out, TripletMergeTree<Vertex, Value, Aggregate>& in, const Special& special);
+
+template<class Vertex, class Value, class Aggregate, class Special>
+void sparsify(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Special& special);
+
+/**
+ * Cancels the branches of persistence below epsilon, as if the function were
+ * raised to the saddle there: a minimum that is not special goes away, and its
+ * branch starts at the next node up. Special vertices stay, and so do the
+ * saddles, so the branches carrying them survive (shortened to start at the
+ * lowest one). Pairs of persistence at least epsilon come out the same, also
+ * after merging with the rest of the domain, since more data only makes a
+ * branch shorter. As with sparsify, the cancelled nodes take their collapsed
+ * vertices along, so it's meant for the trees that get sent. Expects a
+ * repaired tree; returns the number of nodes removed.
+ */
+template<class Vertex, class Value, class Aggregate, class Special>
+size_t simplify(TripletMergeTree<Vertex, Value, Aggregate>& mt, Value epsilon, const Special& special);
 
-template<class Vertex, class Value, class Special>
-void sparsify(TripletMergeTree<Vertex, Value>& out, TripletMergeTree<Vertex, Value>& in, const Special& special);
+template<class Vertex, class Value, class Aggregate>
+typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor
+representative(TripletMergeTree<Vertex, Value, Aggregate>& mt, typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor u, typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor a);
 
-template<class Vertex, class Value, class Special>
-void sparsify(TripletMergeTree<Vertex, Value>& mt, const Special& special);
+// moves the nodes of mt2 into mt1 (without copying them), leaving mt2 empty; nothing gets connected
+template<class Vertex, class Value, class Aggregate>
+void splice(TripletMergeTree<Vertex, Value, Aggregate>& mt1, TripletMergeTree<Vertex, Value, Aggregate>& mt2);
 
-template<class Vertex, class Value>
-typename TripletMergeTree<Vertex, Value>::Neighbor
-representative(TripletMergeTree<Vertex, Value>& mt, typename TripletMergeTree<Vertex, Value>::Neighbor u, typename TripletMergeTree<Vertex, Value>::Neighbor a);
+template<class Vertex, class Value, class Aggregate, class Edges>
+void merge(TripletMergeTree<Vertex, Value, Aggregate>& mt1, TripletMergeTree<Vertex, Value, Aggregate>& mt2, const Edges& edges, bool ignore_missing_edges = false);
 
-template<class Vertex, class Value, class Edges>
-void merge(TripletMergeTree<Vertex, Value>& mt1, TripletMergeTree<Vertex, Value>& mt2, const Edges& edges, bool ignore_missing_edges = false);
+// connects the vertices of edges already in the same tree (e.g., after a received tree was loaded into it)
+template<class Vertex, class Value, class Aggregate, class Edges>
+void merge(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Edges& edges, bool ignore_missing_edges = false);
 
-template<class Vertex, class Value, class Special>
-set<Vertex>
-sparsify_keep(TripletMergeTree<Vertex, Value>& mt, const Special& special);
+template<class Vertex, class Value, class Aggregate, class Special>
+detail::KeepSet<Vertex>
+sparsify_keep(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Special& special);
 
 }
 
@@ -1,25 +1,30 @@
+#include <cassert>
+#include <algorithm>
+#include <numeric>
+
 #include <dlog/log.h>
 #include <dlog/stats.h>
 
 #include "format.h"
+#include "radix-sort.h"
 
-template<class Vertex, class Value>
-typename reeber::TripletMergeTree<Vertex, Value>::Neighbor
-reeber::TripletMergeTree<Vertex, Value>::
+template<class Vertex, class Value, class Aggregate>
+typename reeber::TripletMergeTree<Vertex, Value, Aggregate>::Neighbor
+reeber::TripletMergeTree<Vertex, Value, Aggregate>::
 add(const Vertex& x, Value v)
 {
     Neighbor n = new_node();
     n->vertex = x;
     n->value = v;
-    n->cur_deepest = n;
+    n->set_deepest(n);
     link(n, n, n);
     nodes_.emplace(x,n);
     return n;
 }
 
-template<class Vertex, class Value>
-typename reeber::TripletMergeTree<Vertex, Value>::Neighbor
-reeber::TripletMergeTree<Vertex, Value>::
+template<class Vertex, class Value, class Aggregate>
+typename reeber::TripletMergeTree<Vertex, Value, Aggregate>::Neighbor
+reeber::TripletMergeTree<Vertex, Value, Aggregate>::
 find_or_add(const Vertex& x, Value v)
 {
     auto it = nodes().find(x);
@@ -29,9 +34,9 @@ find_or_add(const Vertex& x, Value v)
         return add(x, v);
 }
 
-template<class Vertex, class Value>
-typename reeber::TripletMergeTree<Vertex, Value>::Neighbor
-reeber::TripletMergeTree<Vertex, Value>::
+template<class Vertex, class Value, class Aggregate>
+typename reeber::TripletMergeTree<Vertex, Value, Aggregate>::Neighbor
+reeber::TripletMergeTree<Vertex, Value, Aggregate>::
 add_or_update(const Vertex& x, Value v)
 {
     auto it = nodes().find(x);
@@ -44,9 +49,9 @@ add_or_update(const Vertex& x, Value v)
         return add(x, v);
 }
 
-template<class Vertex, class Value>
-typename reeber::TripletMergeTree<Vertex, Value>::Neighbor
-reeber::TripletMergeTree<Vertex, Value>::
+template<class Vertex, class Value, class Aggregate>
+typename reeber::TripletMergeTree<Vertex, Value, Aggregate>::Neighbor
+reeber::TripletMergeTree<Vertex, Value, Aggregate>::
 representative(Neighbor u, Neighbor a) const
 {
     Neighbor s, v;
@@ -59,9 +64,9 @@ representative(Neighbor u, Neighbor a) const
     return u;
 }
 
-template<class Vertex, class Value>
-std::tuple<typename reeber::TripletMergeTree<Vertex, Value>::Neighbor, typename reeber::TripletMergeTree<Vertex, Value>::Neighbor>
-reeber::TripletMergeTree<Vertex, Value>::
+template<class Vertex, class Value, class Aggregate>
+std::tuple<typename reeber::TripletMergeTree<Vertex, Value, Aggregate>::Neighbor, typename reeber::TripletMergeTree<Vertex, Value, Aggregate>::Neighbor>
+reeber::TripletMergeTree<Vertex, Value, Aggregate>::
 repair(const Neighbor u)
 {
     Neighbor s, v, ov;
@@ -75,43 +80,215 @@ repair(const Neighbor u)
     return std::make_tuple(s,v);
 }
 
-template<class Vertex, class Value>
-typename reeber::TripletMergeTree<Vertex, Value>::Neighbor
-reeber::TripletMergeTree<Vertex, Value>::
+template<class Vertex, class Value, class Aggregate>
+typename reeber::TripletMergeTree<Vertex, Value, Aggregate>::Neighbor
+reeber::TripletMergeTree<Vertex, Value, Aggregate>::
 find_deepest(const Neighbor u)
 {
-    Neighbor u_ = u->cur_deepest;
+    Neighbor u_ = u->deepest();
     Neighbor v = std::get<1>(u_->parent());
 
     while (u_ != v)
     {
-        u_ = v->cur_deepest;
+        u_ = v->deepest();
         v = std::get<1>(u_->parent());
     }
     Neighbor d = u_;
 
-    u_ = u->cur_deepest;
+    u_ = u->deepest();
     v = std::get<1>(u_->parent());
     while (u_ != v)
     {
-        u_ = v->cur_deepest;
-        v->cur_deepest = d;
+        u_ = v->deepest();
+        v->set_deepest(d);
         v = std::get<1>(u_->parent());
     }
 
-    u->cur_deepest = d;
+    u->set_deepest(d);
     return d;
 }
 
 
-template<class Vertex, class Value, class Topology, class Function>
+namespace reeber
+{
+namespace detail
+{
+    // vertices must be sorted in the order of mt.cmp(); link() may go outside of them
+    template<class Vertex, class Value, class Aggregate, class Topology>
+    void compute_merge_tree(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const std::vector<std::pair<Value,Vertex>>& vertices)
+    {
+        typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor Neighbor;
+        typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Node::ValueVertex ValueVertex;
+
+        const auto& nodes = static_cast<const TripletMergeTree<Vertex, Value, Aggregate>&>(mt).nodes();
+
+        LOG_SEV(debug) << "Computing merge tree out of " << vertices.size() << " vertices";
+
+        for (const ValueVertex& fx : vertices)
+        {
+            Value val; Vertex x;
+            std::tie(val, x) = fx;
+
+            Neighbor u = mt.add(x, val);
+
+            std::vector<Neighbor> leaves;
+            for (const Vertex& y : topology.link(x))
+            {
+                auto it = nodes.find(y);
+                if (it != nodes.end()) leaves.push_back(mt.find_deepest(it->second));
+            }
+            if (!leaves.empty())
+            {
+                Neighbor oldest = *std::min_element(leaves.begin(), leaves.end(), [&mt](Neighbor x, Neighbor y) { return mt.cmp(x, y); });
+                mt.link(u, u, oldest);
+                if (leaves.size() > 1)
+                {
+                    for (const Neighbor v : leaves) if (v != oldest) mt.link(v, u, oldest);
+                }
+            }
+        }
+    }
+
+    struct NoOutside
+    {
+        template<class Vertex>
+        void operator()(const Vertex&, const Vertex&) const {}
+    };
+
+    struct AllShell
+    {
+        template<class Vertex>
+        bool operator()(const Vertex&) const { return true; }
+    };
+
+    // the vertices given to compute_merge_tree2 are either plain vertices, whose values come from f,
+    // or (value, vertex) pairs, when the values are already known (e.g., from a threshold test)
+    template<class Vertex>
+    struct VertexValueOf
+    {
+        static const Vertex&    vertex(const Vertex& a)                                 { return a; }
+        template<class Value>
+        static const Vertex&    vertex(const std::pair<Value, Vertex>& x)               { return x.second; }
+
+        template<class Function>
+        static auto             value(const Vertex& a, const Function& f) -> decltype(f(a))     { return f(a); }
+        template<class Value, class Function>
+        static const Value&     value(const std::pair<Value, Vertex>& x, const Function&)       { return x.first; }
+    };
+
+    // vertices is any random-access container (std::vector, reeber::vector) of either kind;
+    // init(u) is called on every node right after it's added;
+    // outside(a, b) is called (concurrently) on every edge from a vertex a to a vertex b that's not among the vertices,
+    // for the vertices a on the shell: shell(a) is false only if all the neighbors of a are among the vertices,
+    // or left out for reasons outside doesn't care about (e.g., the threshold)
+    template<class Vertex, class Value, class Aggregate, class Topology, class Function, class Vertices, class Init, class Outside = NoOutside, class Shell = AllShell>
+    void compute_merge_tree2(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f, const Vertices& vertices, const Init& init,
+                             const Outside& outside = Outside(), const Shell& shell = Shell())
+    {
+        typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor        Neighbor;
+
+        const bool  report_outside = !std::is_same<Outside, NoOutside>::value;
+        const auto& nodes = static_cast<const TripletMergeTree<Vertex, Value, Aggregate>&>(mt).nodes();
+
+        using VV = VertexValueOf<Vertex>;
+
+        for_each(0, vertices.size(), [&](size_t i) { init(mt.add(VV::vertex(vertices[i]), VV::value(vertices[i], f))); });
+
+        for_each(0, vertices.size(), [&](size_t i)
+        {
+            Vertex a = VV::vertex(vertices[i]);
+            Neighbor u = mt[a];
+            bool probe = report_outside && shell(a);
+            for (const Vertex& b : topology.link(a))
+            {
+                if (b < a && !probe) continue;
+                auto it = nodes.find(b);
+                if (it == nodes.end())                  // cut off by the threshold, or not ours
+                {
+                    if (probe)
+                        outside(a, b);
+                    continue;
+                }
+                if (b < a) continue;
+                mt.merge(u, it->second);
+            }
+        });
+
+        repair(mt);
+    }
+
+    // Adds the aggregate of every node that isn't kept to the first kept node
+    // down its chain of parents, to(t) being where the aggregate of t goes (t
+    // itself, or its copy in another tree); the components nobody keeps are
+    // lost. Must run before the nodes are deleted.
+    template<class Vertex, class Value, class Aggregate, class Keep, class To>
+    void fold_aggregates(const TripletMergeTree<Vertex, Value, Aggregate>& mt, const Keep& keep, const To& to)
+    {
+        typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor        Neighbor;
+
+        if (std::is_same<Aggregate, NoAggregate>::value)
+            return;
+
+        std::unordered_map<Neighbor, Neighbor> target;      // dropped node -> the kept node it goes into (or null)
+        std::vector<Neighbor> path;
+        for (auto& x : mt.nodes())
+        {
+            Neighbor u = x.second;
+            if (x.first != u->vertex || keep(u))
+                continue;
+
+            Neighbor t = nullptr;
+            path.clear();
+            while (true)
+            {
+                if (keep(u))
+                {
+                    t = u;
+                    break;
+                }
+                auto it = target.find(u);
+                if (it != target.end())
+                {
+                    t = it->second;
+                    break;
+                }
+                path.push_back(u);
+                Neighbor v = std::get<1>(u->parent());
+                if (v == u)
+                    break;
+                u = v;
+            }
+            for (Neighbor y : path)
+                target[y] = t;
+
+            if (t)
+                to(t)->aggregate() += x.second->aggregate();
+        }
+    }
+
+    template<class Vertex, class Value, class Aggregate, class Edges>
+    void merge_edges(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Edges& edges, bool ignore_missing_edges)
+    {
+        for_each(0, edges.size(), [&](size_t i)
+        {
+            Vertex a, b;
+            std::tie(a, b) = edges[i];
+            if (!ignore_missing_edges || (mt.contains(a) && mt.contains(b)))
+                mt.merge(mt[a], mt[b]);
+        });
+
+        repair(mt);
+    }
+}
+}
+
+template<class Vertex, class Value, class Aggregate, class Topology, class Function>
 void
-reeber::compute_merge_tree(TripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f)
+reeber::compute_merge_tree(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f)
 {
     dlog::prof << "compute-merge-tree";
 
-    typedef     typename TripletMergeTree<Vertex, Value>::Neighbor Neighbor;
-    typedef     typename TripletMergeTree<Vertex, Value>::Node::ValueVertex ValueVertex;
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Node::ValueVertex ValueVertex;
 
     std::vector<ValueVertex>     vertices;
     vertices.reserve(topology.size());
@@ -120,50 +297,49 @@ reeber::compute_merge_tree(TripletMergeTree<Vertex, Value>& mt, const Topology&
         vertices.push_back(std::make_pair(f(v), v));
     }
 
-    if (mt.negate())
-        std::sort(vertices.begin(), vertices.end(), std::greater<ValueVertex>());
-    else
-        std::sort(vertices.begin(), vertices.end(), std::less<ValueVertex>());
+    sort_value_vertex(vertices, mt.negate());
 
-    LOG_SEV(debug) << "Computing merge tree out of " << vertices.size() << " vertices";
+    detail::compute_merge_tree(mt, topology, vertices);
 
-    for (const ValueVertex& fx : vertices)
-    {
-        Value val; Vertex x;
-        std::tie(val, x) = fx;
+    dlog::prof >> "compute-merge-tree";
+}
+
+template<class Vertex, class Value, class Aggregate, class Topology, class Function>
+void
+reeber::compute_merge_tree(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f, typename TripletMergeTree<Vertex, Value, Aggregate>::Value threshold)
+{
+    dlog::prof << "compute-merge-tree";
 
-        Neighbor u = mt.add(x, val);
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Node::ValueVertex ValueVertex;
 
-        std::vector<Neighbor> leaves;
-        for (const Vertex& y : topology.link(x))
-        {
-            auto it = mt.nodes().find(y);
-            if (it != mt.nodes().end()) leaves.push_back(mt.find_deepest(it->second));
-        }
-        if (!leaves.empty())
-        {
-            Neighbor oldest = *std::min_element(leaves.begin(), leaves.end(), [&mt](Neighbor x, Neighbor y) { return mt.cmp(x, y); });
-            mt.link(u, u, oldest);
-            if (leaves.size() > 1)
-            {
-                for (const Neighbor v : leaves) if (v != oldest) mt.link(v, u, oldest);
-            }
-        }
+    // no reserve: the point is to not pay for the whole topology
+    std::vector<ValueVertex>     vertices;
+    for (Vertex v : topology.vertices())
+    {
+        Value val = f(v);
+        if (!mt.cmp(threshold, val))
+            vertices.push_back(std::make_pair(val, v));
     }
 
+    sort_value_vertex(vertices, mt.negate());
+
+    detail::compute_merge_tree(mt, topology, vertices);
+
     dlog::prof >> "compute-merge-tree";
 }
 
-template<class Vertex, class Value, class Special>
+template<class Vertex, class Value, class Aggregate, class Special>
 void
-reeber::remove_degree_two(TripletMergeTree<Vertex, Value>& mt, const Special& special)
+reeber::remove_degree_two(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Special& special)
 {
     dlog::prof << "remove-degree-two";
 
-    typedef     typename TripletMergeTree<Vertex, Value>::Neighbor          Neighbor;
-    typedef     typename TripletMergeTree<Vertex, Value>::Node::ValueVertex ValueVertex;
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor          Neighbor;
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::ValueVertex       ValueVertex;
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::VerticesRun       VerticesRun;
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::VerticesVector    VerticesVector;
 
-    set<Vertex> keep;
+    detail::KeepSet<Vertex> keep(mt.nodes());
 
     for_each_range(mt.nodes(), [&](const std::pair<Vertex,Neighbor>& n)
     {
@@ -176,7 +352,7 @@ reeber::remove_degree_two(TripletMergeTree<Vertex, Value>& mt, const Special& sp
             {
                 keep.insert(u->vertex);
                 keep.insert(s->vertex);
-                if (keep.find(v->vertex) != keep.end()) break;
+                if (keep.contains(v->vertex)) break;
                 keep.insert(v->vertex);
                 u = v;
                 std::tie(s, v) = u->parent();
@@ -185,68 +361,145 @@ reeber::remove_degree_two(TripletMergeTree<Vertex, Value>& mt, const Special& sp
         if (u == v) keep.insert(u->vertex);
     });
 
+    // a removed node u goes, together with its own collapsed vertices, into its parent v
+    struct Collapsed
+    {
+        Neighbor        to;
+        ValueVertex     vertex;
+        VerticesRun     vertices;
+    };
+    std::vector<Collapsed> collapsed;
+
     // Although the standard guarantees that this works only starting with
     // C++14, according to this issue, all compilers support it with C++11:
     // http://wg21.cmeerw.net/lwg/issue2356
     auto it = mt.nodes().begin();
     while (it != mt.nodes().end())
     {
-        if (keep.find(it->first) == keep.end())
+        if (!keep.contains(it->first))
         {
             Neighbor u = it->second;
             Neighbor v = std::get<1>(u->parent());
-            v->vertices.push_back(ValueVertex(u->value, u->vertex));
+            collapsed.push_back(Collapsed { v, ValueVertex(u->value, u->vertex), u->vertices });
+            v->aggregate() += u->aggregate();
             mt.delete_node(it->second);
             it = map_erase(mt.nodes(), it);
         } else
             ++it;
     }
 
+    if (!collapsed.empty())
+    {
+        // rebuild the storage in bulk: one block, one run per node with its
+        // old vertices and everything collapsed into it
+        std::sort(collapsed.begin(), collapsed.end(), [](const Collapsed& x, const Collapsed& y) { return std::less<Neighbor>()(x.to, y.to); });
+
+        std::vector<Neighbor> nodes;
+        nodes.reserve(mt.size());
+        for (auto& x : mt.nodes())
+            nodes.push_back(x.second);
+
+        std::vector<size_t> offsets(nodes.size() + 1, 0);
+        std::vector<std::pair<size_t, size_t>> groups(nodes.size());
+        for_each(0, nodes.size(), [&](size_t i)
+        {
+            auto range = std::equal_range(collapsed.begin(), collapsed.end(), Collapsed { nodes[i], ValueVertex(), VerticesRun() },
+                                          [](const Collapsed& x, const Collapsed& y) { return std::less<Neighbor>()(x.to, y.to); });
+            groups[i] = std::make_pair(range.first - collapsed.begin(), range.second - collapsed.begin());
+
+            size_t n = nodes[i]->vertices.size();
+            for (auto c = range.first; c != range.second; ++c)
+                n += 1 + c->vertices.size();
+            offsets[i + 1] = n;
+        });
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        VerticesVector block(offsets.back());
+        for_each(0, nodes.size(), [&](size_t i)
+        {
+            ValueVertex* start = block.data() + offsets[i];
+            ValueVertex* out   = std::copy(nodes[i]->vertices.begin(), nodes[i]->vertices.end(), start);
+            for (size_t j = groups[i].first; j < groups[i].second; ++j)
+            {
+                *out++ = collapsed[j].vertex;
+                out = std::copy(collapsed[j].vertices.begin(), collapsed[j].vertices.end(), out);
+            }
+            std::sort(start, out, [&mt](const ValueVertex& x, const ValueVertex& y) { return mt.cmp(x, y); });
+            nodes[i]->vertices = VerticesRun(start, out);
+        });
+
+        mt.vertex_blocks_.clear();
+        mt.store_vertices(std::move(block));
+    }
+
     dlog::prof >> "remove-degree-two";
 }
 
-template<class Vertex, class Value>
+template<class Vertex, class Value, class Aggregate>
 void
-reeber::repair(TripletMergeTree<Vertex, Value>& mt)
+reeber::repair(TripletMergeTree<Vertex, Value, Aggregate>& mt)
 {
-    using Neighbor = typename TripletMergeTree<Vertex, Value>::Neighbor;
+    using Neighbor = typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor;
     for_each_range(mt.nodes(), [&](const std::pair<Vertex,Neighbor>& n) { mt.repair(n.second); });
 }
 
-template<class Vertex, class Value, class Topology, class Function>
+template<class Vertex, class Value, class Aggregate, class Topology, class Function>
+void
+reeber::compute_merge_tree2(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f)
+{
+    reeber::compute_merge_tree2(mt, topology, f, aggregate_with([](const Vertex&, Value) { return Aggregate(); }));
+}
+
+template<class Vertex, class Value, class Aggregate, class Topology, class Function>
 void
-reeber::compute_merge_tree2(TripletMergeTree<Vertex, Value>& mt, const Topology& topology, const Function& f)
+reeber::compute_merge_tree2(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f, typename TripletMergeTree<Vertex, Value, Aggregate>::Value threshold)
+{
+    reeber::compute_merge_tree2(mt, topology, f, threshold, aggregate_with([](const Vertex&, Value) { return Aggregate(); }));
+}
+
+template<class Vertex, class Value, class Aggregate, class Topology, class Function, class AggregateOf>
+void
+reeber::compute_merge_tree2(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f, const detail::AggregateWith<AggregateOf>& aggregate)
 {
     dlog::prof << "compute-merge-tree2";
 
-    typedef     typename TripletMergeTree<Vertex, Value>::Neighbor        Neighbor;
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor        Neighbor;
 
     auto vertices_ = topology.vertices();
 
     vector<Vertex> vertices(std::begin(vertices_), std::end(vertices_));
 
-    for_each(0, vertices.size(), [&](size_t i) { Vertex a = vertices[i]; mt.add(a, f(a)); });
+    detail::compute_merge_tree2(mt, topology, f, vertices, [&aggregate](Neighbor u) { u->aggregate() = aggregate.f(u->vertex, u->value); });
+
+    dlog::prof >> "compute-merge-tree2";
+}
+
+template<class Vertex, class Value, class Aggregate, class Topology, class Function, class AggregateOf>
+void
+reeber::compute_merge_tree2(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Topology& topology, const Function& f, typename TripletMergeTree<Vertex, Value, Aggregate>::Value threshold, const detail::AggregateWith<AggregateOf>& aggregate)
+{
+    dlog::prof << "compute-merge-tree2";
 
-    for_each(0, vertices.size(), [&](size_t i)
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor        Neighbor;
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::ValueVertex     ValueVertex;
+
+    vector<ValueVertex> vertices;
+    for (Vertex v : topology.vertices())
     {
-        Vertex a = vertices[i];
-        Neighbor u = mt[a];
-        for (const Vertex& b : topology.link(a))
-        {
-            if (b < a) continue;
-            Neighbor v = mt[b];
-            mt.merge(u, v);
-        }
-    });
+        Value val = f(v);
+        if (!mt.cmp(threshold, val))
+            vertices.push_back(std::make_pair(val, v));
+    }
 
+    LOG_SEV(debug) << "Computing merge tree out of " << vertices.size() << " vertices that pass the threshold";
 
-    repair(mt);
+    detail::compute_merge_tree2(mt, topology, f, vertices, [&aggregate](Neighbor u) { u->aggregate() = aggregate.f(u->vertex, u->value); });
 
     dlog::prof >> "compute-merge-tree2";
 }
 
-template<class Vertex, class Value>
-size_t reeber::TripletMergeTree<Vertex, Value>::n_vertices_total() const
+template<class Vertex, class Value, class Aggregate>
+size_t reeber::TripletMergeTree<Vertex, Value, Aggregate>::n_vertices_total() const
 {
     size_t result = 0;
     for(const auto& n : nodes_)
@@ -256,13 +509,13 @@ size_t reeber::TripletMergeTree<Vertex, Value>::n_vertices_total() const
     return result;
 }
 
-template<class Vertex, class Value, class Special>
-reeber::set<Vertex>
-reeber::sparsify_keep(TripletMergeTree<Vertex, Value>& mt, const Special& special)
+template<class Vertex, class Value, class Aggregate, class Special>
+reeber::detail::KeepSet<Vertex>
+reeber::sparsify_keep(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Special& special)
 {
-    typedef     typename TripletMergeTree<Vertex, Value>::Neighbor        Neighbor;
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor        Neighbor;
 
-    set<Vertex> keep;
+    detail::KeepSet<Vertex> keep(mt.nodes());
     for_each_range(mt.nodes(), [&](const std::pair<Vertex,Neighbor>& n)
     {
         Neighbor s, v;
@@ -274,7 +527,7 @@ reeber::sparsify_keep(TripletMergeTree<Vertex, Value>& mt, const Special& specia
                 std::tie(s, v) = u->parent();
                 keep.insert(u->vertex);
                 keep.insert(s->vertex);
-                if (keep.find(v->vertex) != keep.end()) break;
+                if (keep.contains(v->vertex)) break;
                 u = v;
             }
         }
@@ -282,17 +535,22 @@ reeber::sparsify_keep(TripletMergeTree<Vertex, Value>& mt, const Special& specia
     return keep;
 }
 
-template<class Vertex, class Value, class Special>
+template<class Vertex, class Value, class Aggregate, class Special>
 void
-reeber::sparsify(TripletMergeTree<Vertex, Value>& out, TripletMergeTree<Vertex, Value>& in, const Special& special)
+reeber::sparsify(TripletMergeTree<Vertex, Value, Aggregate>& out, TripletMergeTree<Vertex, Value, Aggregate>& in, const Special& special)
 {
     dlog::prof << "sparsify";
 
-    typedef     typename TripletMergeTree<Vertex, Value>::Neighbor        Neighbor;
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor        Neighbor;
 
-    set<Vertex> keep = sparsify_keep(in, special);
+    detail::KeepSet<Vertex> keep = sparsify_keep(in, special);
 
-    for_each_range(keep, [&](Vertex x) { out.add(x, in[x]->value); });
+    for_each_range(in.nodes(), [&](const std::pair<Vertex,Neighbor>& n)
+    {
+        if (keep.contains(n.first))
+            out.add(n.first, n.second->value)->aggregate() = n.second->aggregate();
+    });
+    detail::fold_aggregates(in, [&keep](Neighbor u) { return keep.contains(u->vertex); }, [&out](Neighbor u) { return out[u->vertex]; });
 
     for_each_range(out.nodes(), [&](const std::pair<Vertex,Neighbor>& n)
     {
@@ -307,13 +565,16 @@ reeber::sparsify(TripletMergeTree<Vertex, Value>& out, TripletMergeTree<Vertex,
     dlog::prof >> "sparsify";
 }
 
-template<class Vertex, class Value, class Special>
+template<class Vertex, class Value, class Aggregate, class Special>
 void
-reeber::sparsify(TripletMergeTree<Vertex, Value>& mt, const Special& special)
+reeber::sparsify(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Special& special)
 {
     dlog::prof << "sparsify";
 
-    set<Vertex> keep = sparsify_keep(mt, special);
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor        Neighbor;
+
+    detail::KeepSet<Vertex> keep = sparsify_keep(mt, special);
+    detail::fold_aggregates(mt, [&keep](Neighbor u) { return keep.contains(u->vertex); }, [](Neighbor u) { return u; });
 
     // Although the standard guarantees that this works only starting with
     // C++14, according to this issue, all compilers support it with C++11:
@@ -321,7 +582,7 @@ reeber::sparsify(TripletMergeTree<Vertex, Value>& mt, const Special& special)
     auto it = mt.nodes().begin();
     while (it != mt.nodes().end())
     {
-        if (keep.find(it->first) == keep.end())
+        if (!keep.contains(it->first))
         {
             mt.delete_node(it->second);
             it = map_erase(mt.nodes(), it);
@@ -332,12 +593,154 @@ reeber::sparsify(TripletMergeTree<Vertex, Value>& mt, const Special& special)
     dlog::prof >> "sparsify";
 }
 
+template<class Vertex, class Value, class Aggregate, class Special>
+size_t
+reeber::simplify(TripletMergeTree<Vertex, Value, Aggregate>& mt, Value epsilon, const Special& special)
+{
+    dlog::prof << "simplify";
+
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor        Neighbor;
+
+    std::unordered_map<Neighbor, std::vector<Neighbor>> children;
+    std::unordered_set<Neighbor> saddles;
+    std::vector<Neighbor> worklist;
+    for (auto& x : mt.nodes())
+    {
+        Neighbor u = x.second, s, v;
+        std::tie(s, v) = u->parent();
+        if (u != v)
+            children[v].push_back(u);
+        if (u != s)
+        {
+            saddles.insert(s);
+            worklist.push_back(u);
+        }
+    }
 
-template<class Vertex, class Value>
-void reeber::TripletMergeTree<Vertex, Value>::make_deep_copy(reeber::TripletMergeTree<Vertex, Value>& other)
+    auto persistence = [&mt](Neighbor u, Neighbor s) { return mt.negate() ? u->value - s->value : s->value - u->value; };
+    auto is_noise    = [&](Neighbor u)
+    {
+        Neighbor s, v;
+        std::tie(s, v) = u->parent();
+        return u != s && !special(u->vertex) && !saddles.count(u) && persistence(u, s) < epsilon;
+    };
+    auto by_level    = [&mt](Neighbor x, Neighbor y) { return mt.cmp(x, y); };
+    auto saddle      = [](Neighbor u) { return std::get<0>(u->parent()); };
+    auto is_loose    = [&](Neighbor u)          // nothing hangs off u, nothing merges at u
+    {
+        auto c = children.find(u);
+        return !special(u->vertex) && (c == children.end() || c->second.empty()) && !saddles.count(u);
+    };
+
+    std::unordered_set<Neighbor> dead;
+    while (!worklist.empty())
+    {
+        Neighbor m = worklist.back();
+        worklist.pop_back();
+        if (dead.count(m) || !is_noise(m))
+            continue;
+
+        Neighbor s_m, v_m;
+        std::tie(s_m, v_m) = m->parent();
+
+        // the basin of m: the regular nodes on its branch, and the branches that merge into it
+        std::vector<Neighbor> regular, sub;
+        for (Neighbor c : children[m])
+            (saddle(c) == c ? regular : sub).push_back(c);
+        children.erase(m);
+        std::sort(regular.begin(), regular.end(), by_level);
+        std::sort(sub.begin(), sub.end(), [&](Neighbor x, Neighbor y) { return mt.cmp(saddle(x), saddle(y)); });
+
+        // with m gone, its branch starts higher up: the loose regular nodes
+        // below the first merge go with it
+        size_t i = 0;
+        while (i < regular.size() && is_loose(regular[i]) && (sub.empty() || mt.cmp(regular[i], saddle(sub.front()))))
+            dead.insert(regular[i++]);
+
+        auto& up = children[v_m];
+        up.erase(std::find(up.begin(), up.end(), m));
+        dead.insert(m);
+
+        // rebuild the branch decomposition of the rest of the basin, sweeping
+        // its regular nodes and the merges of the other branches in order;
+        // d is the deepest node so far
+        Neighbor d = nullptr;
+        size_t   j = 0;
+        while (i < regular.size() || j < sub.size())
+        {
+            if (j == sub.size() || (i < regular.size() && !mt.cmp(saddle(sub[j]), regular[i])))
+            {
+                Neighbor c = regular[i++];
+                if (!d)
+                    d = c;
+                else
+                {
+                    mt.link(c, c, d);
+                    children[d].push_back(c);
+                }
+            } else
+            {
+                Neighbor w = sub[j++], s_w = saddle(w);
+                if (!d)
+                    d = w;
+                else if (mt.cmp(w, d))
+                {
+                    mt.link(d, s_w, w);
+                    children[w].push_back(d);
+                    worklist.push_back(d);
+                    d = w;
+                } else
+                {
+                    mt.link(w, s_w, d);
+                    children[d].push_back(w);
+                }
+            }
+        }
+
+        if (d)
+        {
+            mt.link(d, s_m, v_m);
+            up.push_back(d);
+            worklist.push_back(d);
+        }
+    }
+
+    // the cancelled nodes kept their old parents, so their chains lead into the rest of the basin
+    detail::fold_aggregates(mt, [&dead](Neighbor u) { return !dead.count(u); }, [](Neighbor u) { return u; });
+
+    // Although the standard guarantees that this works only starting with
+    // C++14, according to this issue, all compilers support it with C++11:
+    // http://wg21.cmeerw.net/lwg/issue2356
+    auto it = mt.nodes().begin();
+    while (it != mt.nodes().end())
+    {
+        if (dead.count(it->second))
+        {
+            mt.delete_node(it->second);
+            it = map_erase(mt.nodes(), it);
+        } else
+            ++it;
+    }
+
+    dlog::prof >> "simplify";
+
+    return dead.size();
+}
+
+
+template<class Vertex, class Value, class Aggregate>
+void reeber::TripletMergeTree<Vertex, Value, Aggregate>::make_deep_copy(reeber::TripletMergeTree<Vertex, Value, Aggregate>& other)
 {
     // delete previous nodes in other
     TripletMergeTree(negate_).swap(other);
+
+    // the collapsed vertices go into a single block of other
+    size_t n_vertices = 0;
+    for (auto vn_pair : nodes_)
+        n_vertices += vn_pair.second->vertices.size();
+    VerticesVector block;
+    block.reserve(n_vertices);
+
     for (auto vn_pair : nodes_)
     {
 
@@ -354,14 +757,18 @@ void reeber::TripletMergeTree<Vertex, Value>::make_deep_copy(reeber::TripletMerg
         other_n_v = other.find_or_add(v, 0);
 
         other.link(other_n_u, other_n_s, other_n_v);
-        other_n_u->vertices = vn_pair.second->vertices;
+        const VerticesRun& vertices = vn_pair.second->vertices;
+        block.insert(block.end(), vertices.begin(), vertices.end());
+        other_n_u->vertices = VerticesRun(block.data() + block.size() - vertices.size(), block.data() + block.size());
+        other_n_u->aggregate() = vn_pair.second->aggregate();
     }
+    other.store_vertices(std::move(block));
 }
 
 
-template<class Vertex, class Value>
+template<class Vertex, class Value, class Aggregate>
 void
-reeber::TripletMergeTree<Vertex, Value>::
+reeber::TripletMergeTree<Vertex, Value, Aggregate>::
 merge(Neighbor u, Neighbor s, Neighbor v)
 {
     while(true)
@@ -401,9 +808,9 @@ merge(Neighbor u, Neighbor s, Neighbor v)
     }
 }
 
-template<class Vertex, class Value>
+template<class Vertex, class Value, class Aggregate>
 void
-reeber::TripletMergeTree<Vertex, Value>::
+reeber::TripletMergeTree<Vertex, Value, Aggregate>::
 merge(Neighbor u, Neighbor v)
 {
     if (cmp(u, v))
@@ -412,35 +819,47 @@ merge(Neighbor u, Neighbor v)
         merge(u, u, v);
 }
 
-template<class Vertex, class Value, class Edges>
+template<class Vertex, class Value, class Aggregate>
+void
+reeber::splice(TripletMergeTree<Vertex, Value, Aggregate>& mt1, TripletMergeTree<Vertex, Value, Aggregate>& mt2)
+{
+    // a vertex present in both trees keeps mt1's node (and aggregate); the other one is a copy
+    for_each_range(mt2.nodes(), [&mt1](const std::pair<Vertex, typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor>& n) { mt1.nodes_.insert(n); });
+    mt2.nodes_.clear();
+    mt1.arena_->splice(*mt2.arena_);
+    for (auto& block : mt2.vertex_blocks_)
+        mt1.vertex_blocks_.emplace_back(std::move(block));
+    mt2.vertex_blocks_.clear();
+}
+
+template<class Vertex, class Value, class Aggregate, class Edges>
 void
-reeber::merge(TripletMergeTree<Vertex, Value>& mt1, TripletMergeTree<Vertex, Value>& mt2, const Edges& edges,
+reeber::merge(TripletMergeTree<Vertex, Value, Aggregate>& mt1, TripletMergeTree<Vertex, Value, Aggregate>& mt2, const Edges& edges,
               bool ignore_missing_edges)
 {
     dlog::prof << "merge";
 
-    mt1.nodes_.insert(mt2.nodes().begin(), mt2.nodes().end());
-    mt2.nodes_.clear();
-
-    for_each(0, edges.size(), [&](size_t i)
-    {
-        Vertex a, b;
-        std::tie(a, b) = edges[i];
-        if (!ignore_missing_edges || (mt1.contains(a) && mt1.contains(b)))
-            mt1.merge(mt1[a], mt1[b]);
-    });
+    splice(mt1, mt2);
+    detail::merge_edges(mt1, edges, ignore_missing_edges);
 
-    repair(mt1);
+    dlog::prof >> "merge";
+}
 
+template<class Vertex, class Value, class Aggregate, class Edges>
+void
+reeber::merge(TripletMergeTree<Vertex, Value, Aggregate>& mt, const Edges& edges, bool ignore_missing_edges)
+{
+    dlog::prof << "merge";
+    detail::merge_edges(mt, edges, ignore_missing_edges);
     dlog::prof >> "merge";
 }
 
 
-template<class Vertex, class Value, class Functor>
+template<class Vertex, class Value, class Aggregate, class Functor>
 void
-reeber::traverse_persistence(const TripletMergeTree<Vertex, Value>& mt, const Functor& f)
+reeber::traverse_persistence(const TripletMergeTree<Vertex, Value, Aggregate>& mt, const Functor& f)
 {
-    typedef     typename TripletMergeTree<Vertex, Value>::Neighbor        Neighbor;
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor        Neighbor;
 
     Neighbor u, s, v;
     for (auto x : mt.nodes())
@@ -455,3 +874,22 @@ reeber::traverse_persistence(const TripletMergeTree<Vertex, Value>& mt, const Fu
         if (u != s || u == v) f(u, s, v);
     }
 }
+
+template<class Vertex, class Value, class Aggregate, class Functor>
+void
+reeber::traverse_persistence_parallel(const TripletMergeTree<Vertex, Value, Aggregate>& mt, const Functor& f)
+{
+    typedef     typename TripletMergeTree<Vertex, Value, Aggregate>::Neighbor        Neighbor;
+
+    for_each_range(mt.nodes(), [&f](const std::pair<const Vertex, Neighbor>& x)
+    {
+        Neighbor u = x.second, s, v;
+
+        // removed degree 2 vertices still sit in the map, we must ignore them
+        if (x.first != u->vertex)
+            return;
+
+        std::tie(s, v) = u->parent();
+        if (u != s || u == v) f(u, s, v);
+    });
+}
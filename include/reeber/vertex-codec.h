@@ -0,0 +1,61 @@
+#ifndef REEBER_VERTEX_CODEC_H
+#define REEBER_VERTEX_CODEC_H
+
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+
+namespace reeber
+{
+
+namespace detail
+{
+    inline std::uint64_t    zigzag(std::int64_t x)          { return (std::uint64_t(x) << 1) ^ std::uint64_t(x >> 63); }
+    inline std::int64_t     unzigzag(std::uint64_t x)       { return std::int64_t(x >> 1) ^ -std::int64_t(x & 1); }
+
+    // LEB128-style variable-length integers, 7 bits per byte
+    struct VarintWriter
+    {
+        void                put(std::uint64_t x)            { while (x >= 0x80) { bytes.push_back((unsigned char) (x | 0x80)); x >>= 7; } bytes.push_back((unsigned char) x); }
+        void                put_signed(std::int64_t x)      { put(zigzag(x)); }
+
+        std::vector<unsigned char>  bytes;
+    };
+
+    struct VarintReader
+    {
+                            VarintReader(const unsigned char* p_): p(p_)    {}
+
+        std::uint64_t       get()                           { std::uint64_t x = 0; unsigned shift = 0; unsigned char c;
+                                                              do { c = *p++; x |= std::uint64_t(c & 0x7f) << shift; shift += 7; } while (c & 0x80);
+                                                              return x; }
+        std::int64_t        get_signed()                    { return unzigzag(get()); }
+
+        const unsigned char* p;
+    };
+}
+
+/**
+ * Encodes a vertex as a difference from the previous one, so that ids that
+ * come in sorted order take a byte or two each (used by the compact
+ * serialization of TripletMergeTree). Specialize it for other vertex types;
+ * without a specialization (enabled = false) the vertices are saved as is.
+ */
+template<class Vertex, class Enable = void>
+struct VertexCodec
+{
+    static constexpr bool   enabled = false;
+};
+
+template<class Vertex>
+struct VertexCodec<Vertex, typename std::enable_if<std::is_integral<Vertex>::value>::type>
+{
+    static constexpr bool   enabled = true;
+
+    static void     encode(detail::VarintWriter& out, const Vertex& prev, const Vertex& x)  { out.put_signed(std::int64_t(std::uint64_t(x) - std::uint64_t(prev))); }
+    static void     decode(detail::VarintReader& in,  const Vertex& prev, Vertex& x)        { x = Vertex(std::uint64_t(prev) + std::uint64_t(in.get_signed())); }
+};
+
+}
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include <reeber/grid.h>
+#include <reeber/triplet-merge-tree.h>
+
+namespace test
+{
+    using Grid      = reeber::Grid<double, 3>;
+    using Index     = Grid::Index;
+    using Position  = Grid::Vertex;
+    using MergeTree = reeber::TripletMergeTree<Index, double>;
+
+    using Pair      = std::tuple<Index, double, Index, double>;
+
+    inline Grid random_grid(const Position& shape, unsigned seed)
+    {
+        Grid g(shape);
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<double> dis(0, 1);
+        for(size_t i = 0; i < g.size(); ++i)
+            g.data()[i] = dis(gen);
+        return g;
+    }
+
+    // (vertex, value, saddle vertex, saddle value) of every branch, sorted
+    template<class MT>
+    std::vector<Pair> persistence_pairs(const MT& mt)
+    {
+        std::vector<Pair> result;
+        reeber::traverse_persistence(mt, [&result](auto u, auto s, auto v) {
+            result.emplace_back(u->vertex, u->value, s->vertex, s->value);
+        });
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+}
@@ -0,0 +1,129 @@
+#include "catch/catch.hpp"
+
+#include <reeber/box.h>
+
+#include "common.h"
+
+using namespace test;
+
+namespace
+{
+    // link() steps through the offsets in the interior; it must agree with the filtered link everywhere
+    template<class Box>
+    void check_link_against_shell_link(const Box& box)
+    {
+        const size_t link_size = Box::link_size;       // a copy, so that REQUIRE doesn't odr-use the member
+
+        size_t n_interior = 0;
+        for(auto v : box.vertices())
+        {
+            std::vector<Index> link, shell_link;
+            for(auto u : box.link(v))
+                link.push_back(u);
+            for(auto u : box.shell_link(box.position(v)))
+                shell_link.push_back(u);
+            REQUIRE(link == shell_link);
+
+            if (box.interior(box.position(v)))
+            {
+                REQUIRE(link.size() == link_size);
+                ++n_interior;
+            }
+        }
+        REQUIRE(n_interior > 0);
+    }
+
+    template<class Connectivity>
+    void check_box_links()
+    {
+        const Position shape { 7, 5, 6 };
+        check_link_against_shell_link(reeber::Box<3, Connectivity>(shape));
+        check_link_against_shell_link(reeber::Box<3, Connectivity>(shape, Position { 1, 0, 2 }, Position { 5, 4, 5 }));
+        check_link_against_shell_link(reeber::Box<3, Connectivity>(shape, Position { -1, 0, 2 }, Position { 7, 4, 6 }));
+    }
+
+    // the minima of the tree are the vertices below their whole link
+    template<class Connectivity>
+    void check_minima()
+    {
+        const Position shape { 9, 8, 7 };
+        Grid g = random_grid(shape, 11);
+        reeber::Box<3, Connectivity> box(shape);
+
+        MergeTree mt;
+        reeber::compute_merge_tree2(mt, box, g);
+        const MergeTree& cmt = mt;
+
+        std::vector<Index> minima, expected;
+        for(auto& x : cmt.nodes())
+            if (x.second->parent() == std::make_tuple(x.second, x.second) || std::get<0>(x.second->parent()) != x.second)
+                minima.push_back(x.first);
+        for(auto v : box.vertices())
+        {
+            bool lowest = true;
+            for(auto u : box.link(v))
+                lowest &= g(v) < g(u);
+            if (lowest)
+                expected.push_back(v);
+        }
+        std::sort(minima.begin(), minima.end());
+        std::sort(expected.begin(), expected.end());
+        REQUIRE(!expected.empty());
+        REQUIRE(minima == expected);
+    }
+}
+
+TEST_CASE("Box link agrees with shell_link", "[box][connectivity]")
+{
+    const Position shape { 7, 5, 6 };
+
+    SECTION("the whole grid")
+    {
+        check_link_against_shell_link(reeber::Box<3>(shape));
+    }
+
+    SECTION("a box inside the grid")
+    {
+        check_link_against_shell_link(reeber::Box<3>(shape, Position { 1, 0, 2 }, Position { 5, 4, 5 }));
+    }
+
+    SECTION("a box that sticks out of the grid")
+    {
+        check_link_against_shell_link(reeber::Box<3>(shape, Position { -1, 0, 2 }, Position { 7, 4, 6 }));
+    }
+
+    SECTION("two dimensions")
+    {
+        using Position2 = reeber::Box<2>::Position;
+        check_link_against_shell_link(reeber::Box<2>(Position2 { 6, 5 }));
+        check_link_against_shell_link(reeber::Box<2>(Position2 { 6, 5 }, Position2 { 1, 1 }, Position2 { 4, 3 }));
+    }
+
+    SECTION("offsets follow the box through a swap")
+    {
+        reeber::Box<3> box(shape), other(Position { 9, 8, 4 });
+        box.swap(other);
+        check_link_against_shell_link(box);
+        check_link_against_shell_link(other);
+    }
+}
+
+TEST_CASE("Box links of the other connectivities", "[box][connectivity]")
+{
+    static_assert(reeber::FreudenthalConnectivity<3>::size == 14, "Freudenthal link has 14 vertices");
+    static_assert(reeber::FaceConnectivity<3>::size == 6,         "face link has 6 vertices");
+    static_assert(reeber::EdgeConnectivity<3>::size == 18,        "edge link has 18 vertices");
+    static_assert(reeber::FullConnectivity<3>::size == 26,        "full link has 26 vertices");
+
+    check_box_links<reeber::FaceConnectivity<3>>();
+    check_box_links<reeber::EdgeConnectivity<3>>();
+    check_box_links<reeber::FullConnectivity<3>>();
+}
+
+TEST_CASE("Merge trees follow the connectivity of the box", "[box][connectivity][triplet_merge_tree]")
+{
+    check_minima<reeber::FreudenthalConnectivity<3>>();
+    check_minima<reeber::FaceConnectivity<3>>();
+    check_minima<reeber::EdgeConnectivity<3>>();
+    check_minima<reeber::FullConnectivity<3>>();
+}
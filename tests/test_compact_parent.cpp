@@ -0,0 +1,73 @@
+#include "catch/catch.hpp"
+
+#include <utility>
+#include <vector>
+
+#include <diy/serialization.hpp>
+
+#include <reeber/box.h>
+#include <reeber/flat-triplet-merge-tree.h>
+#include <reeber/triplet-merge-tree-serialization.h>
+
+#include "common.h"
+
+// built with REEBER_COMPACT_PARENT, see CMakeLists.txt
+
+using namespace test;
+
+using FlatMergeTree = reeber::FlatTripletMergeTree<Index, double>;
+
+TEST_CASE("Compact-parent trees match the flat tree", "[triplet_merge_tree][compact_parent]")
+{
+    const Position shape { 12, 10, 9 };
+    Grid g = random_grid(shape, 11);
+    reeber::Box<3> box(shape);
+
+    FlatMergeTree fmt;
+    reeber::compute_merge_tree2(fmt, box, g);
+    std::vector<Pair> expected = persistence_pairs(fmt);
+
+    SECTION("serial and parallel construction")
+    {
+        MergeTree mt, mt2;
+        reeber::compute_merge_tree(mt, box, g);
+        reeber::compute_merge_tree2(mt2, box, g);
+
+        REQUIRE(persistence_pairs(mt) == expected);
+        REQUIRE(persistence_pairs(mt2) == expected);
+    }
+
+    SECTION("ids stay valid across merge")
+    {
+        // two halves of the domain, glued back together along the edges between them
+        reeber::Box<3> left(shape, Position { 0, 0, 0 }, Position { 5, 9, 8 });
+        reeber::Box<3> right(shape, Position { 6, 0, 0 }, Position { 11, 9, 8 });
+
+        MergeTree mt_left, mt_right;
+        reeber::compute_merge_tree2(mt_left, left, g);
+        reeber::compute_merge_tree2(mt_right, right, g);
+
+        std::vector<std::pair<Index, Index>> edges;
+        for(Index a : left.vertices())
+            for(Index b : box.link(a))
+                if (right.contains(b))
+                    edges.emplace_back(a, b);
+
+        reeber::merge(mt_left, mt_right, edges);
+        REQUIRE(persistence_pairs(mt_left) == expected);
+    }
+
+    SECTION("serialization round trip")
+    {
+        MergeTree mt;
+        reeber::compute_merge_tree2(mt, box, g);
+
+        diy::MemoryBuffer bb;
+        reeber::Serialization<MergeTree>::save(bb, mt);
+        bb.reset();
+
+        MergeTree loaded;
+        reeber::Serialization<MergeTree>::load(bb, loaded);
+        REQUIRE(persistence_pairs(loaded) == expected);
+    }
+}
@@ -0,0 +1,109 @@
+#include "catch/catch.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fstream>
+
+#include <diy/master.hpp>
+#include <diy/mpi.hpp>
+
+#include <reeber/box.h>
+
+#include <output-persistence.h>
+
+#include "common.h"
+
+using namespace test;
+
+namespace
+{
+    struct Block
+    {
+        using RealType  = double;
+        using Neighbor  = MergeTree::Neighbor;
+
+        static void         destroy(void* b)                { delete static_cast<Block*>(b); }
+
+        const MergeTree&    get_merge_tree() const          { return mt; }
+
+        MergeTree           mt;
+    };
+
+    // every other vertex is local, so that the writer skips some of the pairs
+    struct IsLocal
+    {
+        bool    operator()(const Block&, Block::Neighbor u) const      { return u->vertex % 2 == 0; }
+    };
+
+    using Diagram = std::vector<std::pair<double, double>>;
+
+    Diagram read_diagram(const std::string& fn)
+    {
+        std::ifstream in(fn, std::ios::binary);
+        std::uint64_t n = 0;
+        in.read(reinterpret_cast<char*>(&n), sizeof(n));
+
+        Diagram result(n);
+        in.read(reinterpret_cast<char*>(&result[0]), n * sizeof(result[0]));
+        REQUIRE(in);
+        REQUIRE(in.peek() == std::ifstream::traits_type::eof());
+
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+}
+
+TEST_CASE("Thread-local counters start at zero", "[diagram_writer]")
+{
+    using Counts = reeber::thread_specific<std::uint64_t>;
+
+    // over memory that isn't zero, as it wouldn't be on the stack
+    alignas(Counts) unsigned char storage[sizeof(Counts)];
+    std::memset(storage, 0xff, sizeof(storage));
+    Counts* counts = new (storage) Counts;
+
+    REQUIRE(counts->local() == 0);
+    counts->~Counts();
+}
+
+TEST_CASE("DiagramWriter round trip", "[diagram_writer]")
+{
+    const Position shape { 6, 5, 4 };
+    const double threshold = 0.7, min_persistence = 0.01;
+    const std::string fn = "test-diagram-writer.dgm";
+
+    diy::mpi::communicator  world;
+    diy::Master             master(world, 1, -1, 0, &Block::destroy);
+    IsLocal                 is_local;
+
+    Diagram expected;
+    for(int gid = 0; gid < 3; ++gid)
+    {
+        Block* b = new Block;
+        b->mt.set_negate(gid == 1);
+        reeber::compute_merge_tree2(b->mt, reeber::Box<3>(shape), random_grid(shape, 100 + gid));
+        master.add(gid, b, new diy::Link);
+
+        PersistenceFilter<double> filter(b->mt.negate(), threshold, true, min_persistence);
+        reeber::traverse_persistence(b->mt, [&](Block::Neighbor from, Block::Neighbor through, Block::Neighbor)
+        {
+            double birth = from->value, death = through->value;
+            if (is_local(*b, from) && filter(birth, death))
+                expected.emplace_back(birth, death);
+        });
+    }
+    std::sort(expected.begin(), expected.end());
+    REQUIRE(expected.size() > 3);
+
+    // buffers of 3 pairs get flushed many times over
+    DiagramWriter<Block, IsLocal> writer(fn, world, is_local, threshold, true, min_persistence, 3);
+    writer.write(master);
+    REQUIRE(read_diagram(fn) == expected);
+
+    // an existing (longer) file gets truncated
+    DiagramWriter<Block, IsLocal>(fn, world, is_local, threshold, true, 2).write(master);
+    REQUIRE(read_diagram(fn).empty());
+
+    std::remove(fn.c_str());
+}
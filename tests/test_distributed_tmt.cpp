@@ -0,0 +1,344 @@
+#include "catch/catch.hpp"
+
+#include <map>
+#include <mutex>
+#include <set>
+
+#include <diy/master.hpp>
+#include <diy/assigner.hpp>
+
+#include <reeber/box.h>
+#include <reeber/distributed-tmt.h>
+
+#include "common.h"
+
+using namespace test;
+
+namespace
+{
+    template<class MT>
+    struct Block
+    {
+        static void destroy(void* b)            { delete static_cast<Block*>(b); }
+
+        int                                 gid;
+        MT                                  mt;
+        reeber::EdgeMaps<Index, double>     edge_maps;
+    };
+
+    // nblocks slabs along the first axis, all on this process;
+    // compute(master, assigner, topology, function, gid_generator) builds the trees,
+    // then visit(block, gid_of) looks at each of them
+    template<class MT, class Compute, class Visit>
+    void distributed(const Grid& g, int nblocks, bool negate, const Compute& compute, const Visit& visit)
+    {
+        using Block = ::Block<MT>;
+
+        diy::mpi::communicator  world;
+        diy::Master             master(world, 1, -1, 0, &Block::destroy);
+        diy::ContiguousAssigner assigner(world.size(), nblocks);
+
+        const Position& shape = g.shape();
+        reeber::Box<3> domain(shape);
+        auto gid_of = [&](Index i) { return int(domain.position(i)[0] * nblocks / shape[0]); };
+
+        for(int gid = 0; gid < nblocks; ++gid)
+        {
+            Block* b = new Block;
+            b->gid = gid;
+            b->mt.set_negate(negate);
+
+            diy::Link* l = new diy::Link;
+            for(int nbr : { gid - 1, gid + 1 })
+                if (nbr >= 0 && nbr < nblocks)
+                    l->add_neighbor(diy::BlockID { nbr, world.rank() });
+            master.add(gid, b, l);
+        }
+
+        // the block's slab and one layer around it
+        auto topology = [&](Block* b)
+        {
+            Position from = Position::zero(), to = shape - Position::one();
+            from[0] = std::max(0, (b->gid * shape[0] + nblocks - 1) / nblocks - 1);
+            to[0]   = std::min(shape[0] - 1, ((b->gid + 1) * shape[0] + nblocks - 1) / nblocks);
+            return reeber::Box<3>(shape, from, to);
+        };
+
+        compute(master, assigner, topology,
+                [&g](Block*) -> const Grid& { return g; },
+                [&gid_of](Block*) { return gid_of; });
+
+        for(unsigned i = 0; i < master.size(); ++i)
+            visit(master.block<Block>(i), gid_of);
+    }
+
+    // the pairs whose minimum a block owns, after compute_merge_tree
+    std::vector<Pair> distributed_pairs(const Grid& g, int nblocks, const reeber::MergeOptions& options, bool negate = false)
+    {
+        using Block = ::Block<MergeTree>;
+
+        std::vector<Pair> result;
+        distributed<MergeTree>(g, nblocks, negate,
+                               [&](diy::Master& master, diy::Assigner& assigner, const auto& topology, const auto& function, const auto& gid_generator)
+                               {
+                                   reeber::compute_merge_tree(master, assigner, &Block::mt, &Block::edge_maps,
+                                                              topology, function, gid_generator, options);
+                               },
+                               [&](Block* b, const auto& gid_of)
+                               {
+                                   for(auto& p : persistence_pairs(b->mt))
+                                       if (gid_of(std::get<0>(p)) == b->gid)
+                                           result.push_back(p);
+                               });
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    struct Mass
+    {
+        size_t      count = 0;
+        double      sum   = 0;
+
+        Mass&       operator+=(const Mass& other)               { count += other.count; sum += other.sum; return *this; }
+    };
+
+    using MassTree = reeber::TripletMergeTree<Index, double, Mass>;
+
+    // the total of every component, by its root
+    std::map<Index, Mass> component_totals(const MassTree& mt)
+    {
+        std::map<Index, Mass> result;
+        for(auto& x : mt.nodes())
+        {
+            auto u = x.second;
+            while (std::get<1>(u->parent()) != u)
+                u = std::get<1>(u->parent());
+            result[u->vertex] += x.second->aggregate();
+        }
+        return result;
+    }
+}
+
+TEST_CASE("Distributed trees with a threshold", "[distributed_tmt][threshold]")
+{
+    const Position shape { 16, 9, 8 };
+    Grid g = random_grid(shape, 17);
+    reeber::Box<3> box(shape);
+
+    for(bool negate : { false, true })
+    {
+        double threshold = negate ? 0.4 : 0.6;
+
+        MergeTree mt(negate);
+        reeber::compute_merge_tree2(mt, box, g, threshold);
+
+        reeber::MergeOptions options;
+        options.threshold = threshold;
+        REQUIRE(distributed_pairs(g, 4, options, negate) == persistence_pairs(mt));
+    }
+}
+
+TEST_CASE("Distributed trees carry the aggregates", "[distributed_tmt][aggregate]")
+{
+    using Block = Block<MassTree>;
+
+    const Position shape { 16, 9, 8 };
+    Grid g = random_grid(shape, 23);
+    reeber::Box<3> box(shape);
+    auto mass = reeber::aggregate_with([](Index, double x) { return Mass { 1, x }; });
+
+    std::vector<reeber::MergeOptions> all_options(5);
+    all_options[1].k        = 4;
+    all_options[2].lean     = true;
+    all_options[3].premerge = true;
+    all_options[4].epsilon  = 0.05;
+
+    for(bool negate : { false, true })
+        for(double threshold : { std::numeric_limits<double>::quiet_NaN(), 0.5 })
+        {
+            MassTree mt(negate);
+            if (std::isnan(threshold))
+                reeber::compute_merge_tree2(mt, box, g, mass);
+            else
+                reeber::compute_merge_tree2(mt, box, g, threshold, mass);
+            auto expected = component_totals(mt);
+
+            for(auto options : all_options)
+            {
+                options.threshold = threshold;
+                distributed<MassTree>(g, 8, negate,
+                                      [&](diy::Master& master, diy::Assigner& assigner, const auto& topology, const auto& function, const auto& gid_generator)
+                                      {
+                                          reeber::compute_merge_tree(master, assigner, &Block::mt, &Block::edge_maps,
+                                                                     topology, function, gid_generator, mass, options);
+                                      },
+                                      [&](Block* b, const auto&)
+                                      {
+                                          // every component a block sees has the total it has in the serial tree
+                                          for(auto& x : component_totals(b->mt))
+                                          {
+                                              INFO("k = " << options.k << ", lean = " << options.lean << ", premerge = " << options.premerge
+                                                   << ", epsilon = " << options.epsilon << ", negate = " << negate << ", threshold = " << threshold);
+                                              REQUIRE(expected.count(x.first));
+                                              REQUIRE(x.second.count == expected[x.first].count);
+                                              REQUIRE(x.second.sum == Approx(expected[x.first].sum));
+                                          }
+                                      });
+            }
+        }
+}
+
+TEST_CASE("Distributed trees with k-ary rounds", "[distributed_tmt][k]")
+{
+    const Position shape { 18, 7, 6 };
+    Grid g = random_grid(shape, 31);
+
+    MergeTree mt;
+    reeber::compute_merge_tree2(mt, reeber::Box<3>(shape), g);
+    auto expected = persistence_pairs(mt);
+
+    for(auto nblocks_k : { std::make_pair(8, 2), std::make_pair(8, 4), std::make_pair(8, 8), std::make_pair(9, 3), std::make_pair(6, 4) })
+    {
+        reeber::MergeOptions options;
+        options.k = nblocks_k.second;
+        INFO("nblocks = " << nblocks_k.first << ", k = " << options.k);
+        REQUIRE(distributed_pairs(g, nblocks_k.first, options) == expected);
+    }
+}
+
+
+TEST_CASE("Local trees look up the gids only near the block boundary", "[distributed_tmt][gid]")
+{
+    const Position shape { 24, 12, 12 };
+    Grid g = random_grid(shape, 41);
+    reeber::Box<3> domain(shape);
+
+    // block 0 is x < 12, its topology has one more layer
+    reeber::Box<3> topology(shape, Position { 0, 0, 0 }, Position { 12, 11, 11 });
+    reeber::Box<3> local(shape, Position { 0, 0, 0 }, Position { 11, 11, 11 });
+
+    for(double threshold : { std::numeric_limits<double>::quiet_NaN(), 0.5 })
+    {
+        std::mutex          mutex;
+        std::set<Index>     looked_up;
+        auto gid_gen = [&](Index i)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                looked_up.insert(i);
+            }
+            return int(domain.position(i)[0] >= 12);
+        };
+        auto passes = [&](Index i) { return std::isnan(threshold) || g(domain.position(i)) <= threshold; };
+
+        MergeTree                           mt;
+        reeber::EdgeMaps<Index, double>     edge_maps;
+        auto no_aggregate = reeber::aggregate_with([](Index, double) { return reeber::NoAggregate(); });
+        if (std::isnan(threshold))
+            reeber::detail::compute_local_merge_tree(mt, edge_maps, topology, g, gid_gen, 0, no_aggregate);
+        else
+            reeber::detail::compute_local_merge_tree(mt, edge_maps, topology, g, gid_gen, 0, no_aggregate, threshold);
+
+        // only the two layers at the cut, and the neighbors of the inner one the threshold cuts off
+        for(Index i : looked_up)
+            REQUIRE(domain.position(i)[0] >= (std::isnan(threshold) ? 11 : 10));
+
+        MergeTree expected_mt;
+        if (std::isnan(threshold))
+            reeber::compute_merge_tree2(expected_mt, local, g);
+        else
+            reeber::compute_merge_tree2(expected_mt, local, g, threshold);
+        REQUIRE(persistence_pairs(mt) == persistence_pairs(expected_mt));
+
+        std::set<std::tuple<Index, Index>> edges, expected_edges;
+        for(auto& x : edge_maps[1])
+            edges.insert(x.first);
+        for(Index u : local.vertices())
+            if (passes(u))
+                for(Index v : topology.link(u))
+                    if (domain.position(v)[0] == 12 && passes(v))
+                        expected_edges.emplace(u, v);
+        REQUIRE(!expected_edges.empty());
+        REQUIRE(edges == expected_edges);
+        REQUIRE(edge_maps.size() == 1);
+    }
+}
+
+TEST_CASE("Distributed trees with the edges resolved in a single exchange", "[distributed_tmt][lean]")
+{
+    const Position shape { 16, 9, 8 };
+    Grid g = random_grid(shape, 37);
+
+    for(bool negate : { false, true })
+    {
+        MergeTree mt(negate);
+        reeber::compute_merge_tree2(mt, reeber::Box<3>(shape), g);
+        auto expected = persistence_pairs(mt);
+
+        for(int k : { 2, 4 })
+        {
+            reeber::MergeOptions options;
+            options.lean = true;
+            options.k    = k;
+            INFO("negate = " << negate << ", k = " << k);
+            REQUIRE(distributed_pairs(g, 8, options, negate) == expected);
+        }
+    }
+}
+
+TEST_CASE("Distributed trees premerged on each process", "[distributed_tmt][premerge]")
+{
+    const Position shape { 16, 9, 8 };
+    Grid g = random_grid(shape, 41);
+
+    for(bool negate : { false, true })
+    {
+        MergeTree mt(negate);
+        reeber::compute_merge_tree2(mt, reeber::Box<3>(shape), g);
+        auto expected = persistence_pairs(mt);
+
+        for(int nblocks : { 4, 8 })
+            for(int k : { 2, 4 })
+            {
+                reeber::MergeOptions options;
+                options.premerge = true;
+                options.k        = k;
+                INFO("negate = " << negate << ", nblocks = " << nblocks << ", k = " << k);
+                REQUIRE(distributed_pairs(g, nblocks, options, negate) == expected);
+            }
+    }
+}
+
+TEST_CASE("Distributed trees simplified in the reduction keep the persistent pairs", "[distributed_tmt][epsilon]")
+{
+    const Position shape { 18, 9, 8 };
+    Grid g = random_grid(shape, 43);
+
+    // the pairs of persistence at least epsilon and the roots (their saddle is the minimum itself)
+    auto persistent = [](const std::vector<Pair>& pairs, double epsilon)
+    {
+        std::vector<Pair> result;
+        for(auto& p : pairs)
+            if (std::get<0>(p) == std::get<2>(p) || std::abs(std::get<3>(p) - std::get<1>(p)) >= epsilon)
+                result.push_back(p);
+        return result;
+    };
+
+    for(bool negate : { false, true })
+        for(auto nblocks_k : { std::make_pair(9, 3), std::make_pair(8, 4) })
+        {
+            reeber::MergeOptions options;
+            options.k = nblocks_k.second;
+            auto full = distributed_pairs(g, nblocks_k.first, options, negate);
+
+            for(double epsilon : { 0.05, 0.2 })
+            {
+                options.epsilon = epsilon;
+                auto simplified = distributed_pairs(g, nblocks_k.first, options, negate);
+
+                INFO("negate = " << negate << ", nblocks = " << nblocks_k.first << ", k = " << options.k << ", epsilon = " << epsilon);
+                REQUIRE(persistent(full, epsilon).size() < full.size());
+                REQUIRE(persistent(simplified, epsilon) == persistent(full, epsilon));
+            }
+        }
+}
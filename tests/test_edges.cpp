@@ -0,0 +1,77 @@
+#include "catch/catch.hpp"
+
+#include <reeber/edges.h>
+
+#include "common.h"
+
+using namespace test;
+
+TEST_CASE("FlatEdgeMap join", "[edges]")
+{
+    using EdgeMap = reeber::FlatEdgeMap<Index, double>;
+    using Record = EdgeMap::Record;
+
+    EdgeMap ours;
+    ours.insert({ Record { 5, 1, 0.5, 5 }, Record { 1, 2, 0.1, 1 }, Record { 3, 4, 0.3, 3 }, Record { 1, 7, 0.2, 7 } });
+
+    EdgeMap::Records theirs { Record { 1, 2, 1.1, 2 }, Record { 2, 9, 1.2, 9 }, Record { 5, 1, 1.5, 1 }, Record { 6, 0, 1.6, 6 } };
+
+    std::vector<std::pair<Record, Record>> matched;
+    std::vector<Record> unmatched;
+    ours.join(theirs,
+              [&matched](const Record& x, const Record& y) { matched.emplace_back(x, y); },
+              [&unmatched](const Record& y) { unmatched.push_back(y); });
+
+    REQUIRE(matched.size() == 2);
+    REQUIRE(matched[0].first.same_edge(Record { 1, 2, 0, 0 }));
+    REQUIRE(matched[0].first.value == 0.1);
+    REQUIRE(matched[0].second.value == 1.1);
+    REQUIRE(matched[1].first.same_edge(Record { 5, 1, 0, 0 }));
+    REQUIRE(matched[1].second.s == 1);
+
+    REQUIRE(unmatched.size() == 2);
+    REQUIRE(unmatched[0].same_edge(Record { 2, 9, 0, 0 }));
+    REQUIRE(unmatched[1].same_edge(Record { 6, 0, 0, 0 }));
+
+    // the matched edges are gone, the rest stay sorted
+    REQUIRE(ours.size() == 2);
+    REQUIRE(ours.records()[0].same_edge(Record { 1, 7, 0, 0 }));
+    REQUIRE(ours.records()[1].same_edge(Record { 3, 4, 0, 0 }));
+    REQUIRE(ours.find(1, 2) == ours.end());
+    REQUIRE(ours.find(3, 4) != ours.end());
+}
+
+TEST_CASE("FlatEdgeMap from and to an EdgeMap", "[edges]")
+{
+    using EdgeMap = reeber::EdgeMap<Index, double>;
+    using FlatEdgeMap = reeber::FlatEdgeMap<Index, double>;
+
+    EdgeMap m;
+    for(Index u = 0; u < 50; ++u)
+        m.emplace(std::make_tuple(u, (u * 7) % 50), std::make_tuple(double(u) / 50, u / 2));
+
+    for(bool swap_endpoints : { false, true })
+    {
+        FlatEdgeMap flat(m, swap_endpoints);
+        REQUIRE(flat.size() == m.size());
+        REQUIRE(std::is_sorted(flat.begin(), flat.end()));
+
+        for(auto& kv : m)
+        {
+            Index u, v;
+            std::tie(u, v) = kv.first;
+            if (swap_endpoints)
+                std::swap(u, v);
+            auto it = flat.find(u, v);
+            REQUIRE(it != flat.end());
+            REQUIRE(it->value == std::get<0>(kv.second));
+            REQUIRE(it->s == std::get<1>(kv.second));
+        }
+
+        EdgeMap copy;
+        flat.copy_to(copy, swap_endpoints);
+        REQUIRE(copy.size() == m.size());
+        for(auto& kv : m)
+            REQUIRE(copy.at(kv.first) == kv.second);
+    }
+}
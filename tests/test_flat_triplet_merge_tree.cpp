@@ -0,0 +1,57 @@
+#include "catch/catch.hpp"
+
+#include <algorithm>
+
+#include <reeber/box.h>
+#include <reeber/flat-triplet-merge-tree.h>
+
+#include "common.h"
+
+using namespace test;
+
+using FlatMergeTree = reeber::FlatTripletMergeTree<Index, double>;
+
+TEST_CASE("Flat and triplet merge trees have the same persistence pairs", "[triplet_merge_tree][flat_triplet_merge_tree]")
+{
+    const Position shape { 13, 11, 9 };
+    Grid g = random_grid(shape, 5);
+    reeber::Box<3> box(shape);
+
+    SECTION("full domain")
+    {
+        MergeTree mt;
+        FlatMergeTree fmt;
+        reeber::compute_merge_tree2(mt, box, g);
+        reeber::compute_merge_tree2(fmt, box, g);
+
+        REQUIRE(not persistence_pairs(mt).empty());
+        REQUIRE(persistence_pairs(fmt) == persistence_pairs(mt));
+    }
+
+    SECTION("with threshold")
+    {
+        MergeTree mt;
+        FlatMergeTree fmt;
+        reeber::compute_merge_tree2(mt, box, g, 0.6);
+        reeber::compute_merge_tree2(fmt, box, g, box.local_index(), 0.6);
+
+        REQUIRE(not persistence_pairs(mt).empty());
+        REQUIRE(persistence_pairs(fmt) == persistence_pairs(mt));
+
+        // the serial construction skips the same vertices
+        MergeTree serial;
+        reeber::compute_merge_tree(serial, box, g, 0.6);
+        REQUIRE(persistence_pairs(serial) == persistence_pairs(mt));
+        REQUIRE(mt.size() == size_t(std::count_if(g.data(), g.data() + g.size(), [](double x) { return x <= 0.6; })));
+    }
+
+    SECTION("negated")
+    {
+        MergeTree mt(true);
+        FlatMergeTree fmt(true);
+        reeber::compute_merge_tree2(mt, box, g);
+        reeber::compute_merge_tree2(fmt, box, g);
+
+        REQUIRE(persistence_pairs(fmt) == persistence_pairs(mt));
+    }
+}
@@ -0,0 +1,116 @@
+#include "catch/catch.hpp"
+
+#include <map>
+
+#include <reeber/box.h>
+
+#include "common.h"
+
+using namespace test;
+
+namespace
+{
+    // mt with every vertex u renamed to stride * u
+    MergeTree spread_out(const MergeTree& mt, Index stride)
+    {
+        MergeTree result(mt.negate());
+        for(auto& x : mt.nodes())
+            result.add(stride * x.first, x.second->value);
+        for(auto& x : mt.nodes())
+        {
+            auto u = x.second;
+            auto s = std::get<0>(u->parent());
+            auto v = std::get<1>(u->parent());
+            result.link(result[stride * u->vertex], result[stride * s->vertex], result[stride * v->vertex]);
+        }
+        return result;
+    }
+
+    std::vector<Index> vertices(const MergeTree& mt, Index stride = 1)
+    {
+        std::vector<Index> result;
+        for(auto& x : mt.nodes())
+            result.push_back(x.first / stride);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+}
+
+TEST_CASE("KeepSet over dense and sparse ids", "[keep_set]")
+{
+    SECTION("dense integral ids use the marker array")
+    {
+        std::map<long, int> nodes;
+        for(long v = -5; v < 20; ++v)
+            nodes[v] = 0;
+
+        reeber::detail::KeepSet<long> keep(nodes);
+        for(long v : { -5L, 0L, 7L, 19L })
+            keep.insert(v);
+
+        for(long v = -10; v < 30; ++v)
+            REQUIRE(keep.contains(v) == (v == -5 || v == 0 || v == 7 || v == 19));
+    }
+
+    SECTION("sparse integral ids fall back to the set")
+    {
+        std::map<size_t, int> nodes;
+        for(size_t v = 0; v < 10; ++v)
+            nodes[v * 1000] = 0;
+
+        reeber::detail::KeepSet<size_t> keep(nodes);
+        keep.insert(3000);
+        keep.insert(9000);
+
+        for(size_t v = 0; v < 10000; ++v)
+            REQUIRE(keep.contains(v) == (v == 3000 || v == 9000));
+    }
+
+    SECTION("empty trees")
+    {
+        std::map<int, int> nodes;
+        reeber::detail::KeepSet<int> keep(nodes);
+        REQUIRE(!keep.contains(0));
+        keep.insert(0);
+        REQUIRE(keep.contains(0));
+    }
+
+    SECTION("non-integral ids")
+    {
+        std::map<double, int> nodes { { 0.5, 0 }, { 2.5, 0 } };
+
+        reeber::detail::KeepSet<double> keep(nodes);
+        keep.insert(2.5);
+        REQUIRE(keep.contains(2.5));
+        REQUIRE(!keep.contains(0.5));
+    }
+}
+
+TEST_CASE("Sparsify keeps the same nodes with dense and sparse ids", "[keep_set][sparsify]")
+{
+    const Position shape { 9, 8, 7 };
+    Grid g = random_grid(shape, 5);
+    reeber::Box<3> box(shape);
+
+    MergeTree mt;
+    reeber::compute_merge_tree2(mt, box, g);
+
+    const Index stride = 1000;
+    auto special = [](Index u) { return u % 17 == 0; };
+
+    MergeTree dense, sparse;
+    MergeTree mt_sparse = spread_out(mt, stride);
+    reeber::sparsify(dense, mt, special);
+    reeber::sparsify(sparse, mt_sparse, [&](Index u) { return special(u / stride); });
+    REQUIRE(!vertices(dense).empty());
+    REQUIRE(vertices(sparse, stride) == vertices(dense));
+
+    reeber::sparsify(mt, special);
+    reeber::sparsify(mt_sparse, [&](Index u) { return special(u / stride); });
+    REQUIRE(vertices(mt_sparse, stride) == vertices(mt));
+    REQUIRE(vertices(mt) == vertices(dense));
+
+    reeber::remove_degree_two(mt, special);
+    reeber::remove_degree_two(mt_sparse, [&](Index u) { return special(u / stride); });
+    REQUIRE(vertices(mt_sparse, stride) == vertices(mt));
+}
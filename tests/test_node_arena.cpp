@@ -0,0 +1,125 @@
+#include "catch/catch.hpp"
+
+#include <set>
+#include <vector>
+
+#include <reeber/box.h>
+#include <reeber/node-arena.h>
+
+#include "common.h"
+
+using namespace test;
+
+namespace
+{
+    struct Item
+    {
+        int     x = 0;
+        double  y = 0;
+    };
+
+    using Arena = reeber::NodeArena<Item>;
+
+    // counts its live instances, to check that the tree destroys its nodes
+    struct Counted
+    {
+        static int  live;
+
+                    Counted()                           { ++live; }
+                    Counted(const Counted&)             { ++live; }
+                    ~Counted()                          { --live; }
+        Counted&    operator=(const Counted&)           =default;
+        Counted&    operator+=(const Counted&)          { return *this; }
+    };
+
+    int Counted::live = 0;
+}
+
+TEST_CASE("NodeArena allocation and ids", "[node_arena]")
+{
+    Arena arena;
+
+    std::vector<std::pair<Item*, Arena::Id>> items;
+    for(size_t i = 0; i < 3 * Arena::slab_size / 2; ++i)
+    {
+        Arena::Id id;
+        Item* p = arena.allocate(id);
+        p->x = i;
+        items.emplace_back(p, id);
+    }
+    REQUIRE(arena.n_slabs() == 2);
+
+    for(size_t i = 0; i < items.size(); ++i)
+    {
+        REQUIRE(Arena::pointer(items[i].second) == items[i].first);
+        REQUIRE(items[i].first->x == int(i));
+    }
+
+    SECTION("freed nodes are reused with their ids")
+    {
+        arena.deallocate(items[5].first, items[5].second);
+        arena.deallocate(items[7].first, items[7].second);
+
+        Arena::Id id;
+        REQUIRE(arena.allocate(id) == items[7].first);
+        REQUIRE(id == items[7].second);
+        REQUIRE(arena.allocate(id) == items[5].first);
+        REQUIRE(id == items[5].second);
+        REQUIRE(arena.n_slabs() == 2);
+    }
+}
+
+TEST_CASE("NodeArena returns its slabs to the pool", "[node_arena]")
+{
+    size_t limit = Arena::pool_limit();
+
+    std::set<Item*> first;
+    {
+        Arena arena;
+        for(size_t i = 0; i < 2 * Arena::slab_size; ++i)
+            first.insert(arena.allocate());
+    }
+    REQUIRE(Arena::pool_size() >= 2);
+
+    SECTION("the next arena takes the released slabs")
+    {
+        Arena arena;
+        REQUIRE(first.count(arena.allocate()));
+    }
+
+    SECTION("the pool frees the slabs above its limit")
+    {
+        Arena::set_pool_limit(1);
+        REQUIRE(Arena::pool_size() == 1);
+
+        {
+            Arena arena;
+            for(size_t i = 0; i < 3 * Arena::slab_size; ++i)
+                arena.allocate();
+            REQUIRE(arena.n_slabs() == 3);
+            REQUIRE(Arena::pool_size() == 0);
+        }
+        REQUIRE(Arena::pool_size() == 1);
+
+        Arena::set_pool_limit(limit);
+    }
+}
+
+TEST_CASE("TripletMergeTree destroys the nodes it frees and keeps", "[node_arena][triplet_merge_tree]")
+{
+    using CountedTree = reeber::TripletMergeTree<Index, double, Counted>;
+
+    const Position shape { 9, 8, 7 };
+    Grid g = random_grid(shape, 3);
+    reeber::Box<3> box(shape);
+
+    {
+        CountedTree mt;
+        reeber::compute_merge_tree2(mt, box, g);
+        REQUIRE(Counted::live == int(mt.size()));
+
+        reeber::remove_degree_two(mt, [](Index) { return false; });
+        REQUIRE(Counted::live == int(mt.size()));
+    }
+    REQUIRE(Counted::live == 0);
+}
@@ -0,0 +1,96 @@
+#include "catch/catch.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <reeber/radix-sort.h>
+
+namespace
+{
+    // few distinct values, so that the vertex has to break many ties
+    template<class Value, class Vertex>
+    std::vector<std::pair<Value, Vertex>> random_pairs(size_t n, const std::vector<Value>& values, Vertex min_vertex, unsigned seed)
+    {
+        std::mt19937 gen(seed);
+        std::uniform_int_distribution<size_t> pick(0, values.size() - 1);
+
+        std::vector<std::pair<Value, Vertex>> result;
+        for(size_t i = 0; i < n; ++i)
+            result.emplace_back(values[pick(gen)], Vertex(min_vertex + Vertex(i)));
+        return result;
+    }
+
+    template<class Value, class Vertex>
+    void check_sort(std::vector<std::pair<Value, Vertex>> vertices)
+    {
+        using ValueVertex = std::pair<Value, Vertex>;
+
+        for(bool descending : { false, true })
+        {
+            auto expected = vertices;
+            if (descending)
+                std::sort(expected.begin(), expected.end(), std::greater<ValueVertex>());
+            else
+                std::sort(expected.begin(), expected.end(), std::less<ValueVertex>());
+
+            auto sorted = vertices;
+            reeber::sort_value_vertex(sorted, descending);
+            REQUIRE(sorted == expected);
+
+            // vertices in the opposite order, as the topology gives them with negate
+            auto reversed = vertices;
+            std::reverse(reversed.begin(), reversed.end());
+            reeber::sort_value_vertex(reversed, descending);
+            REQUIRE(reversed == expected);
+
+            auto shuffled = vertices;
+            std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1));
+            reeber::sort_value_vertex(shuffled, descending);
+            REQUIRE(shuffled == expected);
+        }
+    }
+}
+
+TEST_CASE("sort_value_vertex orders by value, then vertex", "[radix_sort]")
+{
+    const double inf = std::numeric_limits<double>::infinity();
+
+    SECTION("double values, size_t vertices")
+    {
+        std::vector<double> values { -inf, -1e300, -2.5, -0.0, 0.0, 1e-310, 0.5, 3.0, 1e300, inf };
+        check_sort(random_pairs<double, size_t>(5000, values, size_t(1) << 40, 3));
+    }
+
+    SECTION("float values, signed vertices")
+    {
+        std::vector<float> values { -7.f, -1.f, 0.f, 0.25f, 2.f };
+        check_sort(random_pairs<float, int>(5000, values, -2500, 4));
+    }
+
+    SECTION("integral values")
+    {
+        std::vector<std::int64_t> values { std::numeric_limits<std::int64_t>::min(), -3, 0, 5, std::numeric_limits<std::int64_t>::max() };
+        check_sort(random_pairs<std::int64_t, std::uint32_t>(5000, values, 0, 5));
+    }
+
+    SECTION("input large enough for 16-bit digits")
+    {
+        std::vector<double> values;
+        std::mt19937 gen(6);
+        std::uniform_real_distribution<double> dis(-1, 1);
+        for(int i = 0; i < 1000; ++i)
+            values.push_back(dis(gen));
+        check_sort(random_pairs<double, size_t>((size_t(1) << 20) + 17, values, 0, 7));
+    }
+
+    SECTION("trivial sizes")
+    {
+        check_sort(std::vector<std::pair<double, size_t>>());
+        check_sort(std::vector<std::pair<double, size_t>> { { 1.0, 3 } });
+    }
+}
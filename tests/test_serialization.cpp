@@ -0,0 +1,166 @@
+#include "catch/catch.hpp"
+
+#include <diy/serialization.hpp>
+
+#include <reeber/box.h>
+#include <reeber/triplet-merge-tree-serialization.h>
+
+#include "common.h"
+
+using namespace test;
+
+namespace
+{
+    // all (value, vertex) pairs of the tree, including the collapsed ones, sorted
+    std::vector<std::pair<double, Index>> all_vertices(const MergeTree& mt)
+    {
+        std::vector<std::pair<double, Index>> result;
+        for(auto& x : mt.nodes())
+            for(auto& vv : x.second->vertices)
+                result.push_back(vv);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+}
+
+TEST_CASE("Serialization of TripletMergeTree", "[triplet_merge_tree][serialization]")
+{
+    const Position shape { 13, 6, 5 };
+    Grid g = random_grid(shape, 2);
+
+    MergeTree mt;
+    reeber::compute_merge_tree(mt, reeber::Box<3>(shape), g);
+    const MergeTree& cmt = mt;
+
+    SECTION("round trip")
+    {
+        diy::MemoryBuffer bb;
+        reeber::Serialization<MergeTree>::save(bb, mt);
+        bb.reset();
+
+        MergeTree loaded;
+        reeber::Serialization<MergeTree>::load(bb, loaded);
+
+        REQUIRE(loaded.size() == mt.size());
+        REQUIRE(persistence_pairs(loaded) == persistence_pairs(mt));
+        REQUIRE(all_vertices(loaded) == all_vertices(mt));
+    }
+
+    SECTION("without the vertices")
+    {
+        diy::MemoryBuffer bb;
+        reeber::Serialization<MergeTree>::save(bb, mt, false);
+        bb.reset();
+
+        MergeTree loaded;
+        reeber::Serialization<MergeTree>::load(bb, loaded);
+
+        REQUIRE(persistence_pairs(loaded) == persistence_pairs(mt));
+        REQUIRE(all_vertices(loaded).empty());
+    }
+
+    SECTION("negated tree")
+    {
+        MergeTree nmt(true);
+        reeber::compute_merge_tree(nmt, reeber::Box<3>(shape), g);
+
+        diy::MemoryBuffer bb;
+        reeber::Serialization<MergeTree>::save(bb, nmt);
+        bb.reset();
+
+        MergeTree loaded;
+        reeber::Serialization<MergeTree>::load(bb, loaded);
+
+        REQUIRE(loaded.negate());
+        REQUIRE(persistence_pairs(loaded) == persistence_pairs(nmt));
+    }
+
+    SECTION("load into a non-empty tree")
+    {
+        // two disjoint parts of the same grid
+        reeber::Box<3> left(shape, Position { 0, 0, 0 }, Position { 5, 5, 4 });
+        reeber::Box<3> right(shape, Position { 7, 0, 0 }, Position { 12, 5, 4 });
+
+        MergeTree mt_left, mt_right;
+        reeber::compute_merge_tree(mt_left, left, g);
+        reeber::compute_merge_tree(mt_right, right, g);
+
+        std::vector<Pair> expected = persistence_pairs(mt_left);
+        for(auto& p : persistence_pairs(mt_right))
+            expected.push_back(p);
+        std::sort(expected.begin(), expected.end());
+
+        diy::MemoryBuffer bb;
+        reeber::Serialization<MergeTree>::save(bb, mt_right);
+        bb.reset();
+
+        size_t left_size = mt_left.size();
+        reeber::Serialization<MergeTree>::load(bb, mt_left);
+
+        REQUIRE(mt_left.size() == left_size + mt_right.size());
+        REQUIRE(persistence_pairs(mt_left) == expected);
+    }
+
+    SECTION("load a copy into the tree")
+    {
+        using CountTree = reeber::TripletMergeTree<Index, double, size_t>;
+
+        CountTree ct;
+        reeber::compute_merge_tree2(ct, reeber::Box<3>(shape), g, reeber::aggregate_with([](Index, double) { return size_t(1); }));
+
+        diy::MemoryBuffer bb;
+        reeber::Serialization<CountTree>::save(bb, ct);
+        bb.reset();
+
+        auto expected = persistence_pairs(ct);
+        size_t size = ct.size();
+        reeber::Serialization<CountTree>::load(bb, ct);
+
+        // the vertices already there keep their nodes and aggregates
+        REQUIRE(ct.size() == size);
+        REQUIRE(persistence_pairs(ct) == expected);
+
+        size_t total = 0;
+        for(auto& x : static_cast<const CountTree&>(ct).nodes())
+            total += x.second->aggregate();
+        REQUIRE(total == g.size());
+    }
+
+    SECTION("legacy format")
+    {
+        // the layout of the original format: per node u, value, s, v and the collapsed vertices
+        diy::MemoryBuffer bb;
+        diy::save(bb, true);
+        diy::save(bb, mt.negate());
+        size_t n_nodes = cmt.nodes().size();
+        diy::save(bb, n_nodes);
+        for(auto& x : cmt.nodes())
+        {
+            auto n = x.second;
+            auto parent = n->parent();
+            diy::save(bb, n->vertex);
+            diy::save(bb, n->value);
+            diy::save(bb, std::get<0>(parent)->vertex);
+            diy::save(bb, std::get<1>(parent)->vertex);
+            std::vector<std::pair<double, Index>> vertices(n->vertices.begin(), n->vertices.end());
+            diy::save(bb, vertices);
+        }
+        bb.reset();
+
+        MergeTree loaded;
+        reeber::Serialization<MergeTree>::load(bb, loaded);
+
+        REQUIRE(persistence_pairs(loaded) == persistence_pairs(mt));
+        REQUIRE(all_vertices(loaded) == all_vertices(mt));
+    }
+
+    SECTION("unknown format")
+    {
+        diy::MemoryBuffer bb;
+        diy::save(bb, (unsigned char) 3);
+        bb.reset();
+
+        MergeTree loaded;
+        REQUIRE_THROWS_AS(reeber::Serialization<MergeTree>::load(bb, loaded), std::runtime_error);
+    }
+}
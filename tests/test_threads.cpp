@@ -0,0 +1,98 @@
+#include "catch/catch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <reeber/box.h>
+#include <reeber/parallel-tbb.h>
+#include <reeber/parallel-threads.h>
+
+#include "common.h"
+
+// built with REEBER_USE_THREADS, see CMakeLists.txt
+
+using namespace test;
+
+TEST_CASE("Thread indices are dense and reused", "[threads]")
+{
+    SECTION("threads alive at once get distinct indices")
+    {
+        const unsigned n = 8;
+        std::vector<unsigned> indices(n);
+        std::atomic<unsigned> arrived { 0 };
+
+        std::vector<std::thread> threads;
+        for(unsigned i = 0; i < n; ++i)
+            threads.emplace_back([&, i]() {
+                indices[i] = reeber::threads::thread_index();
+                ++arrived;
+                while (arrived < n)
+                    std::this_thread::yield();
+            });
+        for(auto& t : threads)
+            t.join();
+
+        REQUIRE(std::set<unsigned>(indices.begin(), indices.end()).size() == n);
+    }
+
+    SECTION("exited threads give their indices back")
+    {
+        std::set<unsigned> indices;
+        for(unsigned i = 0; i < 100; ++i)
+        {
+            std::thread t([&indices]() { indices.insert(reeber::threads::thread_index()); });
+            t.join();
+        }
+        REQUIRE(indices.size() == 1);
+    }
+}
+
+TEST_CASE("Parallel loops and thread-specific storage", "[threads]")
+{
+    reeber::task_scheduler_init init(4);
+
+    const size_t n = 100000;
+
+    SECTION("for_each visits every index once")
+    {
+        std::vector<std::atomic<int>> visits(n);
+        for(auto& x : visits)
+            x = 0;
+        reeber::for_each(0, n, [&visits](size_t i) { ++visits[i]; });
+
+        REQUIRE(std::all_of(visits.begin(), visits.end(), [](const std::atomic<int>& x) { return x == 1; }));
+    }
+
+    SECTION("thread_specific sums")
+    {
+        reeber::thread_specific<size_t> sums;
+        reeber::for_each(0, n, [&sums](size_t i) { sums.local() += i; });
+
+        size_t total = 0;
+        sums.combine_each([&total](size_t x) { total += x; });
+        REQUIRE(total == n * (n - 1) / 2);
+    }
+}
+
+TEST_CASE("Parallel and serial trees agree", "[threads][triplet_merge_tree]")
+{
+    reeber::task_scheduler_init init(4);
+
+    const Position shape { 24, 20, 18 };
+    Grid g = random_grid(shape, 7);
+    reeber::Box<3> box(shape);
+
+    MergeTree serial, parallel;
+    reeber::compute_merge_tree(serial, box, g);
+    reeber::compute_merge_tree2(parallel, box, g);
+
+    REQUIRE(persistence_pairs(parallel) == persistence_pairs(serial));
+
+    reeber::remove_degree_two(parallel, [](Index) { return false; });
+    reeber::remove_degree_two(serial, [](Index) { return false; });
+    REQUIRE(persistence_pairs(parallel) == persistence_pairs(serial));
+    REQUIRE(parallel.n_vertices_total() == box.size());
+}
@@ -0,0 +1,11 @@
+#define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_NO_POSIX_SIGNALS       // Catch 2.3 uses SIGSTKSZ as a constant, newer glibc doesn't define it so
+#include "catch/catch.hpp"
+
+#include <diy/mpi.hpp>
+
+int main(int argc, char* argv[])
+{
+    diy::mpi::environment   env(argc, argv);
+    return Catch::Session().run(argc, argv);
+}